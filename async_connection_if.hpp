@@ -0,0 +1,35 @@
+#ifndef __ASYNC_CONNECTION_IF_HPP__
+#define __ASYNC_CONNECTION_IF_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "task.hpp"
+#include "status.hpp"
+
+// Awaitable counterpart of connection_if, a pending operation suspends the coroutine instead of the thread
+class async_connection_if
+{
+public:
+	virtual task<status> async_read(std::string &message) = 0;
+	virtual task<status> async_write(std::string_view message) = 0;
+
+	// Gives up with status::read_timeout if no message starts arriving within the timeout
+	virtual task<status> async_read(std::string &message, std::chrono::milliseconds timeout) = 0;
+
+	// False once the process on the other side is known to be gone
+	virtual bool peer_alive() = 0;
+
+	// Identifies the session in traces
+	[[nodiscard]] virtual uint64_t session_key() const = 0;
+
+	// Process that sent the latest message, 0 while none has arrived
+	[[nodiscard]] virtual uint64_t peer_process() = 0;
+
+	// Process that took the latest message sent, 0 while none has been taken
+	[[nodiscard]] virtual uint64_t reader_process() = 0;
+};
+
+#endif // !__ASYNC_CONNECTION_IF_HPP__
@@ -0,0 +1,117 @@
+#ifndef __ASYNC_MUTEX_HPP__
+#define __ASYNC_MUTEX_HPP__
+
+#include <mutex>
+#include <list>
+#include <utility>
+#include <coroutine>
+
+#include "executor.hpp"
+
+// Mutex for coroutines: a waiter is suspended instead of blocking its worker thread,
+// and the lock may be released on a different thread than the one that took it
+class async_mutex
+{
+private:
+	struct waiter
+	{
+		std::coroutine_handle<> handle;
+		executor *scheduler;
+	};
+
+	std::mutex guard;
+	bool locked = false;
+	// Not a deque: that allocates on construction, and every tank of the fleet has a mutex
+	std::list<waiter> waiters;
+
+public:
+	class lock_guard
+	{
+	private:
+		async_mutex *owner;
+
+	public:
+		explicit lock_guard(async_mutex *owner) noexcept: owner(owner)
+		{}
+
+		lock_guard(lock_guard &&other) noexcept: owner(std::exchange(other.owner, nullptr))
+		{}
+
+		lock_guard(const lock_guard &) = delete;
+		lock_guard &operator=(const lock_guard &) = delete;
+		lock_guard &operator=(lock_guard &&) = delete;
+
+		~lock_guard()
+		{
+			if (owner)
+			{
+				owner->unlock();
+			}
+		}
+	};
+
+	[[nodiscard]] bool try_lock()
+	{
+		auto lock = std::lock_guard(guard);
+		return !std::exchange(locked, true);
+	}
+
+	[[nodiscard]] auto lock() noexcept
+	{
+		struct lock_awaiter
+		{
+			async_mutex &mutex;
+
+			bool await_ready() const
+			{
+				return mutex.try_lock();
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle) const
+			{
+				auto lock = std::lock_guard(mutex.guard);
+				if (!mutex.locked)
+				{
+					mutex.locked = true;
+					return false;
+				}
+
+				mutex.waiters.push_back({ handle, executor::current() });
+				return true;
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		return lock_awaiter{ *this };
+	}
+
+	// co_await mutex.scoped_lock() holds the mutex until the returned guard is destroyed
+	[[nodiscard]] task<lock_guard> scoped_lock()
+	{
+		co_await lock();
+		co_return lock_guard(this);
+	}
+
+	// Ownership passes straight to the first waiter
+	void unlock()
+	{
+		auto next = waiter();
+		{
+			auto lock = std::lock_guard(guard);
+			if (waiters.empty())
+			{
+				locked = false;
+				return;
+			}
+
+			next = waiters.front();
+			waiters.pop_front();
+		}
+
+		next.scheduler->schedule(next.handle);
+	}
+};
+
+#endif // !__ASYNC_MUTEX_HPP__
@@ -2,217 +2,937 @@
 #define __CLI_HPP__
 
 #include <regex>
+#include <charconv>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <memory_resource>
 
+#include "tank_ids.hpp"
+#include "fleet.hpp"
+#include "transfer_planner.hpp"
+#include "fleet_config.hpp"
+#include "export_directory.hpp"
+#include "tracing.hpp"
+#include "tank_lease.hpp"
+#include "rate_limiter.hpp"
+#include "sampling_profiler.hpp"
 #include "storage_tank.hpp"
-#include "connection_if.hpp"
+#include "async_connection_if.hpp"
 
-using session_t = std::pair<std::shared_ptr<connection_if>, storage_tank &>;
+using session_t = std::pair<std::shared_ptr<async_connection_if>, storage_tank &>;
+
+// Session over the whole fleet, tanks are locked only by the transfers it plans
+using fleet_session_t = std::pair<std::shared_ptr<async_connection_if>, fleet &>;
+
+// Match results live in the arena of the session, so they do not allocate on every command
+using match_t = std::match_results<std::string::const_iterator, std::pmr::polymorphic_allocator<std::ssub_match>>;
+
+// What a tank command does with its tank: a read may run in a session that has given the lease up,
+// a transfer spends most of its time waiting for the product to move
+enum class command_kind
+{
+	change,
+	read,
+	transfer
+};
+
+// A handler gets the turn of its command as well, to let the others run while it only waits; most have no use for it
+template <typename S>
+struct command_handler
+{
+	using function = std::function<task<status>(match_t &, S &, rate_limiter::turn &)>;
+
+	std::regex pattern;
+	function run;
+	command_kind kind;
+
+	template <typename F>
+	command_handler(std::regex pattern, F handler, command_kind kind = command_kind::change): pattern(std::move(pattern)), kind(kind)
+	{
+		if constexpr (std::is_invocable_v<F, match_t &, S &, rate_limiter::turn &>)
+		{
+			run = std::move(handler);
+		}
+		else
+		{
+			run = [handler](match_t &sm, S &session, rate_limiter::turn &) { return handler(sm, session); };
+		}
+	}
+};
 
 class cli
 {
 private:
-	static inline std::vector<std::pair<std::regex, std::function<status(std::smatch &, session_t &)>>> cli_handler
+	// Responses are built in the session arena, which the match results come from as well
+	[[nodiscard]] static std::pmr::string make_response(const match_t &sm)
+	{
+		return std::pmr::string(sm.get_allocator());
+	}
+	
+	static std::pmr::string &append_number(std::pmr::string &text, uint64_t value)
+	{
+		char number[24];
+		return text.append(number, std::to_chars(number, std::end(number), value).ptr);
+	}
+	
+	static std::pmr::string &append_milliseconds(std::pmr::string &text, std::chrono::nanoseconds duration)
+	{
+		char number[32];
+		auto milliseconds = std::chrono::duration<double, std::milli>(duration).count();
+		return text.append(number, std::to_chars(number, std::end(number), milliseconds, std::chars_format::fixed, 3).ptr);
+	}
+	
+	// "matches: N" and then one line per tank: id, level, fill in percent of the upper acceptable level
+	static void append_index_entries(std::pmr::string &text, const std::vector<fleet_index::entry> &entries, bool truncated)
+	{
+		append_number(text.append("matches: "), entries.size()).append(truncated ? "+" : "");
+		
+		for (auto &&entry : entries)
+		{
+			auto fill_tenths = entry.fill / (fleet_index::fill_scale / 1000);
+			append_number(text.append("\n"), entry.id);
+			append_number(text.append(" "), entry.level);
+			append_number(text.append(" "), fill_tenths / 10);
+			append_number(text.append("."), fill_tenths % 10).append("%");
+		}
+	}
+	
+	// A transfer sleeps without the turn of its command
+	[[nodiscard]] static storage_tank::transfer_wait waiting_without(rate_limiter::turn &turn)
+	{
+		return [&turn](std::chrono::seconds duration) { return turn.without(storage_tank::sleep(duration)); };
+	}
+	
+	static inline std::vector<command_handler<session_t>> cli_handler
 	{
 		{ std::regex("set download speed (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_download_speed(std::stoull(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set unloading speed (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_unloading_speed(std::stoull(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set lower permissible level (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_lower_permissible_level(std::stoull(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set upper acceptable level (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_upper_acceptable_level(std::stoull(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set level of oil products (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_level_of_oil_products(std::stoull(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set working state (work|non-work)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_working_state(st::stows(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set loading pump status (active|inactive)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_loading_pump_status(st::stoas(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
 		{ std::regex("set unloading pump status (active|inactive)"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
 				current_tank.set_unloading_pump_status(st::stoas(sm[1]));
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
-		{ std::regex("get download speed"),
-			[](std::smatch &sm, session_t &session)
+		{ std::regex("set product grade (crude|gasoline|diesel|kerosene|fuel-oil)"),
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(std::to_string(current_tank.get_download_speed()));
+				if (auto result = current_tank.set_product_grade(st::stopg(sm[1].str()).value()); st::is_not_success(result))
+				{
+					co_return result;
+				}
+				
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
+		{ std::regex("get download speed"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				co_return co_await current_session->async_write(std::to_string(current_tank.get_download_speed()));
+			},
+			command_kind::read
+		},
 		{ std::regex("get unloading speed"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(std::to_string(current_tank.get_unloading_speed()));
-			}
+				co_return co_await current_session->async_write(std::to_string(current_tank.get_unloading_speed()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get lower permissible level"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(std::to_string(current_tank.get_lower_permissible_level()));
-			}
+				co_return co_await current_session->async_write(std::to_string(current_tank.get_lower_permissible_level()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get upper acceptable level"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(std::to_string(current_tank.get_upper_acceptable_level()));
-			}
+				co_return co_await current_session->async_write(std::to_string(current_tank.get_upper_acceptable_level()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get level of oil products"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(std::to_string(current_tank.get_level_of_oil_products()));
-			}
+				co_return co_await current_session->async_write(std::to_string(current_tank.get_level_of_oil_products()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get working state"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(st::wstos(current_tank.get_working_state()));
-			}
+				co_return co_await current_session->async_write(st::wstos(current_tank.get_working_state()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get loading pump status"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(st::astos(current_tank.get_loading_pump_status()));
-			}
+				co_return co_await current_session->async_write(st::astos(current_tank.get_loading_pump_status()));
+			},
+			command_kind::read
 		},
 		{ std::regex("get unloading pump status"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, session_t &session) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				return current_session->write(st::astos(current_tank.get_unloading_pump_status()));
-			}
+				co_return co_await current_session->async_write(st::astos(current_tank.get_unloading_pump_status()));
+			},
+			command_kind::read
+		},
+		{ std::regex("get product grade"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				co_return co_await current_session->async_write(st::pgtos(current_tank.get_product_grade()));
+			},
+			command_kind::read
 		},
-		{ std::regex("download (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+		{ std::regex("if-changed-since (\\d+)"),
+			[](match_t &sm, session_t &session) -> task<status>
 			{
+				// Only the field groups changed after the version the client already has, as "<field>: <value>" lines
 				auto &&[current_session, current_tank] = session;
-				auto oil = oil_product(std::stoull(sm[1]));
+				auto tank = current_tank.snapshot();
+				auto since = std::stoull(sm[1]);
 				
-				if (auto result = current_tank.download(oil); st::is_not_success(result))
+				if (tank.revision <= since)
 				{
-					return result;
+					co_return co_await current_session->async_write("not modified");
 				}
 				
-				return current_session->write("success");
-			}
+				auto changes = make_response(sm);
+				changes.append("version ");
+				append_number(changes, tank.revision);
+				
+				if (tank.changed_since(field_group::state, since))
+				{
+					changes.append("\nworking state: ").append(st::wstos(tank.work_state))
+						.append("\nloading pump status: ").append(st::astos(tank.loading_pump_status))
+						.append("\nunloading pump status: ").append(st::astos(tank.unloading_pump_status));
+				}
+				
+				if (tank.changed_since(field_group::limits, since))
+				{
+					append_number(changes.append("\nlower permissible level: "), tank.lower_permissible_level);
+					append_number(changes.append("\nupper acceptable level: "), tank.upper_acceptable_level);
+				}
+				
+				if (tank.changed_since(field_group::speeds, since))
+				{
+					append_number(changes.append("\ndownload speed: "), tank.download_speed);
+					append_number(changes.append("\nunloading speed: "), tank.unloading_speed);
+				}
+				
+				if (tank.changed_since(field_group::level, since))
+				{
+					append_number(changes.append("\nlevel of oil products: "), tank.level_of_oil_products);
+				}
+				
+				if (tank.changed_since(field_group::product, since))
+				{
+					changes.append("\nproduct grade: ").append(st::pgtos(tank.grade));
+				}
+				
+				co_return co_await current_session->async_write(changes);
+			},
+			command_kind::read
+		},
+		{ std::regex("download (\\d+)(?: (crude|gasoline|diesel|kerosene|fuel-oil))?"),
+			[](match_t &sm, session_t &session, rate_limiter::turn &turn) -> task<status>
+			{
+				// Without a grade the operation moves whatever the tank holds
+				auto &&[current_session, current_tank] = session;
+				auto oil = oil_product(std::stoull(sm[1]), sm[2].matched ? st::stopg(sm[2].str()).value() : current_tank.get_product_grade());
+				
+				if (auto result = co_await current_tank.download(oil, waiting_without(turn)); st::is_not_success(result))
+				{
+					co_return result;
+				}
+				
+				co_return co_await current_session->async_write(st::response(status::success));
+			},
+			command_kind::transfer
 		},
-		{ std::regex("unload (\\d+)"),
-			[](std::smatch &sm, session_t &session)
+		{ std::regex("unload (\\d+)(?: (crude|gasoline|diesel|kerosene|fuel-oil))?"),
+			[](match_t &sm, session_t &session, rate_limiter::turn &turn) -> task<status>
 			{
 				auto &&[current_session, current_tank] = session;
-				auto oil = oil_product(std::stoull(sm[1]));
+				auto oil = oil_product(std::stoull(sm[1]), sm[2].matched ? st::stopg(sm[2].str()).value() : current_tank.get_product_grade());
 				oil.set_content_volume(oil.get_capacity()); // TODO
 								
-				if (auto result = current_tank.unload(oil); st::is_not_success(result))
+				if (auto result = co_await current_tank.unload(oil, waiting_without(turn)); st::is_not_success(result))
 				{
-					return result;
+					co_return result;
 				}
 				
-				return current_session->write("success");
+				co_return co_await current_session->async_write(st::response(status::success));
+			},
+			command_kind::transfer
+		},
+		{ std::regex("rule when level (above|below) (\\d+) then (activate loading pump|deactivate loading pump|activate unloading pump|deactivate unloading pump|alert)"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				auto rule = trigger_table::trigger{ std::stoull(sm[2]), st::stotc(sm[1]), st::stota(sm[3]) };
+				
+				if (auto result = current_tank.get_triggers().add(rule); st::is_not_success(result))
+				{
+					co_return result;
+				}
+				
+				co_return co_await current_session->async_write(st::response(status::success));
 			}
 		},
+		{ std::regex("get rules"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				co_return co_await current_session->async_write(current_tank.get_triggers().to_string());
+			},
+			command_kind::read
+		},
+		{ std::regex("clear rules"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				current_tank.get_triggers().clear();
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		// The token and the number of times the session was resumed are checked by the session loop of the server
+		{ std::regex("resume \\d+ \\d+"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				// Marks the end of the responses a restarted client has missed, they are all in the queue before it
+				auto &&[current_session, current_tank] = session;
+				logging::inflog("the session is resumed by a new client");
+				
+				co_return co_await current_session->async_write("-- resumed --");
+			},
+			command_kind::read
+		},
 		{ std::regex("help"),
-			[](std::smatch &sm, session_t &session)
-			{
-				auto &&[current_session, current_tank] = session;
-				auto help_info = std::stringstream();
-				
-				help_info << "set download speed <number>\n"
-					<< "set unloading speed <number>\n"
-					<< "set lower permissible level <number>\n"
-					<< "set upper acceptable level <number>\n"
-					<< "set level of oil product <number>\n"
-					<< "set working state <work|non-work>\n"
-					<< "set loading pump status <active|inactive>\n"
-					<< "set unloading pump status <active|inactive>\n"
-					<< "get download speed\n"
-					<< "get unloading speed\n"
-					<< "get lower permissible level\n"
-					<< "get upper acceptable level\n"
-					<< "get level of oil product\n"
-					<< "get working state\n"
-					<< "get loading pump status\n"
-					<< "get unloading pump status\n"
-					<< "download <quantity of oil products (number)>\n"
-					<< "unload <quantity of oil products (number)>\n"
-					<< "help\n"
-					<< "disconnect";
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				auto &&[current_session, current_tank] = session;
+				co_return co_await current_session->async_write(
+					"set download speed <number>\n"
+					"set unloading speed <number>\n"
+					"set lower permissible level <number>\n"
+					"set upper acceptable level <number>\n"
+					"set level of oil product <number>\n"
+					"set working state <work|non-work>\n"
+					"set loading pump status <active|inactive>\n"
+					"set unloading pump status <active|inactive>\n"
+					"set product grade <crude|gasoline|diesel|kerosene|fuel-oil>\n"
+					"get download speed\n"
+					"get unloading speed\n"
+					"get lower permissible level\n"
+					"get upper acceptable level\n"
+					"get level of oil product\n"
+					"get working state\n"
+					"get loading pump status\n"
+					"get unloading pump status\n"
+					"get product grade\n"
+					"download <quantity of oil products (number)> [<product grade>]\n"
+					"unload <quantity of oil products (number)> [<product grade>]\n"
+					"rule when level <above|below> <number> then <activate|deactivate> <loading|unloading> pump\n"
+					"rule when level <above|below> <number> then alert\n"
+					"get rules\n"
+					"clear rules\n"
+					"if-changed-since <version>\n"
+					"resume <token> <times resumed>\n"
+					"help\n"
+					"disconnect");
+			},
+			command_kind::read
+		},
+		{ std::regex("disconnect"),
+			[](match_t &sm, session_t &session) -> task<status>
+			{
+				co_return status::disconnect;
+			},
+			command_kind::read
+		},
+	};
+
+	[[nodiscard]] static std::optional<bool> working_filter(const std::string &filter)
+	{
+		if (filter.empty())
+		{
+			return std::nullopt;
+		}
+		
+		return filter == " working";
+	}
+	
+	static inline std::vector<command_handler<fleet_session_t>> fleet_cli_handler
+	{
+		{ std::regex("snapshot ([\\d,\\-]+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto &&[ids, result] = st::stoids(sm[1].str());
+				if (st::is_not_success(result))
+				{
+					co_return co_await current_session->async_write(st::response(status::incorrect_tank_id));
+				}
+				
+				for (auto id : ids)
+				{
+					if (id >= tanks.size())
+					{
+						co_return co_await current_session->async_write(st::response(status::incorrect_tank_id));
+					}
+				}
+
+				// All the tanks as they were at one point in time, the snapshot is closed before the session suspends
+				auto states = std::unordered_map<uint64_t, tank_snapshot>();
+				{
+					auto point = tanks.open_snapshot();
+					for (auto id : ids)
+					{
+						if (!states.contains(id))
+						{
+							states.emplace(id, tanks[id].snapshot(point));
+						}
+					}
+				}
+
+				// One line per tank: id, working state, loading and unloading pumps, lower and upper levels, speeds, level
+				auto response = make_response(sm);
+				for (auto id : ids)
+				{
+					auto &&tank = states[id];
+					append_number(response, id)
+						.append(tank.work_state == working_state::work ? " 1" : " 0")
+						.append(tank.loading_pump_status == activity_state::active ? " 1" : " 0")
+						.append(tank.unloading_pump_status == activity_state::active ? " 1 " : " 0 ");
+					append_number(response, tank.lower_permissible_level).append(" ");
+					append_number(response, tank.upper_acceptable_level).append(" ");
+					append_number(response, tank.download_speed).append(" ");
+					append_number(response, tank.unloading_speed).append(" ");
+					append_number(response, tank.level_of_oil_products).append("\n");
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("find (level|fill) from (\\d+) to (\\d+)( working| non-working)?"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto by = sm[1] == "level" ? fleet_index::order::level : fleet_index::order::fill;
+				auto scale = by == fleet_index::order::fill ? fleet_index::fill_scale / 100 : 1;
+				
+				auto &&[found, truncated] = tanks.get_index().find(by, std::stoull(sm[2]) * scale, std::stoull(sm[3]) * scale,
+					working_filter(sm[4]), max_snapshot_size);
+				
+				auto response = make_response(sm);
+				append_index_entries(response, found, truncated);
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("(emptiest|fullest) (\\d+) by (level|fill)( working| non-working)?"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto by = sm[3] == "level" ? fleet_index::order::level : fleet_index::order::fill;
+				auto k = std::min<uint64_t>(std::stoull(sm[2]), max_snapshot_size);
+				
+				auto found = tanks.get_index().top(by, k, sm[1] == "fullest", working_filter(sm[4]));
+				
+				auto response = make_response(sm);
+				append_index_entries(response, found, false);
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("plan (download|unload) (\\d+)(?: (crude|gasoline|diesel|kerosene|fuel-oil))?"),
+			[](match_t &sm, fleet_session_t &session, rate_limiter::turn &turn) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto direction = sm[1] == "download" ? transfer_direction::download : transfer_direction::unload;
+				auto grade = sm[3].matched ? st::stopg(sm[3].str()) : std::nullopt;
+				
+				// A plan waits for its slowest transfer, the others run meanwhile
+				auto report = co_await turn.without(transfer_planner::run(tanks, direction, std::stoull(sm[2]), grade));
+				
+				// A summary, then one line per part: tank id, planned and transferred volume, planned time, result
+				auto response = "transferred " + std::to_string(report.transferred) + " of " + std::to_string(report.requested)
+					+ " by " + std::to_string(report.parts.size()) + " tanks in " + std::to_string(uint64_t(report.elapsed.count())) + " s";
+				
+				for (auto &&part : report.parts)
+				{
+					response += '\n' + std::to_string(part.tank_id)
+						+ ' ' + std::to_string(part.volume)
+						+ ' ' + std::to_string(part.transferred)
+						+ ' ' + std::to_string(part.seconds) + " s "
+						+ std::string(st::response(part.result));
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("stock(?: (crude|gasoline|diesel|kerosene|fuel-oil))?"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				
+				// One line per grade from the ledger: tanks, volume, volume above the lower levels, room below the upper levels, capacity
+				auto response = make_response(sm);
+				for (size_t i = 0; i < product_grades_count; ++i)
+				{
+					auto grade = product_grade(i);
+					if (sm[1].matched && st::pgtos(grade) != sm[1].str())
+					{
+						continue;
+					}
 					
-				return current_session->write(help_info.str());
+					auto totals = tanks.get_ledger().get_totals(grade);
+					response.append(response.empty() ? "" : "\n").append(st::pgtos(grade));
+					append_number(response.append(": tanks "), totals.tanks);
+					append_number(response.append(", volume "), totals.volume);
+					append_number(response.append(", available "), totals.available);
+					append_number(response.append(", free "), totals.free);
+					append_number(response.append(", capacity "), totals.capacity);
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("flow (on|off)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				tanks.get_flow().set_enabled(sm[1] == "on");
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("flow statistics"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto statistics = tanks.get_flow().get_statistics();
+				
+				co_return co_await current_session->async_write(std::string(statistics.enabled ? "on" : "off")
+					+ ", ticks " + std::to_string(statistics.ticks)
+					+ ", flowing tanks " + std::to_string(statistics.flowing)
+					+ ", kernel " + std::to_string(statistics.kernel.count()) + " us"
+					+ ", tick " + std::to_string(statistics.tick.count()) + " us");
+			}
+		},
+		// Before export, which would match the export of a trace as well
+		{ std::regex("trace (on|off)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				tracing::set_enabled(sm[1] == "on");
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("trace export (\\S+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto &&[path, allowed] = export_directory::resolve(sm[1].str());
+				if (st::is_not_success(allowed))
+				{
+					co_return co_await current_session->async_write(st::response(allowed));
+				}
+				
+				auto &&[spans, result] = tracing::export_chrome_trace(path);
+				if (st::is_not_success(result))
+				{
+					co_return co_await current_session->async_write(st::response(result));
+				}
+				
+				co_return co_await current_session->async_write(std::to_string(spans) + " spans exported");
+			}
+		},
+		{ std::regex("export (\\S+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto &&[path, result] = export_directory::resolve(sm[1].str());
+				if (st::is_not_success(result))
+				{
+					co_return co_await current_session->async_write(st::response(result));
+				}
+				
+				co_return co_await current_session->async_write(st::response(fleet_config::save(tanks, path)));
+			}
+		},
+		{ std::regex("hottest locks (\\d+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto k = std::min<uint64_t>(std::stoull(sm[1]), max_snapshot_size);
+				
+				auto used = std::vector<std::pair<uint64_t, instrumented_mutex::statistics>>();
+				for (uint64_t id = 0; id < tanks.size(); ++id)
+				{
+					if (auto statistics = tanks[id]._get_sync_object().get_statistics(); statistics.acquisitions != 0)
+					{
+						used.emplace_back(id, statistics);
+					}
+				}
+				
+				// The time sessions spent waiting for a tank is what it adds to their latency, the time held breaks ties
+				auto hottest = used.begin() + std::min<size_t>(k, used.size());
+				std::partial_sort(used.begin(), hottest, used.end(), [](auto &&lhs, auto &&rhs)
+				{
+					return lhs.second.wait != rhs.second.wait ? lhs.second.wait > rhs.second.wait : lhs.second.hold > rhs.second.hold;
+				});
+				
+				// "locks used: N", then one line per tank: id, acquisitions, contended ones, total and maximum wait in ms,
+				// total and maximum hold in ms, waiting sessions now and at most
+				auto response = make_response(sm);
+				append_number(response.append("locks used: "), used.size());
+				
+				for (auto current = used.begin(); current != hottest; ++current)
+				{
+					auto &&[id, statistics] = *current;
+					append_number(response.append("\n"), id);
+					append_number(response.append(" "), statistics.acquisitions);
+					append_number(response.append(" "), statistics.contended);
+					append_milliseconds(response.append(" "), statistics.wait);
+					append_milliseconds(response.append(" "), statistics.max_wait);
+					append_milliseconds(response.append(" "), statistics.hold);
+					append_milliseconds(response.append(" "), statistics.max_hold);
+					append_number(response.append(" "), statistics.waiting);
+					append_number(response.append(" "), statistics.max_waiting);
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("rate limit (session|client) (\\d+) (\\d+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				
+				// Commands a second and the burst, a rate of 0 lifts the limit
+				auto limit = rate_limit{ double(std::stoull(sm[2])), double(std::stoull(sm[3])) };
+				if (sm[1] == "session")
+				{
+					rate_limiter::set_session_limit(limit);
+				}
+				else
+				{
+					rate_limiter::set_client_limit(limit);
+				}
+				
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("rate concurrency (\\d+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				rate_limiter::set_concurrency(std::stoull(sm[1]));
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("rate weight (\\d+) (\\d+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				rate_limiter::set_weight(std::stoull(sm[1]), double(std::max<uint64_t>(std::stoull(sm[2]), 1)));
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("rate statistics"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto statistics = rate_limiter::get_statistics();
+				
+				// The limits and turns, then one line per client process: sessions, weight, admitted and throttled commands
+				auto response = make_response(sm);
+				append_number(response.append("session limit: "), uint64_t(statistics.session_limit.rate));
+				append_number(response.append("/s, burst "), uint64_t(statistics.session_limit.burst));
+				append_number(response.append("\nclient limit: "), uint64_t(statistics.client_limit.rate));
+				append_number(response.append("/s, burst "), uint64_t(statistics.client_limit.burst));
+				append_number(response.append("\nturns: "), statistics.in_flight);
+				append_number(response.append(" of "), statistics.concurrency);
+				append_number(response.append(", queued "), statistics.queued);
+				
+				for (auto &&client : statistics.clients)
+				{
+					append_number(response.append("\nclient "), client.client);
+					append_number(response.append(": sessions "), client.sessions);
+					append_number(response.append(", weight "), uint64_t(client.weight));
+					append_number(response.append(", admitted "), client.admitted);
+					append_number(response.append(", throttled "), client.throttled);
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("replication statistics"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto statistics = replication::get_statistics();
+				
+				// Changes recorded, sent and applied by the standby, and the time from a change to its acknowledgement
+				auto response = make_response(sm);
+				response.append(statistics.standby_connected ? "standby: connected" : "standby: none");
+				append_number(response.append("\nchanges: recorded "), statistics.recorded);
+				append_number(response.append(", sent "), statistics.sent);
+				append_number(response.append(", acknowledged "), statistics.acknowledged);
+				append_milliseconds(response.append("\nlag: "), statistics.lag);
+				append_milliseconds(response.append(" ms, at most "), statistics.max_lag);
+				response.append(" ms");
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("lease timeout (\\d+)"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				tank_lease::set_idle_timeout(std::chrono::seconds(std::stoull(sm[1])));
+				co_return co_await current_session->async_write(st::response(status::success));
+			}
+		},
+		{ std::regex("lease statistics"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto statistics = tank_lease::get_statistics();
+				
+				// Leases given up by idle sessions, taken back by them, and commands refused to read-only sessions
+				auto response = make_response(sm);
+				append_number(response.append("idle timeout: "), statistics.idle_timeout.count()).append(" s");
+				append_number(response.append("\nexpired: "), statistics.expired);
+				append_number(response.append(", renewed: "), statistics.renewed);
+				append_number(response.append(", refused: "), statistics.refused);
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("profile (\\d+)( \\S+)?"),
+			[](match_t &sm, fleet_session_t &session, rate_limiter::turn &turn) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto &&[path, allowed] = export_directory::resolve(sm[2].matched ? sm[2].str().substr(1) : std::string("profile.raw"));
+				if (st::is_not_success(allowed))
+				{
+					co_return co_await current_session->async_write(st::response(allowed));
+				}
+				
+				if (auto result = sampling_profiler::start(); st::is_not_success(result))
+				{
+					co_return co_await current_session->async_write(st::response(result));
+				}
+				
+				// The session sleeps meanwhile without its turn, its worker is sampled serving the others
+				co_await turn.without(storage_tank::sleep(std::chrono::seconds(std::stoull(sm[1]))));
+				
+				auto &&[profiled, result] = sampling_profiler::stop(path);
+				if (st::is_not_success(result))
+				{
+					co_return co_await current_session->async_write(st::response(result));
+				}
+				
+				// To be turned into collapsed stacks with profdecode
+				auto response = make_response(sm);
+				append_number(response, profiled.samples).append(" samples of ");
+				append_number(response, profiled.threads).append(" threads, ");
+				append_number(response, profiled.dropped).append(" dropped, written to ").append(path);
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("executor statistics"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				auto statistics = executor::current()->get_statistics();
+				
+				// One line per worker: its node, queue depth, executed and stolen tasks
+				auto response = "injection queue depth: " + std::to_string(statistics.injected);
+				for (size_t worker = 0; worker < statistics.depths.size(); ++worker)
+				{
+					response += "\nworker " + std::to_string(worker)
+						+ ": node " + std::to_string(statistics.nodes[worker])
+						+ ", depth " + std::to_string(statistics.depths[worker])
+						+ ", executed " + std::to_string(statistics.executed[worker])
+						+ ", stolen " + std::to_string(statistics.stolen[worker]);
+				}
+				
+				co_return co_await current_session->async_write(response);
+			}
+		},
+		{ std::regex("number of tanks"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				co_return co_await current_session->async_write(std::to_string(tanks.size()));
+			}
+		},
+		{ std::regex("help"),
+			[](match_t &sm, fleet_session_t &session) -> task<status>
+			{
+				auto &&[current_session, tanks] = session;
+				
+				co_return co_await current_session->async_write(
+					"snapshot <tank list, e.g. 0-15,20>\n"
+					"find <level|fill> from <number> to <number> [working|non-working]\n"
+					"<emptiest|fullest> <number> by <level|fill> [working|non-working]\n"
+					"plan <download|unload> <volume> [<product grade>]\n"
+					"stock [<product grade>]\n"
+					"export <file.csv|file>\n"
+					"flow <on|off>\n"
+					"flow statistics\n"
+					"trace <on|off>\n"
+					"trace export <file.json>\n"
+					"executor statistics\n"
+					"hottest locks <number>\n"
+					"profile <seconds> [<file>]\n"
+					"rate limit <session|client> <commands per second> <burst>\n"
+					"rate concurrency <number>\n"
+					"rate weight <client> <number>\n"
+					"rate statistics\n"
+					"lease timeout <seconds, 0 for none>\n"
+					"lease statistics\n"
+					"replication statistics\n"
+					"number of tanks\n"
+					"help\n"
+					"disconnect");
 			}
 		},
 		{ std::regex("disconnect"),
-			[](std::smatch &sm, session_t &session)
+			[](match_t &sm, fleet_session_t &session) -> task<status>
 			{
-				return status::disconnect;
+				co_return status::disconnect;
 			}
 		},
 	};
 
-public:
-	static status handling(const std::string &command, session_t &session)
+	// The whole command has to match, so that nothing can follow a command and be taken for another one
+	template <typename S>
+	[[nodiscard]] static auto parse(const std::vector<command_handler<S>> &handlers, const std::string &command, S &session, std::pmr::memory_resource *arena)
 	{
-		for (auto &&[regexp, handler] : cli_handler)
+		auto dispatch = tracing::span("cli dispatch", trace_group::sessions, session.first->session_key());
+		
+		for (auto &&entry : handlers)
 		{
-			std::smatch matched;
-			if (std::regex_search(command, matched, regexp))
+			auto matched = match_t(arena);
+			if (std::regex_match(command, matched, entry.pattern))
 			{
-				return handler(matched, session);
+				return parsed_command<S>{ &entry, std::move(matched) };
 			}
 		}
 
-		return status::cli_handler_not_found;
+		return parsed_command<S>{ nullptr, match_t(arena) };
+	}
+
+public:
+	// A command and the handler it matched, found before it is run so that the session knows what it does
+	template <typename S>
+	struct parsed_command
+	{
+		const command_handler<S> *found;
+		match_t matched;
+
+		// A command without a handler is only answered that there is none
+		[[nodiscard]] command_kind kind() const noexcept
+		{
+			return found == nullptr ? command_kind::read : found->kind;
+		}
+	};
+
+	// Whatever a command allocates comes from the arena, the session releases it once the command is done.
+	// The match points into the command, which has to outlive it
+	[[nodiscard]] static parsed_command<session_t> parse(const std::string &command, session_t &session, std::pmr::memory_resource *arena = std::pmr::get_default_resource())
+	{
+		return parse(cli_handler, command, session, arena);
+	}
+
+	[[nodiscard]] static parsed_command<fleet_session_t> parse(const std::string &command, fleet_session_t &session, std::pmr::memory_resource *arena = std::pmr::get_default_resource())
+	{
+		return parse(fleet_cli_handler, command, session, arena);
+	}
+
+	template <typename S>
+	static task<status> handling(parsed_command<S> &command, S &session, rate_limiter::turn &turn)
+	{
+		if (command.found == nullptr)
+		{
+			co_return status::cli_handler_not_found;
+		}
+
+		auto handling = tracing::span("cli handler", trace_group::sessions, session.first->session_key());
+		co_return co_await command.found->run(command.matched, session, turn);
 	}
 };
 
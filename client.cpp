@@ -1,17 +1,66 @@
+#include <fstream>
+
 #include "client.hpp"
 #include "logging.hpp"
 
 int main(int argc, char **argv)
 {
-	if (argc != 2)
+	if (argc == 3 && std::string_view(argv[1]) == "watch")
 	{
-		logging::errlog("it is necessary to specify the id of the tank to connect to the arguments");
+		static const size_t max_watch_size = 4096;
+		
+		if (auto &&[tank_ids, result] = st::stoids(argv[2], max_watch_size); st::is_success(result))
+		{
+			return client::watch(tank_ids) == status::disconnect ? 0 : -1;
+		}
+		
+		logging::errlog("incorrect tank list, expected ids and ranges such as 0-15,20");
+		return -1;
+	}
+	
+	auto script_mode = argc == 4 && std::string_view(argv[2]) == "--script";
+	auto fleet_mode = (argc == 2 || script_mode) && std::string_view(argv[1]) == "fleet";
+	if (argc != 2 && !script_mode)
+	{
+		logging::errlog("it is necessary to specify the id of the tank to connect to the arguments "
+			"(or `<id|fleet> --script <file|->`, `fleet`, or `watch <tank list>`)");
 		return -1;
 	}
 	
 	try
 	{
-		switch (auto result = client(std::stoull(argv[1])).run())
+		auto tank_client = fleet_mode ? client(std::string_view("fleet")) : client(std::stoull(argv[1]));
+		auto result = status::success;
+		
+		// A piped standard input is executed as a script as well, fleet sessions always run commands this way
+		if (script_mode || fleet_mode || isatty(STDIN_FILENO) != 1)
+		{
+			auto script_file = std::ifstream();
+			if (script_mode && std::string_view(argv[3]) != "-")
+			{
+				if (script_file.open(argv[3]); !script_file)
+				{
+					logging::errlog(std::string("unable to open the script: ") + argv[3]);
+					return -1;
+				}
+			}
+			
+			// Typed commands are answered one by one
+			auto pipeline_window = script_file.is_open() || isatty(STDIN_FILENO) != 1 ? client::max_pipeline_window : 1;
+			auto &&[failed_commands, script_result] = tank_client.run_script(script_file.is_open() ? script_file : std::cin, pipeline_window);
+			if (st::is_success(script_result))
+			{
+				return failed_commands == 0 ? 0 : 1;
+			}
+			
+			result = script_result;
+		}
+		else
+		{
+			result = tank_client.run();
+		}
+		
+		switch (result)
 		{
 			case status::failed_initialization:
 			{
@@ -4,17 +4,74 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <cstdio>
+#include <istream>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "dye.hpp"
+#include "frame_renderer.hpp"
+#include "tank_ids.hpp"
 #include "message_connection.hpp"
 
 class client
 {
 private:
-	int tank_id;
+	static const size_t dashboard_rows = 21;
+	static const size_t dashboard_columns = 80;
+	static const size_t response_row = 19;
+	static const size_t prompt_row = 20;
+	static constexpr auto refresh_interval = std::chrono::seconds(1);
+	
+	// Tank id, or "fleet" for a read-only session over the whole fleet
+	std::string handshake_request;
+	
+	// The last known tank state, only the changes since its version are requested
+	uint64_t cached_version = 0;
+	std::map<std::string, std::string, std::less<>> cached_fields;
+	
+	// Where a tank session is remembered until its client disconnects, so that a restarted client can resume it.
+	// Only in the runtime directory of the user, without one sessions are not remembered
+	[[nodiscard]] std::string session_file() const
+	{
+		auto runtime_directory = std::getenv("XDG_RUNTIME_DIR");
+		return runtime_directory && *runtime_directory ? std::string(runtime_directory) + "/oil_storage_session_" + handshake_request : std::string();
+	}
+	
+	// The resume token is a secret of the user, the file is readable by its owner only
+	static void remember_session(const std::string &session_file, const std::string &session_key, const std::string &resume_token, uint64_t resumptions)
+	{
+		auto file = open(session_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		if (file == -1)
+		{
+			return;
+		}
+		
+		auto content = session_key + ' ' + std::to_string(getpid()) + ' ' + resume_token + ' ' + std::to_string(resumptions) + '\n';
+		if (fchmod(file, S_IRUSR | S_IWUSR) != 0 || write(file, content.data(), content.size()) != ssize_t(content.size()))
+		{
+			unlink(session_file.c_str());
+		}
+		close(file);
+	}
+	
+	[[nodiscard]] static bool wait_for_input(std::chrono::milliseconds timeout)
+	{
+		auto input = pollfd{ STDIN_FILENO, POLLIN, 0 };
+		return poll(&input, 1, timeout.count()) != 0;
+	}
 	
 	template <typename T>
-	[[nodiscard]] std::pair<std::string, status> get_request(std::shared_ptr<T> connection, std::string_view request) const
+	[[nodiscard]] static std::pair<std::string, status> get_request(std::shared_ptr<T> connection, std::string_view request)
 	{
 		if (auto result = connection->write(request); st::is_not_success(result))
 		{
@@ -30,129 +87,176 @@ private:
 		return { response, status::success };
 	}
 	
+	// Brings the cached tank state up to date with a single request
 	template <typename T>
-	[[nodiscard]] std::pair<std::string, status> get_complete_info(std::shared_ptr<T> connection) const
+	[[nodiscard]] status refresh_cache(std::shared_ptr<T> connection)
 	{
-		auto &&[working_state, result_work_state] = get_request(connection, "get working state");
-		if (st::is_not_success(result_work_state))
-		{
-			return { working_state, result_work_state };
-		}
-
-		auto &&[loading_pump_status, result_loading_pump_status] = get_request(connection, "get loading pump status");
-		if (st::is_not_success(result_loading_pump_status))
+		auto &&[changes, result] = get_request(connection, "if-changed-since " + std::to_string(cached_version));
+		if (st::is_not_success(result))
 		{
-			return { loading_pump_status, result_loading_pump_status };
+			return result;
 		}
 		
-		auto &&[unloading_pump_status, result_unloading_pump_status] = get_request(connection, "get unloading pump status");
-		if (st::is_not_success(result_unloading_pump_status))
+		if (changes == "not modified")
 		{
-			return { unloading_pump_status, result_unloading_pump_status };
+			return status::success;
 		}
 		
-		auto &&[lower_permissible_level, result_lower_permissible_level] = get_request(connection, "get lower permissible level");
-		if (st::is_not_success(result_lower_permissible_level))
+		static const auto version_prefix = std::string_view("version ");
+		if (!changes.starts_with(version_prefix))
 		{
-			return { lower_permissible_level, result_lower_permissible_level };
+			return status::read_error;
 		}
 		
-		auto &&[upper_acceptable_level, result_upper_acceptable_level] = get_request(connection, "get upper acceptable level");
-		if (st::is_not_success(result_upper_acceptable_level))
-		{
-			return { upper_acceptable_level, result_upper_acceptable_level };
-		}
+		auto lines = std::string_view(changes);
+		auto version_line = lines.substr(0, lines.find('\n'));
+		std::from_chars(version_line.data() + version_prefix.size(), version_line.data() + version_line.size(), cached_version);
+		lines.remove_prefix(std::min(lines.size(), version_line.size() + 1));
 		
-		auto &&[download_speed, result_download_speed] = get_request(connection, "get download speed");
-		if (st::is_not_success(result_download_speed))
+		while (!lines.empty())
 		{
-			return { download_speed, result_download_speed };
+			auto line = lines.substr(0, lines.find('\n'));
+			lines.remove_prefix(std::min(lines.size(), line.size() + 1));
+			
+			if (auto separator = line.find(": "); separator != std::string_view::npos)
+			{
+				cached_fields[std::string(line.substr(0, separator))] = line.substr(separator + 2);
+			}
 		}
 		
-		auto &&[unloading_speed, result_unloading_speed] = get_request(connection, "get unloading speed");
-		if (st::is_not_success(result_unloading_speed))
+		return status::success;
+	}
+	
+	template <typename T>
+	[[nodiscard]] status get_complete_info(std::shared_ptr<T> connection, frame_renderer::frame &complete_info)
+	{
+		if (auto result = refresh_cache(connection); st::is_not_success(result))
 		{
-			return { unloading_speed, result_unloading_speed };
+			return result;
 		}
 		
-		auto &&[level_of_oil_products, result_level_of_oil_products] = get_request(connection, "get level of oil products");
-		if (st::is_not_success(result_level_of_oil_products))
-		{
-			return { level_of_oil_products, result_level_of_oil_products };
-		}
+		auto &&working_state = cached_fields["working state"];
+		auto &&loading_pump_status = cached_fields["loading pump status"];
+		auto &&unloading_pump_status = cached_fields["unloading pump status"];
+		auto &&lower_permissible_level = cached_fields["lower permissible level"];
+		auto &&upper_acceptable_level = cached_fields["upper acceptable level"];
+		auto &&download_speed = cached_fields["download speed"];
+		auto &&unloading_speed = cached_fields["unloading speed"];
+		auto &&level_of_oil_products = cached_fields["level of oil products"];
+		auto &&grade = cached_fields["product grade"];
 		
 		static const auto max_level = 6;
-		auto terminal_dye = dye(dye::code::white);
-		auto complete_info = std::stringstream();
 		auto quantity_of_oil_products = (std::stoull(level_of_oil_products) * max_level) / std::stoull(upper_acceptable_level);
+		auto tank_color = working_state == "non-work" ? dye::code::gray : dye::code::white;
+		auto unloading_pump_color = unloading_pump_status == "active" ? dye::code::green : dye::code::red;
+		auto loading_pump_color = loading_pump_status == "active" ? dye::code::green : dye::code::red;
 		
-		complete_info << "     -= Oil storage =-\n\n";
-		
-		if (working_state == "non-work")
-		{
-			complete_info << terminal_dye.forever(dye::code::gray);
-		}
+		complete_info.clear();
+		complete_info.put(0, 5, "-= Oil storage =-");
 		
 		for (uint64_t i = 0; i < max_level; ++i)
 		{
-			if (i < max_level - quantity_of_oil_products)
+			auto row = i + 2;
+			auto filled = i >= max_level - quantity_of_oil_products;
+			auto oil_color = quantity_of_oil_products == 1 ? dye::code::red : dye::code::yellow;
+			
+			if (i == max_level - 1)
 			{
-				if (i == max_level - 1)
-				{
-					complete_info << "       " << terminal_dye.colorant(">", unloading_pump_status == "active" ? dye::code::green : dye::code::red)
-								<< "|         |" << terminal_dye.colorant(">", loading_pump_status == "active" ? dye::code::green : dye::code::red) << '\n';
-				}
-				else
-				{
-					complete_info << "\t|         |\n";
-				}
+				complete_info.put(row, 7, ">", unloading_pump_color);
+				complete_info.put(row, 19, ">", loading_pump_color);
 			}
-			else
+			
+			complete_info.put(row, 8, "|", tank_color);
+			complete_info.put(row, 9, filled ? "#########" : "         ", filled ? oil_color : tank_color);
+			complete_info.put(row, 18, "|", tank_color);
+		}
+		
+		complete_info.put(max_level + 2, 8, "\\=========/", tank_color);
+		
+		auto field_row = size_t(max_level + 4);
+		auto put_field = [&](std::string_view name, std::string_view value, dye::code color = dye::code::white)
+		{
+			auto value_column = complete_info.put(field_row, 0, name);
+			complete_info.put(field_row++, value_column, value, color);
+		};
+		
+		put_field("working state...............", working_state, working_state == "work" ? dye::code::green : dye::code::red);
+		put_field("loading pump status.........", loading_pump_status, loading_pump_color);
+		put_field("unloading pump status.......", unloading_pump_status, unloading_pump_color);
+		put_field("lower permissible level.....", lower_permissible_level);
+		put_field("upper acceptable level......", upper_acceptable_level);
+		put_field("download speed..............", download_speed);
+		put_field("unloading speed.............", unloading_speed);
+		put_field("level of oil products.......", level_of_oil_products, level_of_oil_products == lower_permissible_level
+			|| level_of_oil_products == upper_acceptable_level ? dye::code::red : dye::code::white);
+		put_field("product grade...............", grade);
+		
+		return status::success;
+	}
+	
+	// Draws one line of the fleet snapshot as a tile: "   12 [#####     ]  50% <>"
+	static void put_tile(frame_renderer::frame &grid, size_t row, size_t column, std::string_view snapshot_line)
+	{
+		enum { id, work_state, loading_pump, unloading_pump, lower_level, upper_level, download_speed, unloading_speed, level, fields_count };
+		
+		uint64_t fields[fields_count] = {};
+		auto position = snapshot_line.data();
+		auto end = position + snapshot_line.size();
+		
+		for (auto &&field : fields)
+		{
+			while (position != end && *position == ' ')
 			{
-				if (i == max_level - 1)
-				{
-					complete_info << "       " << terminal_dye.colorant(">", unloading_pump_status == "active" ? dye::code::green : dye::code::red)
-										<< '|' << terminal_dye.colorant("#########", quantity_of_oil_products == 1 ? dye::code::red : dye::code::yellow)
-										<< '|' << terminal_dye.colorant(">", loading_pump_status == "active" ? dye::code::green : dye::code::red) << '\n';
-				}
-				else
-				{
-					complete_info << "\t|" << terminal_dye.colorant("#########", dye::code::yellow) << "|\n";
-				}
+				++position;
 			}
+			position = std::from_chars(position, end, field).ptr;
 		}
 		
-		complete_info << "\t\\=========/\n\n";
+		static const uint64_t bar_length = 10;
+		auto fill = fields[upper_level] ? std::min<uint64_t>(fields[level] * 100 / fields[upper_level], 100) : 0;
+		auto bar = fill * bar_length / 100;
+		auto tank_color = fields[work_state] ? dye::code::white : dye::code::gray;
+		auto level_color = fields[level] <= fields[lower_level] || fields[level] >= fields[upper_level] ? dye::code::red : dye::code::yellow;
 		
-		if (working_state == "non-work")
+		char number[24];
+		auto number_end = std::to_chars(number, std::end(number), fields[id]).ptr;
+		auto number_length = size_t(number_end - number);
+		
+		column = grid.put(row, column + (number_length < 5 ? 5 - number_length : 0), std::string_view(number, number_length), tank_color);
+		column = grid.put(row, column, " [", tank_color);
+		
+		for (uint64_t i = 0; i < bar_length; ++i)
 		{
-			complete_info << terminal_dye.forever(dye::code::white);
+			column = grid.put(row, column, i < bar ? "#" : " ", fields[work_state] ? level_color : tank_color);
 		}
 		
-		complete_info << "working state..............." << terminal_dye.colorant(working_state, working_state == "work" ? dye::code::green : dye::code::red) << '\n';
-		complete_info << "loading pump status........." << terminal_dye.colorant(loading_pump_status, loading_pump_status == "active" ? dye::code::green : dye::code::red) << '\n';
-		complete_info << "unloading pump status......." << terminal_dye.colorant(unloading_pump_status, unloading_pump_status == "active" ? dye::code::green : dye::code::red) << '\n';
-		complete_info << "lower permissible level....." << lower_permissible_level << '\n';
-		complete_info << "upper acceptable level......" << upper_acceptable_level << '\n';
-		complete_info << "download speed.............." << download_speed << '\n';
-		complete_info << "unloading speed............." << unloading_speed << '\n';
-		complete_info << "level of oil products......." << terminal_dye.colorant(level_of_oil_products, level_of_oil_products == lower_permissible_level
-													|| level_of_oil_products == upper_acceptable_level ? dye::code::red : dye::code::white) << '\n';
+		number_end = std::to_chars(number, std::end(number), fill).ptr;
+		number_length = size_t(number_end - number);
 		
-		return { complete_info.str(), status::success };
+		column = grid.put(row, column, "] ", tank_color);
+		column = grid.put(row, column + (3 - number_length), std::string_view(number, number_length), tank_color);
+		column = grid.put(row, column, "% ", tank_color);
+		column = grid.put(row, column, "<", fields[unloading_pump] ? dye::code::green : dye::code::red);
+		grid.put(row, column, ">", fields[loading_pump] ? dye::code::green : dye::code::red);
 	}
 	
-public:	
-	explicit client(int tank_id) : tank_id(tank_id)
+public:
+	// Bounds the responses waiting in the server queue so that neither side blocks on a full queue
+	static const size_t max_pipeline_window = 16;
+	
+	explicit client(uint64_t tank_id) : handshake_request(std::to_string(tank_id))
+	{}
+
+	explicit client(std::string_view handshake_request) : handshake_request(handshake_request)
 	{}
 
 	template <typename T>
-	[[nodiscard]] std::pair<std::shared_ptr<T>, status> connect()
+	[[nodiscard]] static std::pair<std::shared_ptr<T>, status> connect(std::string_view handshake_request, const std::string &session_file = std::string())
 	{
 		auto result = status::success;
 		if (auto handshake_connection = std::make_shared<T>(result); st::is_success(result))
 		{
-			if (result = handshake_connection->write(std::to_string(tank_id)); st::is_not_success(result))
+			if (result = handshake_connection->write(handshake_request); st::is_not_success(result))
 			{
 				return { nullptr, result };
 			}
@@ -165,47 +269,326 @@ public:
 			
 			if (auto session_connection = std::make_shared<T>(result, std::stoi(connection_key)); st::is_success(result))
 			{
-				std::cout << "the oil tank is busy, please wait...\n";
-				
 				auto acceptance_message = std::string();
 				if (result = session_connection->read(acceptance_message); st::is_not_success(result))
 				{
 					return { nullptr, result };
 				}
 				
-				if (acceptance_message != "-- accepted --")
+				// A tank session is accepted with its resume token
+				static constexpr std::string_view accepted = "-- accepted --";
+				if (!acceptance_message.starts_with(accepted))
 				{
 					return { nullptr, status::failed_accepted };
 				}
 				
+				if (auto resume_token = acceptance_message.substr(accepted.size()); !session_file.empty() && resume_token.size() > 1)
+				{
+					remember_session(session_file, connection_key, resume_token.substr(1), 0);
+				}
+				
 				return { session_connection, status::success };
 			}
 		}
 		return { nullptr, result };
 	}
 	
+	// Takes over the session of a client that exited without disconnecting,
+	// the responses it never read are returned in the missed list
+	template <typename T>
+	[[nodiscard]] std::shared_ptr<T> resume(std::vector<std::string> &missed) const
+	{
+		auto path = session_file();
+		auto file = std::ifstream(path);
+		auto session_key = 0;
+		auto owner = pid_t(0);
+		auto resume_token = std::string();
+		auto resumptions = uint64_t(0);
+		
+		// A session whose client is still running is not ours to take
+		if (path.empty() || !(file >> session_key >> owner >> resume_token >> resumptions) || kill(owner, 0) == 0 || errno != ESRCH)
+		{
+			return nullptr;
+		}
+		
+		auto result = status::success;
+		auto connection = std::make_shared<T>(result, session_key);
+		if (st::is_not_success(result) || !connection->peer_alive())
+		{
+			return nullptr;
+		}
+		
+		// Everything before the marker is a response nobody has read yet
+		missed = connection->take_unread();
+		if (st::is_not_success(connection->write("resume " + resume_token + ' ' + std::to_string(resumptions))))
+		{
+			return nullptr;
+		}
+		
+		for (auto response = std::string(); ; missed.push_back(std::move(response)))
+		{
+			if (st::is_not_success(connection->read(response)) || st::from_response(response) == status::resume_refused)
+			{
+				return nullptr;
+			}
+			
+			if (response == "-- resumed --")
+			{
+				break;
+			}
+		}
+		
+		remember_session(path, std::to_string(session_key), resume_token, resumptions + 1);
+		return connection;
+	}
+	
+	// Resumes the session left behind by a previous client or starts a new one
+	template <typename T>
+	[[nodiscard]] std::tuple<std::shared_ptr<T>, std::vector<std::string>, status> attach() const
+	{
+		auto missed = std::vector<std::string>();
+		if (handshake_request == "fleet")
+		{
+			auto &&[connection, result] = connect<T>(handshake_request);
+			return { connection, missed, result };
+		}
+		
+		if (auto connection = resume<T>(missed))
+		{
+			return { connection, missed, status::success };
+		}
+		
+		missed.clear();
+		auto &&[connection, result] = connect<T>(handshake_request, session_file());
+		return { connection, missed, result };
+	}
+	
+	// Read-only monitoring of many tanks through one fleet session
+	static status watch(const std::vector<uint64_t> &tank_ids)
+	{
+		static const size_t tile_width = 26;
+		static const size_t tiles_per_row = dashboard_columns / tile_width;
+		
+		auto &&[connection, connection_result] = connect<message_connection>("fleet");
+		if (st::is_not_success(connection_result))
+		{
+			return connection_result;
+		}
+		
+		auto grid_rows = (tank_ids.size() + tiles_per_row - 1) / tiles_per_row;
+		auto renderer = frame_renderer(grid_rows + 4, dashboard_columns);
+		auto grid = frame_renderer::frame(grid_rows + 4, dashboard_columns);
+		auto requests = std::vector<std::string>();
+		
+		for (size_t first = 0; first < tank_ids.size(); first += max_snapshot_size)
+		{
+			auto count = std::min(max_snapshot_size, tank_ids.size() - first);
+			requests.push_back("snapshot " + st::idstos(tank_ids.data() + first, count));
+		}
+		
+		grid.put(0, 5, "-= Oil storage fleet =-");
+		grid.put(grid_rows + 3, 0, "q - quit");
+		grid.set_cursor(grid_rows + 3, 8);
+		
+		while (true)
+		{
+			auto tile = size_t(0);
+			
+			for (auto &&request : requests)
+			{
+				auto &&[snapshot, snapshot_result] = get_request(connection, request);
+				if (st::is_not_success(snapshot_result))
+				{
+					return snapshot_result;
+				}
+				
+				if (st::from_response(snapshot) == status::incorrect_tank_id)
+				{
+					return status::incorrect_tank_id;
+				}
+				
+				for (auto lines = std::string_view(snapshot); !lines.empty(); ++tile)
+				{
+					auto line = lines.substr(0, lines.find('\n'));
+					lines.remove_prefix(std::min(lines.size(), line.size() + 1));
+					put_tile(grid, 2 + tile / tiles_per_row, (tile % tiles_per_row) * tile_width, line);
+				}
+			}
+			
+			renderer.render(grid, std::cout);
+			
+			if (wait_for_input(refresh_interval))
+			{
+				auto user_command = std::string();
+				if (!std::getline(std::cin, user_command) || user_command == "q")
+				{
+					std::cout << std::endl;
+					
+					if (auto result = connection->write("disconnect"); st::is_not_success(result))
+					{
+						return result;
+					}
+					return status::disconnect;
+				}
+			}
+		}
+	}
+	
+	// Non-interactive execution: commands are pipelined without redrawing the dashboard,
+	// every result is printed as "<line>\t<ok|failed>\t<elapsed>\t<command>\t<response>"
+	[[nodiscard]] std::pair<size_t, status> run_script(std::istream &script, size_t pipeline_window = max_pipeline_window)
+	{		
+		struct pending_command
+		{
+			size_t line;
+			std::string command;
+			std::chrono::steady_clock::time_point sent;
+		};
+		
+		auto &&[connection, missed, connection_result] = attach<message_connection>();
+		if (st::is_not_success(connection_result))
+		{
+			return { 0, connection_result };
+		}
+		
+		for (auto &&response : missed)
+		{
+			std::cout << "# missed before resumption\t" << response << '\n';
+		}
+		
+		auto in_flight = std::deque<pending_command>();
+		auto script_start = std::chrono::steady_clock::now();
+		auto end_of_script = false;
+		auto line_number = size_t(0);
+		auto executed_commands = size_t(0);
+		auto failed_commands = size_t(0);
+		auto server_response = std::string();
+		
+		while (true)
+		{
+			auto command = std::string();
+			while (!end_of_script && in_flight.size() < pipeline_window)
+			{
+				if (!std::getline(script, command) || command == "disconnect")
+				{
+					end_of_script = true;
+					break;
+				}
+				
+				++line_number;
+				if (command.empty() || command.front() == '#')
+				{
+					continue;
+				}
+				
+				if (auto result = connection->write(command); st::is_not_success(result))
+				{
+					return { failed_commands, result };
+				}
+				
+				in_flight.push_back({ line_number, std::move(command), std::chrono::steady_clock::now() });
+			}
+			
+			if (in_flight.empty())
+			{
+				break;
+			}
+			
+			if (auto result = connection->read(server_response); st::is_not_success(result))
+			{
+				return { failed_commands, result };
+			}
+			
+			auto &&completed = in_flight.front();
+			auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - completed.sent);
+			auto command_result = st::from_response(server_response);
+			
+			++executed_commands;
+			if (st::is_not_success(command_result))
+			{
+				++failed_commands;
+			}
+			
+			std::cout << completed.line << '\t'
+				<< (st::is_success(command_result) ? "ok" : "failed") << '\t'
+				<< std::fixed << std::setprecision(3) << elapsed.count() << " ms\t"
+				<< completed.command << '\t'
+				<< server_response << '\n';
+			
+			in_flight.pop_front();
+		}
+		
+		if (auto result = connection->write("disconnect"); st::is_not_success(result))
+		{
+			return { failed_commands, result };
+		}
+		std::remove(session_file().c_str());
+		
+		auto total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - script_start);
+		std::cout << "# " << executed_commands << " commands, " << failed_commands << " failed, "
+			<< std::fixed << std::setprecision(3) << total.count() << " ms" << std::endl;
+		
+		return { failed_commands, status::success };
+	}
+	
 	status run()
 	{
-		auto &&[connection, connection_result] = connect<message_connection>();
+		std::cout << "the oil tank is busy, please wait...\n";
+		
+		auto &&[connection, missed, connection_result] = attach<message_connection>();
 		if (st::is_not_success(connection_result))
 		{
 			return connection_result;
 		}
 		
+		auto renderer = frame_renderer(dashboard_rows, dashboard_columns);
+		auto dashboard = frame_renderer::frame(dashboard_rows, dashboard_columns);
+		auto server_response = missed.empty() ? std::string() : "missed before resumption: " + missed.back();
+		auto auto_refresh = isatty(STDIN_FILENO) == 1;
+		
+		auto redraw = [&](frame_renderer::cursor_mode mode)
+		{
+			if (auto result = get_complete_info(connection, dashboard); st::is_not_success(result))
+			{
+				return result;
+			}
+			
+			if (!server_response.empty())
+			{
+				auto response_end = dashboard.put(response_row, 0, "% ");
+				response_end = dashboard.put(response_row, response_end, server_response);
+				dashboard.put(response_row, response_end, " %");
+			}
+			
+			dashboard.put(prompt_row, 0, "> ");
+			dashboard.set_cursor(prompt_row, 2);
+			renderer.render(dashboard, std::cout, mode);
+			
+			return status::success;
+		};
+		
 		// cppcheck-suppress cppcheckError
-		if (auto &&[complete_info, complete_info_result] = get_complete_info(connection); st::is_success(complete_info_result))
+		if (auto result = redraw(frame_renderer::cursor_mode::move); st::is_not_success(result))
 		{
-			system("clear");
-			std::cout << complete_info << std::endl;
+			return result;
 		}
-		else return complete_info_result;
 		
 		while (true)
 		{
-			std::cout << "> ";
+			if (auto_refresh && !wait_for_input(refresh_interval))
+			{
+				if (auto result = redraw(frame_renderer::cursor_mode::keep); st::is_not_success(result))
+				{
+					return result;
+				}
+				continue;
+			}
 			
 			auto user_command = std::string();
-			std::getline(std::cin, user_command);
+			if (!std::getline(std::cin, user_command))
+			{
+				user_command = "disconnect";
+			}
 			
 			if (auto result = connection->write(user_command); st::is_not_success(result))
 			{
@@ -214,24 +597,24 @@ public:
 			
 			if (user_command == "disconnect")
 			{
+				std::remove(session_file().c_str());
+				std::cout << std::endl;
 				return status::disconnect;
 			}
 			
-			std::cout << "wait for the command...\n";
+			dashboard.clear_row(response_row);
+			dashboard.put(response_row, 0, "wait for the command...");
+			renderer.render(dashboard, std::cout, frame_renderer::cursor_mode::move);
 			
-			auto server_response = std::string();
 			if (auto result = connection->read(server_response); st::is_not_success(result))
 			{
 				return result;
 			}
 			
-			if (auto &&[complete_info, complete_info_result] = get_complete_info(connection); st::is_success(complete_info_result))
+			if (auto result = redraw(frame_renderer::cursor_mode::move); st::is_not_success(result))
 			{
-				system("clear");
-				std::cout << complete_info << std::endl;
-				std::cout << "% " << server_response << " %" << std::endl;
+				return result;
 			}
-			else return complete_info_result;
 		}
 	}
 };
@@ -0,0 +1,61 @@
+#ifndef __COMMAND_ARENA_HPP__
+#define __COMMAND_ARENA_HPP__
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <memory_resource>
+
+// Memory of one command: a block taken from the pool of the worker when the command is read and given
+// back once it is answered, so an idle session holds none. Larger responses spill to the heap.
+// A command that moves to another worker while suspended gives its block to that worker's pool.
+class command_arena
+{
+private:
+	static const size_t block_size = 16384;
+	// Enough for the commands a worker has in progress at once, more blocks are freed
+	static const size_t pooled_blocks = 64;
+
+	using block = std::array<std::byte, block_size>;
+
+	static inline thread_local std::vector<std::unique_ptr<block>> pool;
+
+	std::unique_ptr<block> memory;
+	std::pmr::monotonic_buffer_resource resource;
+
+	[[nodiscard]] static std::unique_ptr<block> take()
+	{
+		if (pool.empty())
+		{
+			return std::make_unique<block>();
+		}
+
+		auto taken = std::move(pool.back());
+		pool.pop_back();
+		return taken;
+	}
+
+public:
+	command_arena(): memory(take()), resource(memory->data(), memory->size())
+	{}
+
+	command_arena(const command_arena &) = delete;
+	command_arena &operator=(const command_arena &) = delete;
+
+	~command_arena()
+	{
+		resource.release();
+		if (pool.size() < pooled_blocks)
+		{
+			pool.push_back(std::move(memory));
+		}
+	}
+
+	[[nodiscard]] std::pmr::memory_resource *get() noexcept
+	{
+		return &resource;
+	}
+};
+
+#endif // !__COMMAND_ARENA_HPP__
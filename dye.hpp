@@ -2,6 +2,7 @@
 #define __DYE_HPP__
 
 #include <iomanip>
+#include <string_view>
 
 class dye
 {
@@ -22,12 +23,23 @@ public:
 	explicit dye(code color = white): now_color(color)
 	{}
 
+	// Precomputed escape sequences, nothing is formatted at runtime
+	[[nodiscard]] static constexpr std::string_view sequence(code color) noexcept
+	{
+		switch (color)
+		{
+			case red: return "\033[31m";
+			case green: return "\033[32m";
+			case gray: return "\033[90m";
+			case yellow: return "\033[93m";
+			default: return "\033[39m";
+		}
+	}
+
 	std::string forever(code color)
 	{
 		now_color = color;
-		std::stringstream dyestuff;
-		dyestuff << "\033[" << color << 'm';
-		return dyestuff.str();
+		return std::string(sequence(color));
 	}
 	
 	template <typename T>
@@ -0,0 +1,533 @@
+#ifndef __EXECUTOR_HPP__
+#define __EXECUTOR_HPP__
+
+#include <mutex>
+#include <deque>
+#include <queue>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <functional>
+#include <algorithm>
+#include <coroutine>
+#include <condition_variable>
+
+#include "task.hpp"
+#include "logging.hpp"
+#include "numa_placement.hpp"
+
+// Runs coroutines on one worker thread per core, each with its own queue; idle workers steal
+// from the others. A single reactor thread wakes coroutines up when their timers expire
+// or when their non-blocking I/O operations complete. Given a topology, the workers are pinned
+// to NUMA nodes: work meant for a node is queued there and taken by workers of other nodes only
+// when their own node has nothing left, and a coroutine woken by the reactor returns to its node.
+class executor
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	// Scheduled on the node of the calling worker, or on the first node
+	static const size_t any_node = std::numeric_limits<size_t>::max();
+
+	// A non-blocking operation the reactor retries until it completes,
+	// lives in the frame of the suspended coroutine so waiting does not allocate
+	struct pending_io
+	{
+		std::coroutine_handle<> handle;
+
+		// Where the coroutine is resumed once the operation completes
+		size_t node = 0;
+
+		// True once the operation has finished, successfully or not
+		virtual bool attempt() noexcept = 0;
+	};
+
+private:
+	struct timer
+	{
+		clock::time_point deadline;
+		std::coroutine_handle<> handle;
+		size_t node;
+
+		[[nodiscard]] bool operator>(const timer &other) const noexcept
+		{
+			return deadline > other.deadline;
+		}
+	};
+
+	// Keeps the handle of a spawned session alive until it finishes, then frees itself
+	struct detached_task
+	{
+		struct promise_type
+		{
+			detached_task get_return_object() noexcept
+			{
+				return { std::coroutine_handle<promise_type>::from_promise(*this) };
+			}
+
+			std::suspend_always initial_suspend() const noexcept
+			{
+				return {};
+			}
+
+			std::suspend_never final_suspend() const noexcept
+			{
+				return {};
+			}
+
+			void return_void() const noexcept
+			{}
+
+			void unhandled_exception() const noexcept
+			{
+				logging::errlog("unhandled exception in a coroutine");
+			}
+		};
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	// Message queues have no descriptors to wait on, so pending I/O is polled with a growing pause
+	static constexpr auto min_poll_interval = std::chrono::microseconds(50);
+	static constexpr auto max_poll_interval = std::chrono::milliseconds(2);
+
+	static inline thread_local executor *current_executor = nullptr;
+	static inline thread_local size_t current_worker = std::numeric_limits<size_t>::max();
+
+	// The owner takes the newest work from the back, thieves take the oldest from the front
+	struct worker_queue
+	{
+		std::mutex mutex;
+		std::deque<std::coroutine_handle<>> tasks;
+
+		std::atomic<uint64_t> executed = 0;
+		std::atomic<uint64_t> stolen = 0;
+	};
+
+	// Work arriving from outside the workers: the reactor, the accepting thread; one per node
+	struct injection_queue
+	{
+		std::mutex mutex;
+		std::deque<std::coroutine_handle<>> tasks;
+	};
+
+	std::atomic<bool> stopped = false;
+
+	// Null when the workers are not pinned, everything is then on node 0
+	const numa_topology *topology;
+
+	std::vector<std::unique_ptr<worker_queue>> queues;
+	std::vector<size_t> worker_nodes;
+	std::vector<std::unique_ptr<injection_queue>> injections;
+
+	std::atomic<size_t> queued = 0;
+	std::atomic<size_t> idle_workers = 0;
+	std::mutex idle_mutex;
+	std::condition_variable idle_condition;
+
+	std::mutex reactor_mutex;
+	std::condition_variable reactor_condition;
+	std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+	std::vector<pending_io *> pending;
+
+	std::vector<std::thread> workers;
+	std::thread reactor;
+
+	static detached_task run_detached(task<void> coroutine)
+	{
+		co_await coroutine;
+	}
+
+	static detached_task run_job(std::function<void()> job)
+	{
+		job();
+		co_return;
+	}
+
+	[[nodiscard]] static std::coroutine_handle<> take(std::mutex &mutex, std::deque<std::coroutine_handle<>> &tasks, bool newest)
+	{
+		auto guard = std::lock_guard(mutex);
+		if (tasks.empty())
+		{
+			return nullptr;
+		}
+
+		auto handle = newest ? tasks.back() : tasks.front();
+		newest ? tasks.pop_back() : tasks.pop_front();
+		return handle;
+	}
+
+	// Own queue, own node, then the other nodes
+	[[nodiscard]] std::coroutine_handle<> find_work(size_t self)
+	{
+		auto node = worker_nodes[self];
+
+		if (auto handle = take(queues[self]->mutex, queues[self]->tasks, true))
+		{
+			return handle;
+		}
+
+		for (auto local : { true, false })
+		{
+			for (size_t i = 0; i < injections.size(); ++i)
+			{
+				if ((i == node) == local)
+				{
+					if (auto handle = take(injections[i]->mutex, injections[i]->tasks, false))
+					{
+						return handle;
+					}
+				}
+			}
+
+			for (size_t i = 1; i < queues.size(); ++i)
+			{
+				auto victim = (self + i) % queues.size();
+				if ((worker_nodes[victim] == node) != local)
+				{
+					continue;
+				}
+
+				if (auto handle = take(queues[victim]->mutex, queues[victim]->tasks, false))
+				{
+					queues[self]->stolen.fetch_add(1, std::memory_order_relaxed);
+					return handle;
+				}
+			}
+		}
+
+		return nullptr;
+	}
+
+	[[nodiscard]] size_t current_node() const noexcept
+	{
+		return current_executor == this && current_worker < queues.size() ? worker_nodes[current_worker] : 0;
+	}
+
+	void work(size_t self)
+	{
+		current_executor = this;
+		current_worker = self;
+
+		if (topology)
+		{
+			topology->pin_current_thread(worker_nodes[self]);
+		}
+
+		while (true)
+		{
+			if (auto handle = find_work(self))
+			{
+				queued.fetch_sub(1);
+				queues[self]->executed.fetch_add(1, std::memory_order_relaxed);
+				handle.resume();
+				continue;
+			}
+
+			auto lock = std::unique_lock(idle_mutex);
+			idle_workers.fetch_add(1);
+			idle_condition.wait(lock, [this] { return stopped || queued.load() > 0; });
+			idle_workers.fetch_sub(1);
+
+			if (stopped && queued.load() == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	void react()
+	{
+		current_executor = this;
+
+		auto poll_interval = clock::duration(min_poll_interval);
+		auto polling = std::vector<pending_io *>();
+		auto completed = std::vector<std::pair<std::coroutine_handle<>, size_t>>();
+
+		while (!stopped)
+		{
+			{
+				auto lock = std::unique_lock(reactor_mutex);
+
+				for (auto now = clock::now(); !timers.empty() && timers.top().deadline <= now; timers.pop())
+				{
+					completed.emplace_back(timers.top().handle, timers.top().node);
+				}
+
+				polling.swap(pending);
+			}
+
+			// Attempts are system calls, they are made without holding the lock
+			auto unfinished = std::partition(polling.begin(), polling.end(), [](pending_io *io) { return !io->attempt(); });
+			for (auto io = unfinished; io != polling.end(); ++io)
+			{
+				completed.emplace_back((*io)->handle, (*io)->node);
+			}
+			polling.erase(unfinished, polling.end());
+
+			poll_interval = completed.empty() ? std::min<clock::duration>(poll_interval * 2, max_poll_interval) : min_poll_interval;
+
+			for (auto [handle, node] : completed)
+			{
+				schedule(handle, node);
+			}
+			completed.clear();
+
+			auto lock = std::unique_lock(reactor_mutex);
+			pending.insert(pending.end(), polling.begin(), polling.end());
+			polling.clear();
+
+			auto wake_up = pending.empty() ? clock::time_point::max() : clock::now() + poll_interval;
+			if (!timers.empty())
+			{
+				wake_up = std::min(wake_up, timers.top().deadline);
+			}
+
+			reactor_condition.wait_until(lock, wake_up);
+		}
+	}
+
+public:
+	struct statistics
+	{
+		size_t injected;
+		std::vector<size_t> nodes;
+		std::vector<size_t> depths;
+		std::vector<uint64_t> executed;
+		std::vector<uint64_t> stolen;
+	};
+
+	explicit executor(size_t workers_count = std::max(1u, std::thread::hardware_concurrency()), const numa_topology *topology = nullptr):
+		topology(topology), worker_nodes(topology ? topology->worker_nodes(workers_count) : std::vector<size_t>(workers_count, 0))
+	{
+		for (size_t i = 0; i < workers_count; ++i)
+		{
+			queues.push_back(std::make_unique<worker_queue>());
+		}
+
+		for (size_t i = 0; i < (topology ? topology->nodes_count() : 1); ++i)
+		{
+			injections.push_back(std::make_unique<injection_queue>());
+		}
+
+		reactor = std::thread(&executor::react, this);
+
+		for (size_t i = 0; i < workers_count; ++i)
+		{
+			workers.emplace_back(&executor::work, this, i);
+		}
+	}
+
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	// Coroutines still suspended at this point are abandoned
+	~executor()
+	{
+		stopped = true;
+		{
+			auto guard = std::lock_guard(reactor_mutex);
+			reactor_condition.notify_all();
+		}
+		{
+			auto guard = std::lock_guard(idle_mutex);
+			idle_condition.notify_all();
+		}
+
+		for (auto &&worker : workers)
+		{
+			worker.join();
+		}
+
+		reactor.join();
+	}
+
+	[[nodiscard]] static executor *current() noexcept
+	{
+		return current_executor;
+	}
+
+	[[nodiscard]] size_t workers_count() const noexcept
+	{
+		return workers.size();
+	}
+
+	// A worker keeps what it schedules for its own node in its own queue, the rest goes to the injection queue of the node
+	void schedule(std::coroutine_handle<> handle, size_t node = any_node)
+	{
+		if (node == any_node || node >= injections.size())
+		{
+			node = current_node();
+		}
+
+		// Counted before it becomes visible, so a worker never sees more work taken than queued
+		queued.fetch_add(1);
+
+		if (current_executor == this && current_worker < queues.size() && worker_nodes[current_worker] == node)
+		{
+			auto guard = std::lock_guard(queues[current_worker]->mutex);
+			queues[current_worker]->tasks.push_back(handle);
+		}
+		else
+		{
+			auto guard = std::lock_guard(injections[node]->mutex);
+			injections[node]->tasks.push_back(handle);
+		}
+
+		if (idle_workers.load() > 0)
+		{
+			auto guard = std::lock_guard(idle_mutex);
+			idle_condition.notify_one();
+		}
+	}
+
+	// Background job that does not belong to any session
+	void post(std::function<void()> job)
+	{
+		schedule(run_job(std::move(job)).handle);
+	}
+
+	// Behind the work already waiting for the node, what has come from outside included,
+	// so that the job runs once the coroutines that are ready now have had their go
+	void post_behind(std::function<void()> job)
+	{
+		schedule_behind(run_job(std::move(job)).handle);
+	}
+
+	// The same for a coroutine
+	void schedule_behind(std::coroutine_handle<> handle)
+	{
+		auto node = current_node();
+		queued.fetch_add(1);
+		{
+			auto guard = std::lock_guard(injections[node]->mutex);
+			injections[node]->tasks.push_back(handle);
+		}
+
+		if (idle_workers.load() > 0)
+		{
+			auto guard = std::lock_guard(idle_mutex);
+			idle_condition.notify_one();
+		}
+	}
+
+	// Whether coroutines are ready and waiting for a worker
+	[[nodiscard]] bool has_queued_work() const noexcept
+	{
+		return queued.load() != 0;
+	}
+
+	[[nodiscard]] statistics get_statistics()
+	{
+		auto result = statistics();
+		result.injected = 0;
+		result.nodes = worker_nodes;
+
+		for (auto &&injection : injections)
+		{
+			auto guard = std::lock_guard(injection->mutex);
+			result.injected += injection->tasks.size();
+		}
+
+		for (auto &&queue : queues)
+		{
+			auto guard = std::lock_guard(queue->mutex);
+			result.depths.push_back(queue->tasks.size());
+			result.executed.push_back(queue->executed.load(std::memory_order_relaxed));
+			result.stolen.push_back(queue->stolen.load(std::memory_order_relaxed));
+		}
+
+		return result;
+	}
+
+	void schedule_after(clock::duration delay, std::coroutine_handle<> handle)
+	{
+		{
+			auto guard = std::lock_guard(reactor_mutex);
+			timers.push({ clock::now() + delay, handle, current_node() });
+		}
+
+		reactor_condition.notify_one();
+	}
+
+	void wait_io(pending_io *io)
+	{
+		io->node = current_node();
+		{
+			auto guard = std::lock_guard(reactor_mutex);
+			pending.push_back(io);
+		}
+
+		reactor_condition.notify_one();
+	}
+
+	// Starts the coroutine on the workers, preferably those of the node, it owns itself from now on
+	void spawn(task<void> coroutine, size_t node = any_node)
+	{
+		schedule(run_detached(std::move(coroutine)).handle, node);
+	}
+
+	// Suspends the coroutine instead of blocking the worker thread
+	[[nodiscard]] static auto sleep_for(clock::duration delay) noexcept
+	{
+		struct sleep_awaiter
+		{
+			clock::duration delay;
+
+			bool await_ready() const
+			{
+				if (delay <= clock::duration::zero())
+				{
+					return true;
+				}
+
+				// Outside of an executor there is nobody to resume us, so just sleep
+				if (!current_executor)
+				{
+					std::this_thread::sleep_for(delay);
+					return true;
+				}
+
+				return false;
+			}
+
+			void await_suspend(std::coroutine_handle<> handle) const
+			{
+				current_executor->schedule_after(delay, handle);
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		return sleep_awaiter{ delay };
+	}
+
+	// Lets the work that is ready run before the coroutine goes on, for long computations that
+	// would otherwise keep their worker from everything queued behind them
+	[[nodiscard]] static auto yield() noexcept
+	{
+		struct yield_awaiter
+		{
+			bool await_ready() const noexcept
+			{
+				return !current_executor;
+			}
+
+			void await_suspend(std::coroutine_handle<> handle) const
+			{
+				current_executor->schedule_behind(handle);
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		return yield_awaiter{};
+	}
+};
+
+#endif // !__EXECUTOR_HPP__
@@ -0,0 +1,45 @@
+#ifndef __EXPORT_DIRECTORY_HPP__
+#define __EXPORT_DIRECTORY_HPP__
+
+#include <string>
+#include <utility>
+#include <filesystem>
+#include <string_view>
+
+#include "status.hpp"
+#include "logging.hpp"
+
+// Files written at a client's request all go to one directory chosen when the server starts, the
+// working directory unless told otherwise. A client only names the file: a name with a slash or ".."
+// could reach anywhere the server may write, so it is refused.
+class export_directory
+{
+private:
+	static inline std::filesystem::path directory = ".";
+
+public:
+	[[nodiscard]] static status set(const std::string &path)
+	{
+		auto error = std::error_code();
+		if (!std::filesystem::is_directory(path, error))
+		{
+			logging::errlog("not a directory to export to: " + path);
+			return status::failed_initialization;
+		}
+
+		directory = path;
+		return status::success;
+	}
+
+	[[nodiscard]] static std::pair<std::string, status> resolve(std::string_view name)
+	{
+		if (name.empty() || name.find('/') != std::string_view::npos || name.find("..") != std::string_view::npos)
+		{
+			return { {}, status::incorrect_file_name };
+		}
+
+		return { (directory / name).string(), status::success };
+	}
+};
+
+#endif // !__EXPORT_DIRECTORY_HPP__
@@ -0,0 +1,137 @@
+#ifndef __FLEET_HPP__
+#define __FLEET_HPP__
+
+#include <vector>
+
+#include "storage_tank.hpp"
+#include "fleet_index.hpp"
+#include "flow_engine.hpp"
+#include "inventory_ledger.hpp"
+#include "replication.hpp"
+#include "numa_placement.hpp"
+
+// All tanks of the terminal together with the fleet-wide services kept up to date by their changes
+class fleet : public tank_observer_if
+{
+private:
+	// Outlives the tanks it holds
+	numa_resource placement;
+
+	// Outlives the tanks writing through it
+	tank_epochs epochs;
+
+	tank_vector tanks;
+	fleet_index index;
+	inventory_ledger ledger;
+	flow_engine flow;
+
+	void attach()
+	{
+		for (size_t id = 0; id < tanks.size(); ++id)
+		{
+			tanks[id].set_id(id);
+			tanks[id].set_epochs(&epochs);
+		}
+
+		index.build(tanks);
+		ledger.build(tanks);
+
+		for (auto &&tank : tanks)
+		{
+			tank.set_observer(this);
+		}
+	}
+
+public:
+	// The topology the policy places memory on, none without placement
+	[[nodiscard]] static const numa_topology *topology_of(placement_policy policy) noexcept
+	{
+		return policy == placement_policy::numa ? &numa_topology::current() : nullptr;
+	}
+
+	explicit fleet(size_t number_of_tanks, placement_policy policy = placement_policy::none):
+		placement(topology_of(policy)), tanks(number_of_tanks, &placement), flow(tanks)
+	{
+		attach();
+	}
+
+	// Tanks start from the given states, the services are built from them
+	explicit fleet(const std::vector<tank_snapshot> &states, placement_policy policy = placement_policy::none):
+		placement(topology_of(policy)), tanks(states.size(), &placement), flow(tanks)
+	{
+		for (size_t id = 0; id < tanks.size(); ++id)
+		{
+			tanks[id].restore(states[id]);
+		}
+
+		attach();
+	}
+
+	fleet(const fleet &) = delete;
+	fleet &operator=(const fleet &) = delete;
+
+	void state_changed(const storage_tank &tank) override
+	{
+		index.state_changed(tank);
+		ledger.state_changed(tank);
+		flow.state_changed(tank);
+		replication::record(tank);
+	}
+
+	// Streams the changes of the tanks to a standby connecting to the socket
+	[[nodiscard]] status start_replication(const std::string &path) const
+	{
+		return replication::start_primary(path, tanks);
+	}
+
+	// Point-in-time image of all tanks while the sessions keep changing them: read each tank once
+	// through storage_tank::snapshot(point) while it is open
+	[[nodiscard]] tank_epochs::snapshot open_snapshot()
+	{
+		return tank_epochs::snapshot(epochs);
+	}
+
+	[[nodiscard]] storage_tank &at(size_t id)
+	{
+		return tanks.at(id);
+	}
+
+	[[nodiscard]] storage_tank &operator[](size_t id) noexcept
+	{
+		return tanks[id];
+	}
+
+	[[nodiscard]] size_t size() const noexcept
+	{
+		return tanks.size();
+	}
+
+	// Node whose memory holds the tank, the one its sessions are best served on
+	[[nodiscard]] size_t node_of(size_t id) const noexcept
+	{
+		auto topology = placement.get_topology();
+		return topology ? topology->node_of(id, tanks.size()) : 0;
+	}
+
+	[[nodiscard]] const numa_resource &get_placement() const noexcept
+	{
+		return placement;
+	}
+
+	[[nodiscard]] const fleet_index &get_index() const noexcept
+	{
+		return index;
+	}
+
+	[[nodiscard]] const inventory_ledger &get_ledger() const noexcept
+	{
+		return ledger;
+	}
+
+	[[nodiscard]] flow_engine &get_flow() noexcept
+	{
+		return flow;
+	}
+};
+
+#endif // !__FLEET_HPP__
@@ -0,0 +1,387 @@
+#ifndef __FLEET_CONFIG_HPP__
+#define __FLEET_CONFIG_HPP__
+
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <charconv>
+#include <algorithm>
+#include <string_view>
+
+#include "fleet.hpp"
+#include "logging.hpp"
+
+// Bulk import and export of the configuration and state of every tank.
+// A CSV file has a line per tank with the fields of the fleet snapshot command and the product grade:
+//   id,working,loading_pump,unloading_pump,lower_level,upper_level,download_speed,unloading_speed,level,grade
+// where the flags are 0 or 1, the grade may be left out for crude and tanks that are not listed keep the defaults.
+// A tank whose level is not within its lower and upper levels is rejected, in either format.
+// The binary format is a header followed by fixed-size records in id order; files starting with its magic
+// are read as binary. The grade is kept in the flags, files from before grades hold crude.
+class fleet_config
+{
+private:
+	static constexpr std::string_view csv_header = "id,working,loading_pump,unloading_pump,lower_level,upper_level,download_speed,unloading_speed,level,grade";
+	static constexpr std::string_view csv_header_without_grade = "id,working,loading_pump,unloading_pump,lower_level,upper_level,download_speed,unloading_speed,level";
+	static constexpr std::string_view binary_magic = "OILFLT01";
+
+	// Below this a file is not worth splitting between threads
+	static const size_t min_chunk_size = 1 << 20;
+
+	// Tanks are created for every id up to the largest one, a larger id is a mistake rather than a fleet
+	static const uint64_t max_tanks_count = uint64_t(1) << 26;
+
+	enum flag : uint64_t
+	{
+		working = 1,
+		loading_pump = 2,
+		unloading_pump = 4
+	};
+
+	static const uint64_t grade_shift = 8;
+
+	struct binary_record
+	{
+		uint64_t flags;
+		uint64_t lower_permissible_level;
+		uint64_t upper_acceptable_level;
+		uint64_t download_speed;
+		uint64_t unloading_speed;
+		uint64_t level_of_oil_products;
+	};
+
+	struct parsed_chunk
+	{
+		std::vector<std::pair<uint64_t, binary_record>> tanks;
+		size_t lines = 0;
+		// Line within the chunk, 0 if the chunk is correct
+		size_t error_line = 0;
+	};
+
+	[[nodiscard]] static uint64_t flags_of(const tank_snapshot &tank) noexcept
+	{
+		return (tank.work_state == working_state::work ? flag::working : flag(0))
+			| (tank.loading_pump_status == activity_state::active ? flag::loading_pump : flag(0))
+			| (tank.unloading_pump_status == activity_state::active ? flag::unloading_pump : flag(0))
+			| uint64_t(tank.grade) << grade_shift;
+	}
+
+	static void apply_flags(tank_snapshot &tank, uint64_t flags) noexcept
+	{
+		tank.work_state = flags & flag::working ? working_state::work : working_state::non_work;
+		tank.loading_pump_status = flags & flag::loading_pump ? activity_state::active : activity_state::inactive;
+		tank.unloading_pump_status = flags & flag::unloading_pump ? activity_state::active : activity_state::inactive;
+		tank.grade = (flags >> grade_shift) < product_grades_count ? product_grade(flags >> grade_shift) : product_grade::crude;
+	}
+
+	// A tank the server could never have got into: its level outside of its limits
+	[[nodiscard]] static bool consistent(const binary_record &record) noexcept
+	{
+		return record.lower_permissible_level <= record.level_of_oil_products && record.level_of_oil_products <= record.upper_acceptable_level;
+	}
+
+	static void apply_record(tank_snapshot &tank, const binary_record &record) noexcept
+	{
+		apply_flags(tank, record.flags);
+		tank.lower_permissible_level = record.lower_permissible_level;
+		tank.upper_acceptable_level = record.upper_acceptable_level;
+		tank.download_speed = record.download_speed;
+		tank.unloading_speed = record.unloading_speed;
+		tank.level_of_oil_products = record.level_of_oil_products;
+	}
+
+	[[nodiscard]] static bool parse_line(std::string_view line, uint64_t &id, binary_record &record) noexcept
+	{
+		enum { tank_id, work_state, loading, unloading, lower_level, upper_level, download_speed, unloading_speed, level, fields_count };
+
+		uint64_t fields[fields_count];
+		auto position = line.data();
+		auto end = line.data() + line.size();
+
+		for (size_t i = 0; i < fields_count; ++i)
+		{
+			if (i != 0 && (position == end || *position++ != ','))
+			{
+				return false;
+			}
+
+			auto [next, error] = std::from_chars(position, end, fields[i]);
+			if (error != std::errc())
+			{
+				return false;
+			}
+			position = next;
+		}
+
+		auto grade = std::optional<product_grade>(product_grade::crude);
+		if (position != end && *position == ',')
+		{
+			grade = st::stopg(std::string_view(position + 1, end));
+			position = end;
+		}
+
+		if (position != end || !grade || fields[tank_id] >= max_tanks_count || fields[work_state] > 1 || fields[loading] > 1 || fields[unloading] > 1)
+		{
+			return false;
+		}
+
+		id = fields[tank_id];
+		record = {
+			(fields[work_state] ? flag::working : flag(0)) | (fields[loading] ? flag::loading_pump : flag(0)) | (fields[unloading] ? flag::unloading_pump : flag(0))
+				| uint64_t(*grade) << grade_shift,
+			fields[lower_level], fields[upper_level], fields[download_speed], fields[unloading_speed], fields[level]
+		};
+
+		return consistent(record);
+	}
+
+	static void parse_chunk(std::string_view text, parsed_chunk &chunk)
+	{
+		static const size_t typical_line_length = 32;
+		chunk.tanks.reserve(text.size() / typical_line_length);
+
+		while (!text.empty())
+		{
+			auto line = text.substr(0, text.find('\n'));
+			text.remove_prefix(std::min(text.size(), line.size() + 1));
+			++chunk.lines;
+
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.remove_suffix(1);
+			}
+
+			if (line.empty() || line.front() == '#' || line == csv_header || line == csv_header_without_grade)
+			{
+				continue;
+			}
+
+			auto id = uint64_t(0);
+			auto record = binary_record();
+			if (!parse_line(line, id, record))
+			{
+				chunk.error_line = chunk.lines;
+				return;
+			}
+
+			chunk.tanks.emplace_back(id, record);
+		}
+	}
+
+	// Every thread parses whole lines of its part of the file, the results are put in place by id afterwards
+	[[nodiscard]] static std::pair<std::vector<tank_snapshot>, status> parse_csv(std::string_view text)
+	{
+		auto threads_count = std::clamp<size_t>(text.size() / min_chunk_size, 1, std::max(1u, std::thread::hardware_concurrency()));
+		auto chunks = std::vector<parsed_chunk>(threads_count);
+		auto bounds = std::vector<size_t>{ 0 };
+
+		for (size_t i = 1; i < threads_count; ++i)
+		{
+			auto boundary = text.find('\n', std::max(bounds.back(), text.size() / threads_count * i));
+			bounds.push_back(boundary == std::string_view::npos ? text.size() : boundary + 1);
+		}
+		bounds.push_back(text.size());
+
+		auto workers = std::vector<std::thread>();
+		for (size_t i = 1; i < threads_count; ++i)
+		{
+			workers.emplace_back(parse_chunk, text.substr(bounds[i], bounds[i + 1] - bounds[i]), std::ref(chunks[i]));
+		}
+		parse_chunk(text.substr(0, bounds[1]), chunks[0]);
+
+		for (auto &&worker : workers)
+		{
+			worker.join();
+		}
+
+		auto first_line = size_t(0);
+		auto tanks_count = size_t(0);
+		for (auto &&chunk : chunks)
+		{
+			if (chunk.error_line)
+			{
+				logging::errlog("incorrect tank description on line " + std::to_string(first_line + chunk.error_line));
+				return { {}, status::incorrect_configuration };
+			}
+
+			first_line += chunk.lines;
+			for (auto &&[id, record] : chunk.tanks)
+			{
+				tanks_count = std::max<size_t>(tanks_count, id + 1);
+			}
+		}
+
+		auto states = std::vector<tank_snapshot>(tanks_count);
+		auto described = std::vector<bool>(tanks_count);
+		for (auto &&chunk : chunks)
+		{
+			for (auto &&[id, record] : chunk.tanks)
+			{
+				if (described[id])
+				{
+					logging::errlog("tank " + std::to_string(id) + " is described more than once");
+					return { {}, status::incorrect_configuration };
+				}
+
+				described[id] = true;
+				apply_record(states[id], record);
+			}
+		}
+
+		return { std::move(states), status::success };
+	}
+
+	[[nodiscard]] static std::pair<std::vector<tank_snapshot>, status> parse_binary(std::string_view data)
+	{
+		data.remove_prefix(binary_magic.size());
+
+		auto tanks_count = uint64_t(0);
+		if (data.size() < sizeof(tanks_count))
+		{
+			return { {}, status::incorrect_configuration };
+		}
+
+		std::memcpy(&tanks_count, data.data(), sizeof(tanks_count));
+		data.remove_prefix(sizeof(tanks_count));
+
+		if (tanks_count > max_tanks_count)
+		{
+			logging::errlog("too many tanks in the binary configuration: " + std::to_string(tanks_count));
+			return { {}, status::incorrect_configuration };
+		}
+
+		if (data.size() != tanks_count * sizeof(binary_record))
+		{
+			logging::errlog("the binary configuration is truncated");
+			return { {}, status::incorrect_configuration };
+		}
+
+		auto states = std::vector<tank_snapshot>(tanks_count);
+		for (uint64_t id = 0; id < tanks_count; ++id)
+		{
+			auto record = binary_record();
+			std::memcpy(&record, data.data() + id * sizeof(binary_record), sizeof(binary_record));
+
+			if (!consistent(record))
+			{
+				logging::errlog("incorrect description of tank " + std::to_string(id) + " in the binary configuration");
+				return { {}, status::incorrect_configuration };
+			}
+
+			apply_record(states[id], record);
+		}
+
+		return { std::move(states), status::success };
+	}
+
+	static void format_csv(fleet &tanks, tank_epochs::snapshot &point, size_t first, size_t last, std::string &text)
+	{
+		char number[24];
+		auto put = [&](uint64_t value, char separator)
+		{
+			text.append(number, size_t(std::to_chars(number, std::end(number), value).ptr - number));
+			text.push_back(separator);
+		};
+
+		for (auto id = first; id < last; ++id)
+		{
+			auto tank = tanks[id].snapshot(point);
+			auto flags = flags_of(tank);
+
+			put(id, ',');
+			put((flags & flag::working) != 0, ',');
+			put((flags & flag::loading_pump) != 0, ',');
+			put((flags & flag::unloading_pump) != 0, ',');
+			put(tank.lower_permissible_level, ',');
+			put(tank.upper_acceptable_level, ',');
+			put(tank.download_speed, ',');
+			put(tank.unloading_speed, ',');
+			put(tank.level_of_oil_products, ',');
+			text.append(st::pgtos(tank.grade)).push_back('\n');
+		}
+	}
+
+public:
+	[[nodiscard]] static std::pair<std::vector<tank_snapshot>, status> load(const std::string &path)
+	{
+		auto file = std::ifstream(path, std::ios::binary);
+		if (!file)
+		{
+			logging::errlog("unable to open the fleet configuration: " + path);
+			return { {}, status::incorrect_configuration };
+		}
+
+		auto content = std::string(size_t(file.seekg(0, std::ios::end).tellg()), '\0');
+		file.seekg(0).read(content.data(), content.size());
+		if (std::string_view(content).starts_with(binary_magic))
+		{
+			return parse_binary(content);
+		}
+
+		return parse_csv(content);
+	}
+
+	// A path ending with ".csv" gets CSV, anything else the binary format. The fleet is saved as it was
+	// when the call started, without stopping the sessions changing it meanwhile
+	static status save(fleet &tanks, const std::string &path)
+	{
+		auto content = std::string();
+		auto point = tanks.open_snapshot();
+
+		if (std::string_view(path).ends_with(".csv"))
+		{
+			static const size_t tanks_per_thread = 65536;
+			auto threads_count = std::clamp<size_t>(tanks.size() / tanks_per_thread, 1, std::max(1u, std::thread::hardware_concurrency()));
+			auto parts = std::vector<std::string>(threads_count);
+			auto workers = std::vector<std::thread>();
+
+			for (size_t i = 0; i < threads_count; ++i)
+			{
+				workers.emplace_back(format_csv, std::ref(tanks), std::ref(point), tanks.size() * i / threads_count, tanks.size() * (i + 1) / threads_count, std::ref(parts[i]));
+			}
+
+			for (auto &&worker : workers)
+			{
+				worker.join();
+			}
+
+			content.append(csv_header).push_back('\n');
+			for (auto &&part : parts)
+			{
+				content += part;
+			}
+		}
+		else
+		{
+			auto tanks_count = uint64_t(tanks.size());
+			content.append(binary_magic);
+			content.append(reinterpret_cast<const char *>(&tanks_count), sizeof(tanks_count));
+
+			for (size_t id = 0; id < tanks.size(); ++id)
+			{
+				auto tank = tanks[id].snapshot(point);
+				auto record = binary_record{ flags_of(tank), tank.lower_permissible_level, tank.upper_acceptable_level,
+					tank.download_speed, tank.unloading_speed, tank.level_of_oil_products };
+
+				content.append(reinterpret_cast<const char *>(&record), sizeof(record));
+			}
+		}
+
+		auto read = point.get_statistics();
+		logging::inflog<"fleet snapshot: {} tanks, {} kept from later changes">(read.read, read.preserved);
+
+		auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+		if (!file.write(content.data(), content.size()))
+		{
+			logging::errlog("unable to write the fleet configuration: " + path);
+			return status::incorrect_configuration;
+		}
+
+		return status::success;
+	}
+};
+
+#endif // !__FLEET_CONFIG_HPP__
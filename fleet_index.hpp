@@ -0,0 +1,215 @@
+#ifndef __FLEET_INDEX_HPP__
+#define __FLEET_INDEX_HPP__
+
+#include <set>
+#include <vector>
+#include <array>
+#include <limits>
+#include <optional>
+#include <algorithm>
+#include <shared_mutex>
+
+#include "storage_tank.hpp"
+
+// Ordered secondary indexes over the fleet, kept up to date on every tank state change.
+// Tanks are sharded by id so that sessions changing different tanks rarely meet on the same lock.
+class fleet_index : public tank_observer_if
+{
+public:
+	enum class order
+	{
+		level,
+		fill
+	};
+
+	struct entry
+	{
+		uint64_t id;
+		uint64_t level;
+		// Parts per million of the upper acceptable level
+		uint64_t fill;
+		bool working;
+	};
+
+	static const uint64_t fill_scale = 1'000'000;
+
+private:
+	static const size_t shards_count = 16;
+
+	// Working tanks come first, so every working state occupies a contiguous part of the index
+	struct key
+	{
+		bool non_working;
+		uint64_t value;
+		uint64_t id;
+
+		[[nodiscard]] auto operator<=>(const key &) const noexcept = default;
+	};
+
+	struct shard
+	{
+		mutable std::shared_mutex mutex;
+		std::set<key> by_level;
+		std::set<key> by_fill;
+	};
+
+	std::array<shard, shards_count> shards;
+	std::vector<entry> entries;
+
+	[[nodiscard]] static entry make_entry(const storage_tank &tank)
+	{
+		auto state = tank.snapshot();
+		auto fill = state.upper_acceptable_level == 0 ? 0 :
+			uint64_t(std::min(double(state.level_of_oil_products) / state.upper_acceptable_level * fill_scale, 1e18));
+
+		return { tank.get_id(), state.level_of_oil_products, fill, state.work_state == working_state::work };
+	}
+
+	[[nodiscard]] static key level_key(const entry &tank) noexcept
+	{
+		return { !tank.working, tank.level, tank.id };
+	}
+
+	[[nodiscard]] static key fill_key(const entry &tank) noexcept
+	{
+		return { !tank.working, tank.fill, tank.id };
+	}
+
+	[[nodiscard]] shard &shard_of(uint64_t id) noexcept
+	{
+		return shards[id % shards_count];
+	}
+
+	static void replace(std::set<key> &index, const key &old_key, const key &new_key)
+	{
+		if (old_key == new_key)
+		{
+			return;
+		}
+
+		// Reuses the tree node, an update does not allocate
+		auto node = index.extract(old_key);
+		node.value() = new_key;
+		index.insert(std::move(node));
+	}
+
+	static void sort(std::vector<entry> &found, order by, bool descending)
+	{
+		std::sort(found.begin(), found.end(), [by, descending](const entry &lhs, const entry &rhs)
+		{
+			auto lhs_key = by == order::level ? level_key(lhs) : fill_key(lhs);
+			auto rhs_key = by == order::level ? level_key(rhs) : fill_key(rhs);
+
+			lhs_key.non_working = rhs_key.non_working = false;
+			return descending ? rhs_key < lhs_key : lhs_key < rhs_key;
+		});
+	}
+
+	// Walks the index of every requested working state in key order
+	template <typename F>
+	void scan(order by, std::optional<bool> working, uint64_t from, uint64_t to, bool descending, size_t limit, F &&collect) const
+	{
+		for (auto non_working : { false, true })
+		{
+			if (working.has_value() && working.value() == non_working)
+			{
+				continue;
+			}
+
+			auto first = key{ non_working, from, 0 };
+			auto last = key{ non_working, to, std::numeric_limits<uint64_t>::max() };
+
+			for (auto &&current_shard : shards)
+			{
+				auto guard = std::shared_lock(current_shard.mutex);
+				auto &&index = by == order::level ? current_shard.by_level : current_shard.by_fill;
+				auto begin = index.lower_bound(first);
+				auto end = index.upper_bound(last);
+				auto taken = size_t(0);
+
+				if (descending)
+				{
+					for (auto it = std::make_reverse_iterator(end); it != std::make_reverse_iterator(begin) && taken < limit; ++it, ++taken)
+					{
+						collect(entries[it->id]);
+					}
+				}
+				else
+				{
+					for (auto it = begin; it != end && taken < limit; ++it, ++taken)
+					{
+						collect(entries[it->id]);
+					}
+				}
+			}
+		}
+	}
+
+public:
+	void build(const tank_vector &tanks)
+	{
+		entries.resize(tanks.size());
+
+		auto level_keys = std::array<std::vector<key>, shards_count>();
+		auto fill_keys = std::array<std::vector<key>, shards_count>();
+
+		for (auto &&tank : tanks)
+		{
+			auto &&current = entries[tank.get_id()] = make_entry(tank);
+			level_keys[current.id % shards_count].push_back(level_key(current));
+			fill_keys[current.id % shards_count].push_back(fill_key(current));
+		}
+
+		// Sorted keys go to the end of the tree, so inserting them needs no search
+		for (size_t i = 0; i < shards_count; ++i)
+		{
+			std::sort(level_keys[i].begin(), level_keys[i].end());
+			std::sort(fill_keys[i].begin(), fill_keys[i].end());
+
+			shards[i].by_level.insert(level_keys[i].begin(), level_keys[i].end());
+			shards[i].by_fill.insert(fill_keys[i].begin(), fill_keys[i].end());
+		}
+	}
+
+	void state_changed(const storage_tank &tank) override
+	{
+		auto &&current_shard = shard_of(tank.get_id());
+		auto guard = std::unique_lock(current_shard.mutex);
+
+		// The state is re-read under the shard lock, so the last notification always wins
+		auto &&current = entries[tank.get_id()];
+		auto updated = make_entry(tank);
+
+		replace(current_shard.by_level, level_key(current), level_key(updated));
+		replace(current_shard.by_fill, fill_key(current), fill_key(updated));
+		current = updated;
+	}
+
+	// Tanks with the value in [from, to], in ascending order, at most limit of them
+	[[nodiscard]] std::pair<std::vector<entry>, bool> find(order by, uint64_t from, uint64_t to, std::optional<bool> working, size_t limit) const
+	{
+		auto found = std::vector<entry>();
+		scan(by, working, from, to, false, limit + 1, [&](const entry &tank) { found.push_back(tank); });
+
+		sort(found, by, false);
+
+		auto truncated = found.size() > limit;
+		found.resize(std::min(found.size(), limit));
+
+		return { found, truncated };
+	}
+
+	// The k emptiest (or fullest) tanks
+	[[nodiscard]] std::vector<entry> top(order by, size_t k, bool fullest, std::optional<bool> working) const
+	{
+		auto found = std::vector<entry>();
+		scan(by, working, 0, std::numeric_limits<uint64_t>::max(), fullest, k, [&](const entry &tank) { found.push_back(tank); });
+
+		sort(found, by, fullest);
+		found.resize(std::min(found.size(), k));
+
+		return found;
+	}
+};
+
+#endif // !__FLEET_INDEX_HPP__
@@ -0,0 +1,339 @@
+#ifndef __FLOW_ENGINE_HPP__
+#define __FLOW_ENGINE_HPP__
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "storage_tank.hpp"
+#include "executor.hpp"
+#include "instrumented_mutex.hpp"
+
+// Continuous flow through the running pumps of the whole fleet: every tick moves each tank by speed * dt.
+// Levels and speeds are kept as contiguous arrays advanced by a branchless kernel the compiler vectorizes;
+// tanks see their whole level written back as the tick budget allows, and a pump stopping at a limit
+// right away, while no session holds them. A tick yields its worker between chunks of tanks.
+class flow_engine : public tank_observer_if
+{
+public:
+	struct statistics
+	{
+		bool enabled;
+		uint64_t ticks;
+		size_t flowing;
+		std::chrono::microseconds kernel;
+		std::chrono::microseconds tick;
+	};
+
+	static constexpr auto tick_interval = std::chrono::milliseconds(100);
+
+private:
+	enum pump : uint8_t
+	{
+		loading = 1,
+		unloading = 2
+	};
+
+	// Changes made by the engine itself are not queued for reloading, it reloads those tanks right away
+	static inline thread_local bool publishing = false;
+
+	tank_vector &tanks;
+
+	// One element per tank
+	std::vector<double> level;
+	std::vector<double> inflow;
+	std::vector<double> outflow;
+	std::vector<double> lower;
+	std::vector<double> upper;
+
+	// What the tanks were last told: the whole level and the pumps that run
+	std::vector<uint64_t> published;
+	std::vector<uint8_t> running;
+
+	std::mutex dirty_mutex;
+	std::vector<uint64_t> dirty;
+	std::vector<uint64_t> reloading;
+
+	// Writing back goes through the tank observers and costs far more than the kernel, so it is bounded
+	static constexpr auto publish_share = 0.5;
+	static const size_t deadline_check_interval = 1024;
+
+	// Tanks advanced or visited before the worker is given up to the sessions
+	static const size_t chunk_size = 64 * 1024;
+	uint64_t publish_cursor = 0;
+
+	std::atomic<bool> enabled = false;
+	std::atomic<uint64_t> ticks = 0;
+	std::atomic<size_t> flowing = 0;
+	std::atomic<int64_t> kernel_time = 0;
+	std::atomic<int64_t> tick_time = 0;
+
+	// Only a working tank flows, and only through a pump that is active and has a speed
+	void load(uint64_t id)
+	{
+		auto tank = tanks[id].snapshot();
+		auto working = tank.work_state == working_state::work;
+		auto loading_runs = working && tank.loading_pump_status == activity_state::active && tank.download_speed != 0;
+		auto unloading_runs = working && tank.unloading_pump_status == activity_state::active && tank.unloading_speed != 0;
+
+		inflow[id] = unloading_runs ? double(tank.unloading_speed) : 0.0;
+		outflow[id] = loading_runs ? double(tank.download_speed) : 0.0;
+		lower[id] = double(tank.lower_permissible_level);
+		upper[id] = double(tank.upper_acceptable_level);
+		running[id] = (loading_runs ? pump::loading : 0) | (unloading_runs ? pump::unloading : 0);
+
+		// The fraction accumulated by the engine survives as long as nobody else moved the level
+		if (tank.level_of_oil_products != published[id])
+		{
+			level[id] = double(tank.level_of_oil_products);
+			published[id] = tank.level_of_oil_products;
+		}
+	}
+
+	// Unloading raises the level up to the upper limit, loading lowers it down to the lower one;
+	// a pump whose limit is reached stops, as it does at the end of a transfer. Selects instead of
+	// branches, so the loop is vectorized for whatever the target has
+	static void advance(double *__restrict level, double *__restrict inflow, double *__restrict outflow,
+		const double *__restrict lower, const double *__restrict upper, size_t count, double dt) noexcept
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			auto current = level[i];
+			auto in = inflow[i];
+			auto out = outflow[i];
+			auto delta = (in - out) * dt;
+
+			// A level already beyond a limit is not pulled back by the clamping
+			auto raised = std::min(current + delta, std::max(current, upper[i]));
+			auto lowered = std::max(current + delta, std::min(current, lower[i]));
+			auto next = delta > 0.0 ? raised : current;
+			next = delta < 0.0 ? lowered : next;
+
+			// & rather than &&, which would be a branch and keep the loop from being vectorized
+			level[i] = next;
+			inflow[i] = (delta > 0.0) & (next >= upper[i]) ? 0.0 : in;
+			outflow[i] = (delta < 0.0) & (next <= lower[i]) ? 0.0 : out;
+		}
+	}
+
+	// Only into a tank nobody holds: a session holding it may be editing its automation rules or be in
+	// the middle of a transfer that writes the level back, so the tank is tried again on the next tick
+	void publish(uint64_t id)
+	{
+		auto &&tank = tanks[id];
+		if (!tank._get_sync_object().try_lock())
+		{
+			return;
+		}
+		auto guard = instrumented_mutex::lock_guard(&tank._get_sync_object());
+
+		if (auto whole = uint64_t(level[id]); whole != published[id])
+		{
+			published[id] = whole;
+			tank.set_level_of_oil_products(whole);
+		}
+
+		if ((running[id] & pump::unloading) && inflow[id] == 0.0)
+		{
+			tank.set_unloading_pump_status(activity_state::inactive);
+		}
+
+		if ((running[id] & pump::loading) && outflow[id] == 0.0)
+		{
+			tank.set_loading_pump_status(activity_state::inactive);
+		}
+
+		// Automation rules may have switched pumps while the level was written
+		load(id);
+	}
+
+	// Kernel and tick time count only what the worker spent on the tick, not the yields in between
+	task<void> tick(double dt)
+	{
+		using clock = std::chrono::steady_clock;
+
+		auto busy = clock::duration::zero();
+		auto resumed = clock::now();
+		auto yield = [&]
+		{
+			busy += clock::now() - resumed;
+			return executor::yield();
+		};
+
+		{
+			auto guard = std::lock_guard(dirty_mutex);
+			reloading.swap(dirty);
+		}
+
+		for (size_t i = 0; i < reloading.size(); ++i)
+		{
+			if (i != 0 && i % chunk_size == 0)
+			{
+				co_await yield();
+				resumed = clock::now();
+			}
+			load(reloading[i]);
+		}
+		reloading.clear();
+
+		for (size_t first = 0; first < level.size(); first += chunk_size)
+		{
+			if (first != 0)
+			{
+				co_await yield();
+				resumed = clock::now();
+			}
+
+			auto count = std::min(chunk_size, level.size() - first);
+			advance(level.data() + first, inflow.data() + first, outflow.data() + first, lower.data() + first, upper.data() + first, count, dt);
+		}
+		busy += clock::now() - resumed;
+		auto kernel = busy;
+		auto deadline = clock::now() + tick_interval * publish_share;
+
+		co_await yield();
+		resumed = clock::now();
+
+		auto flowing_tanks = size_t(0);
+
+		// Pumps stopping at a limit are written back on every tick
+		for (uint64_t id = 0; id < tanks.size(); ++id)
+		{
+			if (id != 0 && id % chunk_size == 0)
+			{
+				co_await yield();
+				resumed = clock::now();
+			}
+
+			if (!running[id])
+			{
+				continue;
+			}
+
+			publishing = true;
+			if (((running[id] & pump::unloading) && inflow[id] == 0.0) || ((running[id] & pump::loading) && outflow[id] == 0.0))
+			{
+				publish(id);
+			}
+			publishing = false;
+			flowing_tanks += running[id] != 0;
+		}
+
+		// Levels are refreshed round-robin within a part of the tick: with more flowing tanks than fit,
+		// each one is refreshed less often while the kernel still advances all of them every tick
+		for (size_t visited = 0; visited < tanks.size(); ++visited, publish_cursor = (publish_cursor + 1) % tanks.size())
+		{
+			if (visited % deadline_check_interval == 0 && clock::now() > deadline)
+			{
+				break;
+			}
+
+			if (visited != 0 && visited % chunk_size == 0)
+			{
+				co_await yield();
+				resumed = clock::now();
+			}
+
+			if (running[publish_cursor] && uint64_t(level[publish_cursor]) != published[publish_cursor])
+			{
+				publishing = true;
+				publish(publish_cursor);
+				publishing = false;
+			}
+		}
+
+		busy += clock::now() - resumed;
+		ticks.fetch_add(1, std::memory_order_relaxed);
+		flowing.store(flowing_tanks, std::memory_order_relaxed);
+		kernel_time.store(std::chrono::duration_cast<std::chrono::microseconds>(kernel).count(), std::memory_order_relaxed);
+		tick_time.store(std::chrono::duration_cast<std::chrono::microseconds>(busy).count(), std::memory_order_relaxed);
+	}
+
+public:
+	explicit flow_engine(tank_vector &tanks): tanks(tanks)
+	{
+		level.resize(tanks.size());
+		inflow.resize(tanks.size());
+		outflow.resize(tanks.size());
+		lower.resize(tanks.size());
+		upper.resize(tanks.size());
+		published.resize(tanks.size());
+		running.resize(tanks.size());
+
+		for (uint64_t id = 0; id < tanks.size(); ++id)
+		{
+			level[id] = double(published[id] = tanks[id].get_level_of_oil_products());
+			load(id);
+		}
+	}
+
+	flow_engine(const flow_engine &) = delete;
+	flow_engine &operator=(const flow_engine &) = delete;
+
+	// A disabled engine reloads every tank when it is turned on, so nothing is queued meanwhile
+	void state_changed(const storage_tank &tank) override
+	{
+		if (publishing || !enabled)
+		{
+			return;
+		}
+
+		auto guard = std::lock_guard(dirty_mutex);
+		dirty.push_back(tank.get_id());
+	}
+
+	void set_enabled(bool state)
+	{
+		if (!state || enabled)
+		{
+			enabled = state;
+			return;
+		}
+
+		// Changes made while it was off were not queued
+		auto guard = std::lock_guard(dirty_mutex);
+		dirty.clear();
+		for (uint64_t id = 0; id < tanks.size(); ++id)
+		{
+			dirty.push_back(id);
+		}
+		enabled = true;
+	}
+
+	[[nodiscard]] statistics get_statistics() const noexcept
+	{
+		return {
+			enabled.load(),
+			ticks.load(std::memory_order_relaxed),
+			flowing.load(std::memory_order_relaxed),
+			std::chrono::microseconds(kernel_time.load(std::memory_order_relaxed)),
+			std::chrono::microseconds(tick_time.load(std::memory_order_relaxed))
+		};
+	}
+
+	// Ticks for as long as the executor runs, dt is the time actually elapsed; a tick may move
+	// between workers at its yields
+	task<void> run()
+	{
+		auto last_tick = std::chrono::steady_clock::now();
+
+		while (true)
+		{
+			co_await executor::sleep_for(tick_interval);
+
+			auto now = std::chrono::steady_clock::now();
+			auto dt = std::chrono::duration<double>(now - last_tick).count();
+			last_tick = now;
+
+			if (enabled)
+			{
+				co_await tick(dt);
+			}
+		}
+	}
+};
+
+#endif // !__FLOW_ENGINE_HPP__
@@ -0,0 +1,226 @@
+#ifndef __FRAME_RENDERER_HPP__
+#define __FRAME_RENDERER_HPP__
+
+#include <string>
+#include <vector>
+#include <charconv>
+#include <ostream>
+#include <algorithm>
+
+#include "dye.hpp"
+
+class frame_renderer
+{
+public:
+	struct cell
+	{
+		char symbol = ' ';
+		dye::code color = dye::code::white;
+
+		[[nodiscard]] bool operator==(const cell &) const noexcept = default;
+	};
+
+	class frame
+	{
+	private:
+		size_t rows;
+		size_t columns;
+		std::vector<cell> cells;
+
+		size_t cursor_row = 0;
+		size_t cursor_column = 0;
+
+	public:
+		frame(size_t rows, size_t columns): rows(rows), columns(columns), cells(rows * columns)
+		{}
+
+		void clear() noexcept
+		{
+			std::fill(cells.begin(), cells.end(), cell());
+		}
+
+		void clear_row(size_t row) noexcept
+		{
+			if (row < rows)
+			{
+				std::fill_n(cells.begin() + row * columns, columns, cell());
+			}
+		}
+
+		// Writes the text starting at the given position, everything outside the frame is cut off
+		size_t put(size_t row, size_t column, std::string_view text, dye::code color = dye::code::white) noexcept
+		{
+			if (row >= rows)
+			{
+				return column;
+			}
+
+			for (auto symbol : text)
+			{
+				if (column >= columns)
+				{
+					break;
+				}
+
+				cells[row * columns + column++] = { symbol, color };
+			}
+
+			return column;
+		}
+
+		void set_cursor(size_t row, size_t column) noexcept
+		{
+			cursor_row = row;
+			cursor_column = column;
+		}
+
+		[[nodiscard]] const cell &at(size_t row, size_t column) const noexcept
+		{
+			return cells[row * columns + column];
+		}
+
+		[[nodiscard]] size_t get_rows() const noexcept
+		{
+			return rows;
+		}
+
+		[[nodiscard]] size_t get_columns() const noexcept
+		{
+			return columns;
+		}
+
+		[[nodiscard]] size_t get_cursor_row() const noexcept
+		{
+			return cursor_row;
+		}
+
+		[[nodiscard]] size_t get_cursor_column() const noexcept
+		{
+			return cursor_column;
+		}
+	};
+
+	enum class cursor_mode
+	{
+		// Place the cursor at the frame position and erase the rest of the line (after user input)
+		move,
+		// Leave the cursor where it was (refresh while the user is typing)
+		keep
+	};
+
+private:
+	static const size_t short_gap = 4;
+
+	frame previous;
+	bool screen_is_clean = false;
+	std::string output;
+
+	void move_cursor(size_t row, size_t column)
+	{
+		char number[24];
+
+		output.append("\033[");
+		output.append(number, std::to_chars(number, std::end(number), row + 1).ptr);
+		output.push_back(';');
+		output.append(number, std::to_chars(number, std::end(number), column + 1).ptr);
+		output.push_back('H');
+	}
+
+public:
+	frame_renderer(size_t rows, size_t columns): previous(rows, columns)
+	{
+		output.reserve(rows * columns * 8);
+	}
+
+	// Emits only the cells that differ from the previous frame
+	void render(const frame &next, std::ostream &terminal, cursor_mode mode = cursor_mode::move)
+	{
+		output.clear();
+
+		if (mode == cursor_mode::keep)
+		{
+			output.append("\0337");
+		}
+
+		if (!screen_is_clean)
+		{
+			output.append("\033[H\033[2J");
+			previous.clear();
+			screen_is_clean = true;
+		}
+
+		auto current_color = dye::code::white;
+		auto last_row = next.get_rows();
+		auto last_column = next.get_columns();
+		output.append(dye::sequence(current_color));
+
+		for (size_t row = 0; row < next.get_rows(); ++row)
+		{
+			for (size_t column = 0; column < next.get_columns(); ++column)
+			{
+				auto &&required = next.at(row, column);
+				if (required == previous.at(row, column))
+				{
+					continue;
+				}
+
+				if (row == last_row && column > last_column && column - last_column <= short_gap)
+				{
+					// Rewriting a few unchanged cells is cheaper than an escape sequence
+					for (; last_column < column; ++last_column)
+					{
+						auto &&unchanged = next.at(row, last_column);
+						if (unchanged.color != current_color)
+						{
+							current_color = unchanged.color;
+							output.append(dye::sequence(current_color));
+						}
+
+						output.push_back(unchanged.symbol);
+					}
+				}
+				else if (row != last_row || column != last_column)
+				{
+					move_cursor(row, column);
+				}
+
+				if (required.color != current_color)
+				{
+					current_color = required.color;
+					output.append(dye::sequence(current_color));
+				}
+
+				output.push_back(required.symbol);
+				last_row = row;
+				last_column = column + 1;
+			}
+		}
+
+		if (current_color != dye::code::white)
+		{
+			output.append(dye::sequence(dye::code::white));
+		}
+
+		if (mode == cursor_mode::keep)
+		{
+			output.append("\0338");
+		}
+		else
+		{
+			move_cursor(next.get_cursor_row(), next.get_cursor_column());
+			output.append("\033[K");
+		}
+
+		previous = next;
+		terminal.write(output.data(), output.size());
+		terminal.flush();
+	}
+
+	// The next render will redraw the whole screen
+	void invalidate() noexcept
+	{
+		screen_is_clean = false;
+	}
+};
+
+#endif // !__FRAME_RENDERER_HPP__
@@ -0,0 +1,176 @@
+#ifndef __INSTRUMENTED_MUTEX_HPP__
+#define __INSTRUMENTED_MUTEX_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <coroutine>
+
+#include "async_mutex.hpp"
+
+// async_mutex that keeps track of its contention: how long the lock was waited for and held,
+// and how many coroutines were waiting for it. The counters are read while the lock is in use.
+class instrumented_mutex
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct statistics
+	{
+		uint64_t acquisitions;
+		// Acquisitions that had to wait
+		uint64_t contended;
+		std::chrono::nanoseconds wait;
+		std::chrono::nanoseconds max_wait;
+		std::chrono::nanoseconds hold;
+		std::chrono::nanoseconds max_hold;
+		uint32_t waiting;
+		uint32_t max_waiting;
+	};
+
+private:
+	async_mutex mutex;
+
+	std::atomic<uint64_t> acquisitions = 0;
+	std::atomic<uint64_t> contended = 0;
+	std::atomic<int64_t> wait_time = 0;
+	std::atomic<int64_t> max_wait_time = 0;
+	std::atomic<int64_t> hold_time = 0;
+	std::atomic<int64_t> max_hold_time = 0;
+	std::atomic<uint32_t> waiting = 0;
+	std::atomic<uint32_t> max_waiting = 0;
+
+	// Written by the holder only
+	clock::time_point acquired_at;
+
+	template <typename T>
+	static void update_max(std::atomic<T> &maximum, T value) noexcept
+	{
+		for (auto current = maximum.load(std::memory_order_relaxed); current < value
+			&& !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed); )
+		{}
+	}
+
+	void acquired(clock::duration waited) noexcept
+	{
+		acquired_at = clock::now();
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+		if (waited != clock::duration::zero())
+		{
+			auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count();
+			contended.fetch_add(1, std::memory_order_relaxed);
+			wait_time.fetch_add(nanoseconds, std::memory_order_relaxed);
+			update_max(max_wait_time, nanoseconds);
+		}
+	}
+
+public:
+	class lock_guard
+	{
+	private:
+		instrumented_mutex *owner;
+
+	public:
+		explicit lock_guard(instrumented_mutex *owner) noexcept: owner(owner)
+		{}
+
+		lock_guard(lock_guard &&other) noexcept: owner(std::exchange(other.owner, nullptr))
+		{}
+
+		lock_guard(const lock_guard &) = delete;
+		lock_guard &operator=(const lock_guard &) = delete;
+		lock_guard &operator=(lock_guard &&) = delete;
+
+		~lock_guard()
+		{
+			if (owner)
+			{
+				owner->unlock();
+			}
+		}
+	};
+
+	[[nodiscard]] bool try_lock()
+	{
+		if (!mutex.try_lock())
+		{
+			return false;
+		}
+
+		acquired(clock::duration::zero());
+		return true;
+	}
+
+	[[nodiscard]] auto lock() noexcept
+	{
+		struct lock_awaiter
+		{
+			instrumented_mutex &owner;
+			decltype(std::declval<async_mutex &>().lock()) inner;
+			clock::time_point started = {};
+
+			bool await_ready()
+			{
+				if (inner.await_ready())
+				{
+					owner.acquired(clock::duration::zero());
+					return true;
+				}
+
+				started = clock::now();
+				update_max(owner.max_waiting, owner.waiting.fetch_add(1, std::memory_order_relaxed) + 1);
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				return inner.await_suspend(handle);
+			}
+
+			void await_resume() noexcept
+			{
+				if (started != clock::time_point())
+				{
+					owner.waiting.fetch_sub(1, std::memory_order_relaxed);
+					owner.acquired(std::max<clock::duration>(clock::now() - started, clock::duration(1)));
+				}
+			}
+		};
+
+		return lock_awaiter{ *this, mutex.lock() };
+	}
+
+	// co_await mutex.scoped_lock() holds the mutex until the returned guard is destroyed
+	[[nodiscard]] task<lock_guard> scoped_lock()
+	{
+		co_await lock();
+		co_return lock_guard(this);
+	}
+
+	void unlock()
+	{
+		auto held = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - acquired_at).count();
+		hold_time.fetch_add(held, std::memory_order_relaxed);
+		update_max(max_hold_time, held);
+
+		mutex.unlock();
+	}
+
+	[[nodiscard]] statistics get_statistics() const noexcept
+	{
+		return {
+			acquisitions.load(std::memory_order_relaxed),
+			contended.load(std::memory_order_relaxed),
+			std::chrono::nanoseconds(wait_time.load(std::memory_order_relaxed)),
+			std::chrono::nanoseconds(max_wait_time.load(std::memory_order_relaxed)),
+			std::chrono::nanoseconds(hold_time.load(std::memory_order_relaxed)),
+			std::chrono::nanoseconds(max_hold_time.load(std::memory_order_relaxed)),
+			waiting.load(std::memory_order_relaxed),
+			max_waiting.load(std::memory_order_relaxed)
+		};
+	}
+};
+
+#endif // !__INSTRUMENTED_MUTEX_HPP__
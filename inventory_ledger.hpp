@@ -0,0 +1,127 @@
+#ifndef __INVENTORY_LEDGER_HPP__
+#define __INVENTORY_LEDGER_HPP__
+
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include "storage_tank.hpp"
+
+// Stock of every product grade over the fleet, kept up to date on every tank state change: a change
+// takes the tank's last accounted state out of the accounts of its grade and puts the new one in,
+// so terminal-wide totals are read without visiting the tanks. Sharded by id like the fleet index.
+class inventory_ledger : public tank_observer_if
+{
+public:
+	struct totals
+	{
+		uint64_t tanks = 0;
+		uint64_t volume = 0;
+		// Above the lower permissible levels, what can be downloaded
+		uint64_t available = 0;
+		// Below the upper acceptable levels, what can be unloaded
+		uint64_t free = 0;
+		uint64_t capacity = 0;
+	};
+
+private:
+	static const size_t shards_count = 16;
+
+	struct entry
+	{
+		product_grade grade;
+		uint64_t level;
+		uint64_t available;
+		uint64_t free;
+		uint64_t capacity;
+	};
+
+	struct shard
+	{
+		mutable std::mutex mutex;
+		std::array<totals, product_grades_count> accounts;
+	};
+
+	std::array<shard, shards_count> shards;
+	std::vector<entry> entries;
+
+	[[nodiscard]] static entry make_entry(const storage_tank &tank)
+	{
+		auto state = tank.snapshot();
+		auto level = state.level_of_oil_products;
+
+		return {
+			state.grade,
+			level,
+			level > state.lower_permissible_level ? level - state.lower_permissible_level : 0,
+			state.upper_acceptable_level > level ? state.upper_acceptable_level - level : 0,
+			state.upper_acceptable_level
+		};
+	}
+
+	static void post(totals &account, const entry &tank) noexcept
+	{
+		++account.tanks;
+		account.volume += tank.level;
+		account.available += tank.available;
+		account.free += tank.free;
+		account.capacity += tank.capacity;
+	}
+
+	static void reverse(totals &account, const entry &tank) noexcept
+	{
+		--account.tanks;
+		account.volume -= tank.level;
+		account.available -= tank.available;
+		account.free -= tank.free;
+		account.capacity -= tank.capacity;
+	}
+
+public:
+	void build(const tank_vector &tanks)
+	{
+		entries.resize(tanks.size());
+
+		for (auto &&tank : tanks)
+		{
+			auto &&current = entries[tank.get_id()] = make_entry(tank);
+			post(shards[tank.get_id() % shards_count].accounts[size_t(current.grade)], current);
+		}
+	}
+
+	void state_changed(const storage_tank &tank) override
+	{
+		auto &&current_shard = shards[tank.get_id() % shards_count];
+		auto guard = std::lock_guard(current_shard.mutex);
+
+		// The state is re-read under the shard lock, so the last notification always wins
+		auto &&current = entries[tank.get_id()];
+		auto updated = make_entry(tank);
+
+		reverse(current_shard.accounts[size_t(current.grade)], current);
+		post(current_shard.accounts[size_t(updated.grade)], updated);
+		current = updated;
+	}
+
+	// Constant time in the number of tanks; changes landing while the shards are summed may be counted or not
+	[[nodiscard]] totals get_totals(product_grade grade) const
+	{
+		auto result = totals();
+
+		for (auto &&current_shard : shards)
+		{
+			auto guard = std::lock_guard(current_shard.mutex);
+			auto &&account = current_shard.accounts[size_t(grade)];
+
+			result.tanks += account.tanks;
+			result.volume += account.volume;
+			result.available += account.available;
+			result.free += account.free;
+			result.capacity += account.capacity;
+		}
+
+		return result;
+	}
+};
+
+#endif // !__INVENTORY_LEDGER_HPP__
@@ -0,0 +1,229 @@
+#ifndef __LOG_FORMAT_HPP__
+#define __LOG_FORMAT_HPP__
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+
+enum class log_level : uint8_t
+{
+	info,
+	warn,
+	error
+};
+
+// Marks the tank a message is about, the messages of one tank can then be picked out of the log
+struct log_tank
+{
+	uint64_t id;
+};
+
+// Format of a log call site given as a template argument, "{}" stands for the next argument
+template <size_t N>
+struct log_format_string
+{
+	char text[N];
+
+	constexpr log_format_string(const char (&literal)[N]) noexcept
+	{
+		std::copy_n(literal, N, text);
+	}
+
+	[[nodiscard]] constexpr std::string_view view() const noexcept
+	{
+		return { text, N - 1 };
+	}
+
+	[[nodiscard]] constexpr size_t placeholders() const noexcept
+	{
+		auto count = size_t(0);
+		for (auto position = view().find("{}"); position != std::string_view::npos; position = view().find("{}", position + 2))
+		{
+			++count;
+		}
+		return count;
+	}
+};
+
+// Encoding of the binary log shared by the server and logdecode. The file is a magic followed by chunks,
+// each the flushed buffer of one thread: the timestamp of its first record in nanoseconds since the epoch,
+// the size of its records and the records. A record starts with a varint: 0 for the definition of a format,
+// otherwise the id of the format of an event. A definition holds the id, the level, the argument types and
+// the format; an event holds the nanoseconds since the previous record of its chunk and the arguments.
+class log_format
+{
+public:
+	enum class argument : uint8_t
+	{
+		signed_integer,
+		unsigned_integer,
+		floating,
+		text,
+		tank
+	};
+
+	static constexpr std::string_view magic = "OILBLOG1";
+	static const size_t chunk_header_size = sizeof(int64_t) + sizeof(uint32_t);
+	static const uint64_t definition = 0;
+
+	template <typename T>
+	[[nodiscard]] static constexpr argument argument_of() noexcept
+	{
+		using type = std::decay_t<T>;
+
+		if constexpr (std::is_same_v<type, log_tank>)
+		{
+			return argument::tank;
+		}
+		else if constexpr (std::is_same_v<type, bool> || (std::is_integral_v<type> && std::is_unsigned_v<type>))
+		{
+			return argument::unsigned_integer;
+		}
+		else if constexpr (std::is_integral_v<type> || std::is_enum_v<type>)
+		{
+			return argument::signed_integer;
+		}
+		else if constexpr (std::is_floating_point_v<type>)
+		{
+			return argument::floating;
+		}
+		else
+		{
+			static_assert(std::is_convertible_v<const T &, std::string_view>, "a log argument is a number, a string or a log_tank");
+			return argument::text;
+		}
+	}
+
+	static void put_varint(std::string &out, uint64_t value)
+	{
+		char bytes[10];
+		auto size = size_t(0);
+
+		for (; value >= 0x80; value >>= 7)
+		{
+			bytes[size++] = char(value | 0x80);
+		}
+		bytes[size++] = char(value);
+
+		out.append(bytes, size);
+	}
+
+	[[nodiscard]] static bool get_varint(std::string_view &in, uint64_t &value) noexcept
+	{
+		value = 0;
+		for (size_t shift = 0; !in.empty() && shift < 64; shift += 7)
+		{
+			auto byte = uint8_t(in.front());
+			in.remove_prefix(1);
+			value |= uint64_t(byte & 0x7f) << shift;
+
+			if (!(byte & 0x80))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Small negative numbers stay short
+	[[nodiscard]] static uint64_t zigzag(int64_t value) noexcept
+	{
+		return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+	}
+
+	[[nodiscard]] static int64_t unzigzag(uint64_t value) noexcept
+	{
+		return int64_t(value >> 1) ^ -int64_t(value & 1);
+	}
+
+	template <typename T>
+	static void put_argument(std::string &out, const T &value)
+	{
+		if constexpr (constexpr auto kind = argument_of<T>(); kind == argument::tank)
+		{
+			put_varint(out, value.id);
+		}
+		else if constexpr (kind == argument::unsigned_integer)
+		{
+			put_varint(out, uint64_t(value));
+		}
+		else if constexpr (kind == argument::signed_integer)
+		{
+			put_varint(out, zigzag(int64_t(value)));
+		}
+		else if constexpr (kind == argument::floating)
+		{
+			auto number = double(value);
+			out.append(reinterpret_cast<const char *>(&number), sizeof(number));
+		}
+		else
+		{
+			auto text = std::string_view(value);
+			put_varint(out, text.size());
+			out.append(text);
+		}
+	}
+
+	// Text of an argument as it appears in a rendered message
+	template <typename T>
+	[[nodiscard]] static std::string to_text(const T &value)
+	{
+		char number[32];
+
+		if constexpr (constexpr auto kind = argument_of<T>(); kind == argument::tank)
+		{
+			return std::string(number, std::to_chars(number, std::end(number), value.id).ptr);
+		}
+		else if constexpr (kind == argument::unsigned_integer)
+		{
+			return std::string(number, std::to_chars(number, std::end(number), uint64_t(value)).ptr);
+		}
+		else if constexpr (kind == argument::signed_integer)
+		{
+			return std::string(number, std::to_chars(number, std::end(number), int64_t(value)).ptr);
+		}
+		else if constexpr (kind == argument::floating)
+		{
+			return std::string(number, std::to_chars(number, std::end(number), double(value)).ptr);
+		}
+		else
+		{
+			return std::string(std::string_view(value));
+		}
+	}
+
+	// Replaces the placeholders in turn, extra placeholders are left as they are
+	[[nodiscard]] static std::string render(std::string_view format, const std::string *arguments, size_t count)
+	{
+		auto message = std::string();
+		for (size_t next = 0; !format.empty(); )
+		{
+			auto placeholder = format.find("{}");
+			if (placeholder == std::string_view::npos || next == count)
+			{
+				message.append(format);
+				break;
+			}
+
+			message.append(format.substr(0, placeholder)).append(arguments[next++]);
+			format.remove_prefix(placeholder + 2);
+		}
+		return message;
+	}
+
+	[[nodiscard]] static std::string_view level_name(log_level level) noexcept
+	{
+		switch (level)
+		{
+			case log_level::info: return "INFO";
+			case log_level::warn: return "WARN";
+			default: return "ERROR";
+		}
+	}
+};
+
+#endif // !__LOG_FORMAT_HPP__
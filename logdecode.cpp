@@ -0,0 +1,53 @@
+#include "logdecode.hpp"
+#include "logging.hpp"
+
+int main(int argc, char **argv)
+{
+	static const std::string_view usage = "you must specify the binary log to decode, optionally followed by filters: "
+		"`<log> [--level info|warn|error] [--tank <id>]`";
+
+	if (argc < 2 || argc % 2 != 0)
+	{
+		logging::errlog(usage);
+		return -1;
+	}
+
+	try
+	{
+		auto selected = logdecode::filter();
+		for (int i = 2; i < argc; i += 2)
+		{
+			auto option = std::string_view(argv[i]);
+			auto value = std::string_view(argv[i + 1]);
+
+			if (option == "--tank")
+			{
+				selected.tank = std::stoull(argv[i + 1]);
+			}
+			else if (option == "--level" && (value == "info" || value == "warn" || value == "error"))
+			{
+				// The level and everything more severe
+				selected.level = value == "info" ? log_level::info : value == "warn" ? log_level::warn : log_level::error;
+			}
+			else
+			{
+				logging::errlog(usage);
+				return -1;
+			}
+		}
+
+		auto &&[decoded, result] = logdecode::load(argv[1], selected);
+		if (st::is_not_success(result))
+		{
+			return -1;
+		}
+
+		decoded.print(std::cout);
+		return 0;
+	}
+	catch (...)
+	{
+		logging::errlog("incorrect tank id");
+		return -1;
+	}
+}
@@ -0,0 +1,302 @@
+#ifndef __LOGDECODE_HPP__
+#define __LOGDECODE_HPP__
+
+#include <map>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <iostream>
+#include <algorithm>
+
+#include "status.hpp"
+#include "logging.hpp"
+#include "log_format.hpp"
+
+// Renders a binary log written by the server back into the text it would have logged, in time order.
+// The first event of a format carries its definition, but the chunk holding it may be written after
+// the chunk of another thread using the same format, so chunks are decoded in passes until all are known.
+class logdecode
+{
+public:
+	struct filter
+	{
+		log_level level = log_level::info;
+		std::optional<uint64_t> tank;
+	};
+
+private:
+	struct definition
+	{
+		log_level level;
+		std::vector<log_format::argument> arguments;
+		std::string format;
+	};
+
+	struct event
+	{
+		int64_t timestamp;
+		log_level level;
+		std::string message;
+	};
+
+	struct chunk
+	{
+		int64_t first;
+		std::string_view records;
+	};
+
+	std::map<uint64_t, definition> definitions;
+	std::vector<event> events;
+	size_t undecoded_chunks = 0;
+
+	[[nodiscard]] static bool get_bytes(std::string_view &in, size_t size, std::string_view &bytes) noexcept
+	{
+		if (in.size() < size)
+		{
+			return false;
+		}
+
+		bytes = in.substr(0, size);
+		in.remove_prefix(size);
+		return true;
+	}
+
+	[[nodiscard]] static bool get_definition(std::string_view &in, uint64_t &id, definition &result)
+	{
+		auto level = std::string_view();
+		auto types = std::string_view();
+		auto format = std::string_view();
+		auto count = uint64_t(0);
+		auto format_size = uint64_t(0);
+
+		if (!log_format::get_varint(in, id) || !get_bytes(in, 1, level) || !log_format::get_varint(in, count)
+			|| !get_bytes(in, count, types) || !log_format::get_varint(in, format_size) || !get_bytes(in, format_size, format))
+		{
+			return false;
+		}
+
+		result.level = log_level(level.front());
+		result.format = format;
+		for (auto type : types)
+		{
+			result.arguments.push_back(log_format::argument(type));
+		}
+		return true;
+	}
+
+	// The argument as text, and whether it names the tank the filter looks for
+	[[nodiscard]] static bool get_argument(std::string_view &in, log_format::argument type, const filter &selected,
+		std::string &text, bool &about_tank)
+	{
+		auto value = uint64_t(0);
+		auto bytes = std::string_view();
+
+		switch (type)
+		{
+			case log_format::argument::tank:
+			{
+				if (!log_format::get_varint(in, value))
+				{
+					return false;
+				}
+
+				about_tank = about_tank || (selected.tank && *selected.tank == value);
+				text = log_format::to_text(value);
+				return true;
+			}
+
+			case log_format::argument::unsigned_integer:
+			{
+				if (!log_format::get_varint(in, value))
+				{
+					return false;
+				}
+
+				text = log_format::to_text(value);
+				return true;
+			}
+
+			case log_format::argument::signed_integer:
+			{
+				if (!log_format::get_varint(in, value))
+				{
+					return false;
+				}
+
+				text = log_format::to_text(log_format::unzigzag(value));
+				return true;
+			}
+
+			case log_format::argument::floating:
+			{
+				auto number = 0.0;
+				if (!get_bytes(in, sizeof(number), bytes))
+				{
+					return false;
+				}
+
+				std::memcpy(&number, bytes.data(), sizeof(number));
+				text = log_format::to_text(number);
+				return true;
+			}
+
+			default:
+			{
+				if (!log_format::get_varint(in, value) || !get_bytes(in, value, bytes))
+				{
+					return false;
+				}
+
+				text = bytes;
+				return true;
+			}
+		}
+	}
+
+	// False while an event of the chunk uses a format not defined yet, the chunk is then tried again
+	[[nodiscard]] bool decode_chunk(const chunk &current, const filter &selected)
+	{
+		auto in = current.records;
+		auto timestamp = current.first;
+		auto decoded = std::vector<event>();
+
+		for (auto id = uint64_t(0); !in.empty(); )
+		{
+			if (!log_format::get_varint(in, id))
+			{
+				break;
+			}
+
+			if (id == log_format::definition)
+			{
+				auto result = definition();
+				if (!get_definition(in, id, result))
+				{
+					break;
+				}
+
+				definitions.emplace(id, std::move(result));
+				continue;
+			}
+
+			auto found = definitions.find(id);
+			if (found == definitions.end())
+			{
+				return false;
+			}
+
+			auto &&format = found->second;
+			auto delta = uint64_t(0);
+			auto arguments = std::vector<std::string>(format.arguments.size());
+			auto about_tank = !selected.tank;
+			auto complete = log_format::get_varint(in, delta);
+
+			for (size_t i = 0; complete && i < arguments.size(); ++i)
+			{
+				complete = get_argument(in, format.arguments[i], selected, arguments[i], about_tank);
+			}
+
+			if (!complete)
+			{
+				break;
+			}
+
+			timestamp += int64_t(delta);
+			if (format.level >= selected.level && about_tank)
+			{
+				decoded.push_back({ timestamp, format.level, log_format::render(format.format, arguments.data(), arguments.size()) });
+			}
+		}
+
+		events.insert(events.end(), std::make_move_iterator(decoded.begin()), std::make_move_iterator(decoded.end()));
+		return true;
+	}
+
+	static void print_time(std::ostream &out, int64_t timestamp)
+	{
+		char time[16];
+		auto seconds = std::time_t(timestamp / 1'000'000'000);
+		auto local = tm();
+		auto fraction = std::to_string(timestamp % 1'000'000'000);
+
+		out.write(time, std::strftime(time, sizeof(time), "%T", localtime_r(&seconds, &local)));
+		out << '.' << std::string(9 - fraction.size(), '0') << fraction;
+	}
+
+public:
+	// A log cut short by a killed server ends with a partial chunk, which is dropped
+	[[nodiscard]] static std::pair<logdecode, status> load(const std::string &path, const filter &selected)
+	{
+		auto file = std::ifstream(path, std::ios::binary);
+		if (!file)
+		{
+			logging::errlog("unable to open the binary log: " + path);
+			return { logdecode(), status::read_error };
+		}
+
+		auto content = std::string(size_t(file.seekg(0, std::ios::end).tellg()), '\0');
+		file.seekg(0).read(content.data(), content.size());
+
+		auto data = std::string_view(content);
+		if (!data.starts_with(log_format::magic))
+		{
+			logging::errlog("not a binary log: " + path);
+			return { logdecode(), status::read_error };
+		}
+		data.remove_prefix(log_format::magic.size());
+
+		auto pending = std::vector<chunk>();
+		while (data.size() >= log_format::chunk_header_size)
+		{
+			auto current = chunk();
+			auto size = uint32_t(0);
+
+			std::memcpy(&current.first, data.data(), sizeof(current.first));
+			std::memcpy(&size, data.data() + sizeof(current.first), sizeof(size));
+
+			if (data.size() - log_format::chunk_header_size < size)
+			{
+				break;
+			}
+
+			current.records = data.substr(log_format::chunk_header_size, size);
+			data.remove_prefix(log_format::chunk_header_size + size);
+			pending.push_back(current);
+		}
+
+		auto decoded = logdecode();
+		for (auto progress = true; progress && !pending.empty(); )
+		{
+			auto before = pending.size();
+			std::erase_if(pending, [&](const chunk &current) { return decoded.decode_chunk(current, selected); });
+			progress = pending.size() != before;
+		}
+
+		decoded.undecoded_chunks = pending.size();
+		std::stable_sort(decoded.events.begin(), decoded.events.end(), [](auto &&lhs, auto &&rhs) { return lhs.timestamp < rhs.timestamp; });
+
+		return { std::move(decoded), status::success };
+	}
+
+	void print(std::ostream &out) const
+	{
+		for (auto &&current : events)
+		{
+			out << '[' << log_format::level_name(current.level) << "] [";
+			print_time(out, current.timestamp);
+			out << "] " << current.message << '\n';
+		}
+		out.flush();
+
+		// Their formats were in chunks that never reached the file
+		if (undecoded_chunks != 0)
+		{
+			logging::warnlog(std::to_string(undecoded_chunks) + " chunks with unknown formats were skipped");
+		}
+	}
+};
+
+#endif // !__LOGDECODE_HPP__
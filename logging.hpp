@@ -2,51 +2,258 @@
 #define __LOGGING_HPP__
 
 #include <mutex>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
 #include <iostream>
+#include <type_traits>
+#include <condition_variable>
 #include <experimental/source_location>
 
 #include "dye.hpp"
+#include "status.hpp"
+#include "log_format.hpp"
 
 static std::mutex logging_mutex;
 
+// Messages are written to std::clog as text, or in binary mode to a file rendered later by logdecode.
+// A call site that gives its format as a template argument, inflog<"level {}">(level), then writes only
+// the id of the format, a timestamp and the raw arguments into a buffer of its thread.
 class logging
 {
-	[[nodiscard]] static std::string get_current_time()
+	struct binary_buffer
 	{
+		std::mutex mutex;
+		std::string records;
+		int64_t first = 0;
+		int64_t last = 0;
+	};
+
+	static const size_t flush_threshold = 1 << 16;
+	static constexpr auto flush_interval = std::chrono::seconds(1);
+
+	static inline std::atomic<bool> binary = false;
+	static inline std::atomic<uint64_t> formats_count = 0;
+
+	static inline std::mutex file_mutex;
+	static inline std::ofstream binary_file;
+
+	static inline std::mutex registry_mutex;
+	static inline std::vector<std::shared_ptr<binary_buffer>> buffers;
+	static inline thread_local std::shared_ptr<binary_buffer> local_buffer;
+
+	// Writes the buffers out regularly and once more when the program ends
+	static inline std::jthread flusher;
+
+	// Called under the logging mutex, so the buffer can be shared
+	[[nodiscard]] static std::string_view get_current_time()
+	{
+		static char time[16];
 		auto now = std::time(nullptr);
-		auto time = std::stringstream();
-		time << std::put_time(localtime(&now), "%T");
-		return time.str();
+		auto local = tm();
+		return { time, std::strftime(time, sizeof(time), "%T", localtime_r(&now, &local)) };
+	}
+
+	[[nodiscard]] static binary_buffer &thread_buffer()
+	{
+		if (!local_buffer)
+		{
+			auto guard = std::lock_guard(registry_mutex);
+			local_buffer = buffers.emplace_back(std::make_shared<binary_buffer>());
+		}
+		return *local_buffer;
+	}
+
+	// Called with the buffer locked
+	static void write_chunk(binary_buffer &buffer)
+	{
+		if (buffer.records.empty())
+		{
+			return;
+		}
+
+		auto size = uint32_t(buffer.records.size());
+		{
+			auto guard = std::lock_guard(file_mutex);
+			binary_file.write(reinterpret_cast<const char *>(&buffer.first), sizeof(buffer.first));
+			binary_file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+			binary_file.write(buffer.records.data(), size).flush();
+		}
+		buffer.records.clear();
+	}
+
+	static void flush()
+	{
+		auto all = std::vector<std::shared_ptr<binary_buffer>>();
+		{
+			auto guard = std::lock_guard(registry_mutex);
+			all = buffers;
+		}
+
+		for (auto &&buffer : all)
+		{
+			auto guard = std::lock_guard(buffer->mutex);
+			write_chunk(*buffer);
+		}
+	}
+
+	template <log_level level, log_format_string format, typename... Args>
+	static void write(const Args &... args)
+	{
+		static_assert(format.placeholders() == sizeof...(Args), "the number of arguments does not match the format");
+
+		if (!binary.load(std::memory_order_relaxed))
+		{
+			std::string arguments[] = { log_format::to_text(args)..., std::string() };
+			auto message = log_format::render(format.view(), arguments, sizeof...(Args));
+
+			switch (level)
+			{
+				case log_level::info: log("INFO", message); break;
+				case log_level::warn: log(dye().colorant("WARN", dye::code::yellow), message); break;
+				default: log(dye().colorant("ERROR", dye::code::red), message); break;
+			}
+			return;
+		}
+
+		// A call site gets its id the first time it logs, and its definition goes out with that first event
+		static const auto id = formats_count.fetch_add(1) + 1;
+		static auto defined = std::atomic<bool>(false);
+
+		auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		auto &&buffer = thread_buffer();
+		auto guard = std::lock_guard(buffer.mutex);
+
+		if (buffer.records.empty())
+		{
+			buffer.first = buffer.last = timestamp;
+		}
+
+		if (!defined.exchange(true, std::memory_order_relaxed))
+		{
+			log_format::put_varint(buffer.records, log_format::definition);
+			log_format::put_varint(buffer.records, id);
+			buffer.records.push_back(char(level));
+			log_format::put_varint(buffer.records, sizeof...(Args));
+			(buffer.records.push_back(char(log_format::argument_of<Args>())), ...);
+			log_format::put_varint(buffer.records, format.view().size());
+			buffer.records.append(format.view());
+		}
+
+		log_format::put_varint(buffer.records, id);
+		log_format::put_varint(buffer.records, uint64_t(std::max<int64_t>(timestamp - buffer.last, 0)));
+		buffer.last = std::max(buffer.last, timestamp);
+		(log_format::put_argument(buffer.records, args), ...);
+
+		if (buffer.records.size() >= flush_threshold)
+		{
+			write_chunk(buffer);
+		}
 	}
 
 public:
+	// From now on messages go to the file, the ones written as text before stay on std::clog
+	[[nodiscard]] static status start_binary_log(const std::string &path)
+	{
+		{
+			auto guard = std::lock_guard(file_mutex);
+			if (binary_file.open(path, std::ios::binary | std::ios::trunc); !binary_file.write(log_format::magic.data(), log_format::magic.size()))
+			{
+				return status::write_error;
+			}
+		}
+
+		flusher = std::jthread([](std::stop_token stop)
+		{
+			auto mutex = std::mutex();
+			auto condition = std::condition_variable_any();
+			auto lock = std::unique_lock(mutex);
+
+			while (!stop.stop_requested())
+			{
+				condition.wait_for(lock, stop, flush_interval, [] { return false; });
+				flush();
+			}
+		});
+
+		binary = true;
+		return status::success;
+	}
+
+	template <log_format_string format, typename... Args>
+	static void errlog(const Args &... args)
+	{
+		write<log_level::error, format>(args...);
+	}
+
+	template <log_format_string format, typename... Args>
+	static void warnlog(const Args &... args)
+	{
+		write<log_level::warn, format>(args...);
+	}
+
+	template <log_format_string format, typename... Args>
+	static void inflog(const Args &... args)
+	{
+		write<log_level::info, format>(args...);
+	}
+
 	template <typename T>
 	static void errlog(
 		T &&message,
 		std::experimental::source_location location = std::experimental::source_location::current())
 	{
+		if constexpr (std::is_convertible_v<T, std::string_view>)
+		{
+			if (binary.load(std::memory_order_relaxed))
+			{
+				write<log_level::error, "file: {}({}:{}) `{}` {}">(location.file_name(), location.line(),
+					location.column(), location.function_name(), std::string_view(message));
+				return;
+			}
+		}
+
 		auto terminal_dye = dye();
 		auto errinfo = std::stringstream();
-		
+
 		errinfo << "file: " <<
 			location.file_name() << '(' <<
 			location.line() << ':' <<
 			location.column() << ") `" <<
 			location.function_name() << "` " <<
 			std::forward<T>(message);
-		
+
 		log(terminal_dye.colorant("ERROR", dye::code::red), errinfo.str());
 	}
 
+	// Free-form messages are logged in binary mode as well, as the text of a single argument
 	template <typename T>
 	static void warnlog(T &&message)
 	{
+		if (binary.load(std::memory_order_relaxed))
+		{
+			write<log_level::warn, "{}">(std::string_view(message));
+			return;
+		}
+
 		log(dye().colorant("WARN", dye::code::yellow), std::forward<T>(message));
 	}
-	
+
 	template <typename T>
 	static void inflog(T &&message)
 	{
+		if (binary.load(std::memory_order_relaxed))
+		{
+			write<log_level::info, "{}">(std::string_view(message));
+			return;
+		}
+
 		log("INFO", std::forward<T>(message));
 	}
 
@@ -4,11 +4,23 @@
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <thread>
 #include <cstring>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <optional>
 
+#include "tracing.hpp"
+#include "executor.hpp"
 #include "connection_if.hpp"
+#include "async_connection_if.hpp"
 
-class message_connection : public connection_if
+class message_connection : public connection_if, public async_connection_if
 {
 private:
 	struct message_buffer
@@ -24,35 +36,131 @@ private:
 	};
 	
 	message_handle msg_handle { -1 };
+	int key;
+
+	// A connection serves one request at a time, so the staging buffers are kept instead of allocated per message
+	std::vector<char> receive_buffer;
+	std::vector<char> send_buffer;
+
+	static const size_t max_message_size = 65536;
 	
-	bool message_read(char *buffer, size_t size) noexcept
+	enum class io_result
 	{
-		auto smart_buffer = std::vector<char>(sizeof(message_buffer) + size);
-		auto msg_buffer = reinterpret_cast<message_buffer *>(smart_buffer.data());
+		done,
+		pending,
+		failed
+	};
+
+	// With IPC_NOWAIT an empty (or full) queue is reported as pending instead of blocking
+	io_result message_receive(char *buffer, size_t size, int flags) noexcept
+	{
+		receive_buffer.resize(std::max(receive_buffer.size(), sizeof(message_buffer) + size));
+		auto msg_buffer = reinterpret_cast<message_buffer *>(receive_buffer.data());
 
 		msg_buffer->type = 1;
-		if (msgrcv(msg_handle.client_message_handle, msg_buffer, size, 1, 0) == -1)
+		if (msgrcv(msg_handle.client_message_handle, msg_buffer, size, 1, flags) == -1)
 		{
-			return true;
+			return (flags & IPC_NOWAIT) && errno == ENOMSG ? io_result::pending : io_result::failed;
 		}
 
 		std::memcpy(buffer, msg_buffer->buffer, size);
-		return false;
+		return io_result::done;
 	}
 
-	bool message_write(const char *buffer, size_t size) noexcept
+	io_result message_send(const char *buffer, size_t size, int flags) noexcept
 	{
-		auto smart_buffer = std::vector<char>(sizeof(message_buffer) + size);
-		auto msg_buffer = reinterpret_cast<message_buffer *>(smart_buffer.data());
+		send_buffer.resize(std::max(send_buffer.size(), sizeof(message_buffer) + size));
+		auto msg_buffer = reinterpret_cast<message_buffer *>(send_buffer.data());
 
 		msg_buffer->type = 1;
 		std::memcpy(msg_buffer->buffer, buffer, size);
 
-		return msgsnd(msg_handle.server_message_handle, msg_buffer, size, 0) == -1;
+		if (msgsnd(msg_handle.server_message_handle, msg_buffer, size, flags) == -1)
+		{
+			return (flags & IPC_NOWAIT) && errno == EAGAIN ? io_result::pending : io_result::failed;
+		}
+
+		return io_result::done;
 	}
 
+	bool message_read(char *buffer, size_t size) noexcept
+	{
+		return message_receive(buffer, size, 0) != io_result::done;
+	}
+
+	bool message_write(const char *buffer, size_t size) noexcept
+	{
+		return message_send(buffer, size, 0) != io_result::done;
+	}
+
+	// One message of the queue as an awaitable, retried by the executor reactor while the queue is not ready
+	struct message_operation : executor::pending_io
+	{
+		message_connection &connection;
+		char *read_buffer;
+		const char *write_buffer;
+		size_t size;
+		io_result result = io_result::pending;
+		std::optional<executor::clock::time_point> deadline;
+
+		message_operation(message_connection &connection, char *buffer, size_t size) noexcept:
+			connection(connection), read_buffer(buffer), write_buffer(nullptr), size(size)
+		{}
+
+		message_operation(message_connection &connection, const char *buffer, size_t size) noexcept:
+			connection(connection), read_buffer(nullptr), write_buffer(buffer), size(size)
+		{}
+
+		io_result perform(int flags) noexcept
+		{
+			return read_buffer ?
+				connection.message_receive(read_buffer, size, flags) :
+				connection.message_send(write_buffer, size, flags);
+		}
+
+		bool attempt() noexcept override
+		{
+			result = perform(IPC_NOWAIT);
+			return result != io_result::pending || (deadline && executor::clock::now() >= *deadline);
+		}
+
+		bool await_ready() noexcept
+		{
+			if (attempt())
+			{
+				return true;
+			}
+
+			// Outside of an executor the operation simply blocks
+			if (!executor::current())
+			{
+				result = perform(0);
+				return true;
+			}
+
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> awaiting)
+		{
+			handle = awaiting;
+			executor::current()->wait_io(this);
+		}
+
+		io_result await_resume() const noexcept
+		{
+			return result;
+		}
+	};
+
 public:
-	message_connection(status &init_status, int session_id = std::numeric_limits<int>::max()) noexcept
+	// An unknown process counts as alive
+	[[nodiscard]] static bool process_alive(pid_t pid) noexcept
+	{
+		return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+	}
+
+	message_connection(status &init_status, int session_id = std::numeric_limits<int>::max()) noexcept: key(session_id)
 	{
 	#ifdef _IS_SERVER_
 		static const auto server_message_key = 1;
@@ -106,6 +214,43 @@ public:
 		return status::success;
 	}
 
+	// For threads outside of an executor: status::read_timeout when no message has started within the timeout.
+	// There is no blocking receive with a deadline, so the queue is polled, a little less often the longer it stays empty
+	status read(std::string &message, std::chrono::milliseconds timeout)
+	{
+		static constexpr auto max_poll_interval = std::chrono::microseconds(1000);
+
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		auto poll_interval = std::chrono::microseconds(50);
+		size_t message_length;
+
+		// Only the start of a message may time out, a started message is always read to the end
+		auto result = io_result::pending;
+		while ((result = message_receive(reinterpret_cast<char *>(&message_length), sizeof(message_length), IPC_NOWAIT)) == io_result::pending)
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				return status::read_timeout;
+			}
+
+			std::this_thread::sleep_for(poll_interval);
+			poll_interval = std::min(poll_interval * 2, max_poll_interval);
+		}
+
+		if (result != io_result::done)
+		{
+			return status::read_error;
+		}
+
+		message.resize(message_length);
+		if (message_read(message.data(), message_length))
+		{
+			return status::read_error;
+		}
+
+		return status::success;
+	}
+
 	status write(std::string_view message) override
 	{
 		size_t message_length = message.length();
@@ -122,6 +267,171 @@ public:
 		return status::success;
 	}
 
+	task<status> async_read(std::string &message) override
+	{
+		auto span = tracing::span("queue read", trace_group::sessions, session_key());
+		size_t message_length;
+		if (co_await message_operation(*this, reinterpret_cast<char *>(&message_length), sizeof(message_length)) != io_result::done)
+		{
+			co_return status::read_error;
+		}
+
+		message.resize(message_length);
+		if (co_await message_operation(*this, message.data(), message_length) != io_result::done)
+		{
+			co_return status::read_error;
+		}
+
+		co_return status::success;
+	}
+
+	task<status> async_write(std::string_view message) override
+	{
+		auto span = tracing::span("queue write", trace_group::sessions, session_key());
+		size_t message_length = message.length();
+		if (co_await message_operation(*this, reinterpret_cast<const char *>(&message_length), sizeof(message_length)) != io_result::done)
+		{
+			co_return status::write_error;
+		}
+
+		if (co_await message_operation(*this, message.data(), message_length) != io_result::done)
+		{
+			co_return status::write_error;
+		}
+
+		co_return status::success;
+	}
+
+	task<status> async_read(std::string &message, std::chrono::milliseconds timeout) override
+	{
+		auto span = tracing::span("queue read", trace_group::sessions, session_key());
+		size_t message_length;
+		auto length_operation = message_operation(*this, reinterpret_cast<char *>(&message_length), sizeof(message_length));
+		length_operation.deadline = executor::clock::now() + timeout;
+
+		// Only the start of a message may time out, a started message is always read to the end
+		switch (co_await length_operation)
+		{
+			case io_result::done: break;
+			case io_result::pending: co_return status::read_timeout;
+			default: co_return status::read_error;
+		}
+
+		message.resize(message_length);
+		if (co_await message_operation(*this, message.data(), message_length) != io_result::done)
+		{
+			co_return status::read_error;
+		}
+
+		co_return status::success;
+	}
+
+	// The peer is the last process that wrote to us, or else the last one that read from us
+	bool peer_alive() override
+	{
+		auto incoming = msqid_ds();
+		if (msgctl(msg_handle.client_message_handle, IPC_STAT, &incoming) == -1)
+		{
+			return false;
+		}
+
+		if (incoming.msg_lspid != 0 && incoming.msg_lspid != getpid())
+		{
+			return process_alive(incoming.msg_lspid);
+		}
+
+		auto outgoing = msqid_ds();
+		if (msgctl(msg_handle.server_message_handle, IPC_STAT, &outgoing) == -1)
+		{
+			return false;
+		}
+
+		return outgoing.msg_lrpid == getpid() || process_alive(outgoing.msg_lrpid);
+	}
+
+	uint64_t session_key() const override
+	{
+		return uint64_t(key);
+	}
+
+	uint64_t peer_process() override
+	{
+		auto incoming = msqid_ds();
+		if (msgctl(msg_handle.client_message_handle, IPC_STAT, &incoming) == -1 || incoming.msg_lspid == getpid())
+		{
+			return 0;
+		}
+
+		return uint64_t(incoming.msg_lspid);
+	}
+
+	uint64_t reader_process() override
+	{
+		auto outgoing = msqid_ds();
+		if (msgctl(msg_handle.server_message_handle, IPC_STAT, &outgoing) == -1 || outgoing.msg_lrpid == getpid())
+		{
+			return 0;
+		}
+
+		return uint64_t(outgoing.msg_lrpid);
+	}
+
+	// Removes the messages that arrived but were never read, so a client taking over a session gets
+	// the responses its predecessor missed; a body whose length was already read by it is dropped
+	std::vector<std::string> take_unread()
+	{
+		auto raw_messages = std::vector<std::string>();
+		auto smart_buffer = std::vector<char>(sizeof(message_buffer) + max_message_size);
+		auto msg_buffer = reinterpret_cast<message_buffer *>(smart_buffer.data());
+
+		while (true)
+		{
+			auto received = msgrcv(msg_handle.client_message_handle, msg_buffer, max_message_size, 1, IPC_NOWAIT | MSG_NOERROR);
+			if (received == -1)
+			{
+				break;
+			}
+
+			raw_messages.emplace_back(msg_buffer->buffer, received);
+		}
+
+		auto unread = std::vector<std::string>();
+		for (size_t i = 0; i < raw_messages.size(); )
+		{
+			size_t message_length = 0;
+			if (raw_messages[i].size() != sizeof(message_length))
+			{
+				++i;
+				continue;
+			}
+
+			std::memcpy(&message_length, raw_messages[i].data(), sizeof(message_length));
+			if (i + 1 < raw_messages.size())
+			{
+				if (raw_messages[i + 1].size() == message_length)
+				{
+					unread.push_back(std::move(raw_messages[i + 1]));
+					i += 2;
+				}
+				else
+				{
+					++i;
+				}
+				continue;
+			}
+
+			// The body of the last message is still being written
+			auto message = std::string(message_length, '\0');
+			if (!message_read(message.data(), message_length))
+			{
+				unread.push_back(std::move(message));
+			}
+			break;
+		}
+
+		return unread;
+	}
+
 	~message_connection() noexcept
 	{
 	#ifdef _IS_SERVER_
@@ -0,0 +1,287 @@
+#ifndef __NUMA_PLACEMENT_HPP__
+#define __NUMA_PLACEMENT_HPP__
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <memory_resource>
+
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "status.hpp"
+#include "logging.hpp"
+#include "tank_ids.hpp"
+
+// How the tanks and the workers serving them are laid out
+enum class placement_policy
+{
+	// Tanks wherever the allocator puts them, workers on any CPU; the default, NUMA placement is opted into
+	none,
+	// Tanks split into a contiguous range per NUMA node, workers pinned to the node of their tanks
+	numa
+};
+
+// NUMA nodes of the machine and their CPUs, read from sysfs; without NUMA the machine is a single node
+class numa_topology
+{
+private:
+	static const size_t max_cpus = 4096;
+	static const size_t max_nodes = 64;
+
+	std::vector<std::vector<uint64_t>> cpus;
+
+	[[nodiscard]] static numa_topology detect()
+	{
+		auto detected = numa_topology();
+
+		for (size_t node = 0; node < max_nodes; ++node)
+		{
+			auto file = std::ifstream("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			auto list = std::string();
+			if (!file || !std::getline(file, list))
+			{
+				break;
+			}
+
+			// A node with memory only has an empty list, its memory is still used by the nearest CPUs
+			if (auto &&[node_cpus, result] = st::stoids(list, max_cpus); st::is_success(result))
+			{
+				detected.cpus.push_back(std::move(node_cpus));
+			}
+			else
+			{
+				detected.cpus.emplace_back();
+			}
+		}
+
+		if (detected.cpus.empty())
+		{
+			auto &&all = detected.cpus.emplace_back();
+			for (uint64_t cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+			{
+				all.push_back(cpu);
+			}
+		}
+
+		return detected;
+	}
+
+public:
+	[[nodiscard]] static const numa_topology &current()
+	{
+		static const auto topology = detect();
+		return topology;
+	}
+
+	[[nodiscard]] size_t nodes_count() const noexcept
+	{
+		return cpus.size();
+	}
+
+	[[nodiscard]] const std::vector<uint64_t> &cpus_of(size_t node) const noexcept
+	{
+		return cpus[node];
+	}
+
+	// The node among the first `count` elements an element belongs to: equal contiguous ranges
+	[[nodiscard]] size_t node_of(size_t element, size_t count) const noexcept
+	{
+		return count == 0 ? 0 : element * nodes_count() / count;
+	}
+
+	// Workers are shared out in proportion to the CPUs of the nodes, every node with CPUs gets at least one
+	[[nodiscard]] std::vector<size_t> worker_nodes(size_t workers_count) const
+	{
+		auto total = size_t(0);
+		for (auto &&node_cpus : cpus)
+		{
+			total += node_cpus.size();
+		}
+
+		auto nodes = std::vector<size_t>();
+		for (size_t node = 0; node < nodes_count(); ++node)
+		{
+			auto share = std::max<size_t>(cpus[node].empty() ? 0 : 1, workers_count * cpus[node].size() / std::max<size_t>(total, 1));
+			nodes.insert(nodes.end(), share, node);
+		}
+
+		nodes.resize(workers_count, nodes.empty() ? 0 : nodes.back());
+		return nodes;
+	}
+
+	// The calling thread runs on the CPUs of the node from now on, or anywhere as before if it cannot be pinned
+	status pin_current_thread(size_t node) const
+	{
+		auto set = cpu_set_t();
+		CPU_ZERO(&set);
+
+		for (auto cpu : cpus_of(node))
+		{
+			if (cpu < CPU_SETSIZE)
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+
+		if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		{
+			logging::warnlog("unable to pin a thread to node " + std::to_string(node));
+			return status::failed_initialization;
+		}
+
+		return status::success;
+	}
+};
+
+// Backs large arrays such as the tanks with hugepages and binds each node's share of them to its memory.
+// An allocation is split into as many equal contiguous ranges as there are nodes, the same way
+// numa_topology::node_of() splits elements. Explicit 2 MB hugepages are used when some are reserved,
+// otherwise transparent ones are requested. Without a topology it is the plain heap.
+class numa_resource : public std::pmr::memory_resource
+{
+public:
+	enum class page_kind
+	{
+		regular,
+		transparent_huge,
+		huge
+	};
+
+	static const size_t huge_page_size = 2 << 20;
+
+private:
+	// From linux/mempolicy.h: memory of the given node while it has some, then the nearest
+	static const int preferred_policy = 1;
+
+	// Nodes are counted up to numa_topology::max_nodes
+	static const size_t mask_bits = 64;
+	static const size_t word_bits = sizeof(unsigned long) * 8;
+
+	const numa_topology *topology;
+	page_kind pages = page_kind::regular;
+
+	[[nodiscard]] static size_t round_up(size_t value, size_t alignment) noexcept
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Has to be done before the memory is first touched, so before the elements are constructed
+	void bind(char *memory, size_t bytes, size_t page_size) const
+	{
+		auto nodes = topology->nodes_count();
+		if (nodes < 2)
+		{
+			return;
+		}
+
+		for (size_t node = 0; node < nodes; ++node)
+		{
+			// Ranges start on a page boundary, a page shared by two nodes goes to the first one
+			auto begin = round_up(bytes * node / nodes, page_size);
+			auto end = std::min(round_up(bytes * (node + 1) / nodes, page_size), bytes);
+			if (begin >= end)
+			{
+				continue;
+			}
+
+			unsigned long mask[mask_bits / word_bits] = {};
+			mask[node / word_bits] = 1ul << (node % word_bits);
+
+			// The kernel counts one bit less than it is given
+			if (syscall(SYS_mbind, memory + begin, end - begin, preferred_policy, mask, sizeof(mask) * 8 + 1, 0) != 0)
+			{
+				logging::warnlog("unable to bind the memory of node " + std::to_string(node));
+			}
+		}
+	}
+
+	void *do_allocate(size_t bytes, size_t alignment) override
+	{
+		if (!topology)
+		{
+			return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		}
+
+		auto size = round_up(std::max<size_t>(bytes, 1), huge_page_size);
+
+		auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory != MAP_FAILED)
+		{
+			pages = page_kind::huge;
+			bind(static_cast<char *>(memory), bytes, huge_page_size);
+			return memory;
+		}
+
+		// Transparent hugepages need an aligned range, so a page more is mapped and the ends are given back
+		auto mapped = mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED)
+		{
+			throw std::bad_alloc();
+		}
+
+		auto start = static_cast<char *>(mapped);
+		auto aligned = reinterpret_cast<char *>(round_up(reinterpret_cast<uintptr_t>(start), huge_page_size));
+		if (aligned != start)
+		{
+			munmap(start, aligned - start);
+		}
+		munmap(aligned + size, start + huge_page_size - aligned);
+
+		pages = madvise(aligned, size, MADV_HUGEPAGE) == 0 ? page_kind::transparent_huge : page_kind::regular;
+		bind(aligned, bytes, pages == page_kind::regular ? size_t(sysconf(_SC_PAGESIZE)) : huge_page_size);
+		return aligned;
+	}
+
+	void do_deallocate(void *memory, size_t bytes, size_t alignment) override
+	{
+		if (!topology)
+		{
+			std::pmr::new_delete_resource()->deallocate(memory, bytes, alignment);
+			return;
+		}
+
+		munmap(memory, round_up(std::max<size_t>(bytes, 1), huge_page_size));
+	}
+
+	[[nodiscard]] bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+
+public:
+	explicit numa_resource(const numa_topology *topology) noexcept: topology(topology)
+	{}
+
+	[[nodiscard]] const numa_topology *get_topology() const noexcept
+	{
+		return topology;
+	}
+
+	// Of the latest allocation
+	[[nodiscard]] page_kind get_pages() const noexcept
+	{
+		return pages;
+	}
+};
+
+namespace st
+{
+	[[nodiscard]] std::string_view pktos(numa_resource::page_kind pages)
+	{
+		switch (pages)
+		{
+			case numa_resource::page_kind::huge: return "2 MB hugepages";
+			case numa_resource::page_kind::transparent_huge: return "transparent hugepages";
+			default: return "regular pages";
+		}
+	}
+}
+
+#endif // !__NUMA_PLACEMENT_HPP__
@@ -1,14 +1,56 @@
 #ifndef __OIL_PRODUCT_HPP__
 #define __OIL_PRODUCT_HPP__
 
+#include <array>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// What a tank holds and an operation moves; crude is the default, tanks from before grades hold crude
+enum class product_grade : uint8_t
+{
+	crude,
+	gasoline,
+	diesel,
+	kerosene,
+	fuel_oil
+};
+
+static const size_t product_grades_count = 5;
+
+namespace st
+{
+	static constexpr std::array<std::string_view, product_grades_count> product_grade_names = { "crude", "gasoline", "diesel", "kerosene", "fuel-oil" };
+
+	[[nodiscard]] std::string_view pgtos(product_grade grade)
+	{
+		return product_grade_names[size_t(grade)];
+	}
+
+	[[nodiscard]] std::optional<product_grade> stopg(std::string_view grade)
+	{
+		for (size_t i = 0; i < product_grades_count; ++i)
+		{
+			if (grade == product_grade_names[i])
+			{
+				return product_grade(i);
+			}
+		}
+
+		return std::nullopt;
+	}
+};
+
 class oil_product
 {
 private:
 	uint64_t content_volume = 0;
 	uint64_t capacity;
+	product_grade grade;
 
 public:
-	oil_product(uint64_t capacity = 0): capacity(capacity) {}
+	oil_product(uint64_t capacity = 0, product_grade grade = product_grade::crude): capacity(capacity), grade(grade) {}
 
 	void set_content_volume(uint64_t volume) noexcept
 	{
@@ -29,6 +71,11 @@ public:
 	{
 		return capacity;
 	}
+
+	[[nodiscard]] product_grade get_grade() const noexcept
+	{
+		return grade;
+	}
 };
 
 #endif // !__OIL_PRODUCT_HPP__
@@ -0,0 +1,32 @@
+#include "placement_benchmark.hpp"
+#include "logging.hpp"
+
+int main(int argc, char **argv)
+{
+	if (argc > 3)
+	{
+		logging::errlog("you may specify the number of tanks and the seconds per layout: `[<tanks>] [<seconds>]`");
+		return -1;
+	}
+
+	try
+	{
+		// Enough tanks by default to outgrow the caches and the TLB reach of regular pages
+		auto tanks_count = argc >= 2 ? std::stoull(argv[1]) : size_t(1) << 20;
+		auto seconds = argc == 3 ? std::stod(argv[2]) : 2.0;
+
+		if (tanks_count == 0 || seconds <= 0)
+		{
+			logging::errlog("the number of tanks and the seconds must be positive");
+			return -1;
+		}
+
+		placement_benchmark::run(tanks_count, std::chrono::duration<double>(seconds));
+		return 0;
+	}
+	catch (...)
+	{
+		logging::errlog("incorrect number of tanks or seconds");
+		return -1;
+	}
+}
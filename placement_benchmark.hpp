@@ -0,0 +1,140 @@
+#ifndef __PLACEMENT_BENCHMARK_HPP__
+#define __PLACEMENT_BENCHMARK_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+
+#include "storage_tank.hpp"
+#include "numa_placement.hpp"
+
+// Compares the tank layouts under the access pattern of the sessions: every thread stands for a worker
+// and reads random tanks of its node's range, the way a worker serves the sessions routed to it.
+// With the current layout the tanks are wherever the constructing thread put them and the threads float;
+// with NUMA placement the tanks are bound to their nodes on hugepages and the threads are pinned.
+class placement_benchmark
+{
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct result
+	{
+		uint64_t accesses;
+		std::chrono::duration<double> elapsed;
+	};
+
+	[[nodiscard]] static uint64_t next_random(uint64_t &state) noexcept
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+
+	[[nodiscard]] static result measure(placement_policy policy, size_t tanks_count, std::chrono::duration<double> duration)
+	{
+		auto &&topology = numa_topology::current();
+		auto placement = numa_resource(policy == placement_policy::numa ? &topology : nullptr);
+		auto tanks = tank_vector(tanks_count, &placement);
+
+		auto nodes = topology.worker_nodes(std::max(1u, std::thread::hardware_concurrency()));
+		auto started = std::atomic<bool>(false);
+		auto stopped = std::atomic<bool>(false);
+		auto accesses = std::atomic<uint64_t>(0);
+		auto checksum = std::atomic<uint64_t>(0);
+		auto threads = std::vector<std::thread>();
+
+		for (size_t worker = 0; worker < nodes.size(); ++worker)
+		{
+			threads.emplace_back([&, worker]
+			{
+				auto node = nodes[worker];
+				if (policy == placement_policy::numa)
+				{
+					topology.pin_current_thread(node);
+				}
+
+				// The range of the node, the same split the fleet uses
+				auto first = tanks_count * node / topology.nodes_count();
+				auto count = std::max<size_t>(tanks_count * (node + 1) / topology.nodes_count() - first, 1);
+				auto random = uint64_t(0x9e3779b97f4a7c15) ^ worker;
+				auto local_accesses = uint64_t(0);
+				auto local_checksum = uint64_t(0);
+
+				while (!started.load(std::memory_order_acquire))
+				{}
+
+				while (!stopped.load(std::memory_order_relaxed))
+				{
+					for (size_t i = 0; i < 1024; ++i)
+					{
+						local_checksum += tanks[first + next_random(random) % count].snapshot().level_of_oil_products;
+					}
+					local_accesses += 1024;
+				}
+
+				accesses.fetch_add(local_accesses);
+				checksum.fetch_add(local_checksum);
+			});
+		}
+
+		auto start = clock::now();
+		started.store(true, std::memory_order_release);
+		std::this_thread::sleep_for(duration);
+		stopped = true;
+
+		for (auto &&thread : threads)
+		{
+			thread.join();
+		}
+
+		auto elapsed = clock::now() - start;
+
+		// The sum keeps the reads from being optimized away
+		if (checksum.load() == 0)
+		{
+			std::cout << "# no tank was read\n";
+		}
+
+		if (policy == placement_policy::numa)
+		{
+			std::cout << "# placed on " << topology.nodes_count() << " NUMA nodes, " << st::pktos(placement.get_pages()) << '\n';
+		}
+
+		return { accesses.load(), elapsed };
+	}
+
+	static void print_row(std::string_view name, const result &measured, size_t threads_count)
+	{
+		auto per_second = double(measured.accesses) / measured.elapsed.count();
+		auto nanoseconds = 1e9 * measured.elapsed.count() * double(threads_count) / double(std::max<uint64_t>(measured.accesses, 1));
+
+		std::cout << name << '\t' << std::fixed << std::setprecision(0) << per_second << '\t'
+			<< std::setprecision(1) << nanoseconds << '\n';
+	}
+
+public:
+	// Prints the reads per second of all threads and the nanoseconds a read takes a thread for both layouts
+	static void run(size_t tanks_count, std::chrono::duration<double> duration)
+	{
+		auto threads_count = numa_topology::current().worker_nodes(std::max(1u, std::thread::hardware_concurrency())).size();
+
+		std::cout << "# " << tanks_count << " tanks of " << sizeof(storage_tank) << " bytes, "
+			<< threads_count << " threads, " << duration.count() << " s per layout\n";
+
+		auto current = measure(placement_policy::none, tanks_count, duration);
+		auto placed = measure(placement_policy::numa, tanks_count, duration);
+
+		std::cout << "# layout\treads/s\tns/read\n";
+		print_row("current", current, threads_count);
+		print_row("numa", placed, threads_count);
+
+		std::cout << "# numa/current throughput: " << std::setprecision(2)
+			<< (double(placed.accesses) / placed.elapsed.count()) / (double(current.accesses) / current.elapsed.count()) << std::endl;
+	}
+};
+
+#endif // !__PLACEMENT_BENCHMARK_HPP__
@@ -0,0 +1,20 @@
+#include "profdecode.hpp"
+#include "logging.hpp"
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		logging::errlog("you must specify the profile written by the `profile` command: `<profile>`");
+		return -1;
+	}
+
+	auto &&[decoded, result] = profdecode::load(argv[1]);
+	if (st::is_not_success(result))
+	{
+		return -1;
+	}
+
+	decoded.print(std::cout);
+	return 0;
+}
@@ -0,0 +1,284 @@
+#ifndef __PROFDECODE_HPP__
+#define __PROFDECODE_HPP__
+
+#include <map>
+#include <array>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "status.hpp"
+#include "logging.hpp"
+
+// Turns a profile written by the server into collapsed stacks, "thread;outermost;...;innermost count"
+// a line, the input of flame graph tools. Addresses are symbolised here, after the fact, by addr2line
+// on the modules they were mapped from; inlined functions become frames of their own. In a stripped
+// library a frame gets the nearest exported name, an address addr2line knows nothing about is shown
+// as its module and offset.
+class profdecode
+{
+private:
+	struct module
+	{
+		uint64_t start;
+		uint64_t end;
+		uint64_t offset;
+		std::string path;
+	};
+
+	static const size_t addresses_per_call = 512;
+
+	std::vector<module> modules;
+	std::unordered_map<uint64_t, std::string> thread_names;
+	std::vector<std::pair<uint64_t, std::vector<uint64_t>>> samples;
+	// Frames of an address, outermost first
+	std::unordered_map<uint64_t, std::vector<std::string>> symbols;
+
+	[[nodiscard]] const module *module_of(uint64_t address) const noexcept
+	{
+		auto found = std::find_if(modules.begin(), modules.end(), [address](auto &&mapped) { return address >= mapped.start && address < mapped.end; });
+		return found == modules.end() ? nullptr : &*found;
+	}
+
+	// Shared objects and position independent executables are looked up by their offset in the file,
+	// anything else by the address itself
+	[[nodiscard]] static bool is_relocatable(const std::string &path)
+	{
+		auto header = std::array<char, 18>();
+		auto file = std::ifstream(path, std::ios::binary);
+		static const uint16_t shared_object = 3;
+		return file.read(header.data(), header.size()) && uint16_t(uint8_t(header[16]) | uint8_t(header[17]) << 8) == shared_object;
+	}
+
+	[[nodiscard]] static std::string fallback(const module *mapped, uint64_t address)
+	{
+		if (!mapped)
+		{
+			return "[unknown]";
+		}
+
+		char offset[24];
+		std::snprintf(offset, sizeof(offset), "+0x%lx", static_cast<unsigned long>(address - mapped->start + mapped->offset));
+		return mapped->path.substr(mapped->path.rfind('/') + 1) + offset;
+	}
+
+	// Without a shell: the module paths come from the profile and are passed on as they are.
+	// The output of the program is read from the returned stream, its errors are dropped
+	[[nodiscard]] static FILE *run(std::vector<std::string> &arguments, pid_t &child)
+	{
+		int ends[2];
+		if (pipe(ends) == -1)
+		{
+			return nullptr;
+		}
+
+		auto argv = std::vector<char *>();
+		for (auto &&argument : arguments)
+		{
+			argv.push_back(argument.data());
+		}
+		argv.push_back(nullptr);
+
+		if (child = fork(); child == 0)
+		{
+			dup2(ends[1], STDOUT_FILENO);
+			if (auto null = open("/dev/null", O_WRONLY); null != -1)
+			{
+				dup2(null, STDERR_FILENO);
+			}
+			close(ends[0]);
+			close(ends[1]);
+
+			execvp(argv[0], argv.data());
+			_exit(127);
+		}
+
+		close(ends[1]);
+		if (child == -1)
+		{
+			close(ends[0]);
+			return nullptr;
+		}
+
+		return fdopen(ends[0], "r");
+	}
+
+	// "0x<address>" and then a function and a location per frame, innermost first
+	void symbolize(const module &mapped, const std::vector<uint64_t> &addresses)
+	{
+		auto relocatable = is_relocatable(mapped.path);
+
+		for (size_t first = 0; first < addresses.size(); first += addresses_per_call)
+		{
+			auto last = std::min(first + addresses_per_call, addresses.size());
+			auto arguments = std::vector<std::string>{ "addr2line", "-a", "-f", "-C", "-i", "-e", mapped.path };
+			auto lookup = std::map<uint64_t, uint64_t>();
+
+			for (auto i = first; i < last; ++i)
+			{
+				auto looked_up = relocatable ? addresses[i] - mapped.start + mapped.offset : addresses[i];
+				lookup[looked_up] = addresses[i];
+
+				char number[24];
+				std::snprintf(number, sizeof(number), "0x%lx", static_cast<unsigned long>(looked_up));
+				arguments.emplace_back(number);
+			}
+
+			auto child = pid_t();
+			auto pipe = run(arguments, child);
+			if (!pipe)
+			{
+				return;
+			}
+
+			std::vector<std::string> *current = nullptr;
+			auto expect_function = true;
+			char buffer[4096];
+			while (std::fgets(buffer, sizeof(buffer), pipe))
+			{
+				auto line = std::string(buffer);
+				line.erase(line.find_last_not_of('\n') + 1);
+
+				if (line.starts_with("0x") && line.find_first_not_of("0123456789abcdef", 2) == std::string::npos)
+				{
+					auto found = lookup.find(std::stoull(line, nullptr, 16));
+					current = found == lookup.end() ? nullptr : &symbols[found->second];
+					expect_function = true;
+				}
+				else if (current && expect_function)
+				{
+					current->push_back(line);
+					expect_function = false;
+				}
+				else
+				{
+					expect_function = true;
+				}
+			}
+
+			std::fclose(pipe);
+			waitpid(child, nullptr, 0);
+		}
+	}
+
+	void symbolize_all()
+	{
+		auto by_module = std::map<const module *, std::vector<uint64_t>>();
+		for (auto &&[thread, frames] : samples)
+		{
+			for (auto address : frames)
+			{
+				if (!symbols.contains(address))
+				{
+					symbols[address];
+					if (auto mapped = module_of(address))
+					{
+						by_module[mapped].push_back(address);
+					}
+				}
+			}
+		}
+
+		for (auto &&[mapped, addresses] : by_module)
+		{
+			symbolize(*mapped, addresses);
+		}
+
+		for (auto &&[address, frames] : symbols)
+		{
+			frames.erase(std::remove(frames.begin(), frames.end(), "??"), frames.end());
+			if (frames.empty())
+			{
+				frames.push_back(fallback(module_of(address), address));
+			}
+
+			// addr2line gives the inlined functions innermost first
+			std::reverse(frames.begin(), frames.end());
+		}
+	}
+
+public:
+	[[nodiscard]] static std::pair<profdecode, status> load(const std::string &path)
+	{
+		auto file = std::ifstream(path);
+		auto line = std::string();
+		if (!file || !std::getline(file, line) || line != "OILPRF01")
+		{
+			logging::errlog("not a profile: " + path);
+			return { {}, status::read_error };
+		}
+
+		auto decoded = profdecode();
+		while (std::getline(file, line))
+		{
+			auto fields = std::istringstream(line);
+			auto kind = std::string();
+			fields >> kind;
+
+			if (kind == "module")
+			{
+				auto &&mapped = decoded.modules.emplace_back();
+				fields >> std::hex >> mapped.start >> mapped.end >> mapped.offset >> std::ws;
+				std::getline(fields, mapped.path);
+			}
+			else if (kind == "thread")
+			{
+				auto thread = uint64_t(0);
+				fields >> thread >> std::ws;
+				std::getline(fields, decoded.thread_names[thread]);
+			}
+			else if (kind == "sample")
+			{
+				auto &&[thread, frames] = decoded.samples.emplace_back();
+				fields >> thread >> std::hex;
+				for (auto address = uint64_t(0); fields >> address; )
+				{
+					// A return address points after its call, the call itself is one byte before
+					frames.push_back(frames.empty() ? address : address - 1);
+				}
+			}
+		}
+
+		decoded.symbolize_all();
+		return { std::move(decoded), status::success };
+	}
+
+	// Identical stacks are counted once, the busiest first
+	void print(std::ostream &out) const
+	{
+		auto counts = std::map<std::string, uint64_t>();
+		for (auto &&[thread, frames] : samples)
+		{
+			auto name = thread_names.find(thread);
+			auto stack = name == thread_names.end() ? std::string("thread") : name->second;
+
+			for (auto frame = frames.rbegin(); frame != frames.rend(); ++frame)
+			{
+				for (auto &&function : symbols.at(*frame))
+				{
+					stack.append(";").append(function);
+				}
+			}
+			++counts[stack];
+		}
+
+		auto sorted = std::vector<std::pair<std::string, uint64_t>>(counts.begin(), counts.end());
+		std::stable_sort(sorted.begin(), sorted.end(), [](auto &&lhs, auto &&rhs) { return lhs.second > rhs.second; });
+
+		for (auto &&[stack, count] : sorted)
+		{
+			out << stack << ' ' << count << '\n';
+		}
+	}
+};
+
+#endif // !__PROFDECODE_HPP__
@@ -0,0 +1,31 @@
+#include "rate_benchmark.hpp"
+#include "logging.hpp"
+
+int main(int argc, char **argv)
+{
+	if (argc > 4)
+	{
+		logging::errlog("you may specify the weights of the two clients and the seconds: `[<weight> <weight>] [<seconds>]`");
+		return -1;
+	}
+
+	try
+	{
+		// A client three times heavier than the other should get three quarters of the commands through
+		auto weights = argc >= 3 ? std::vector<double>{ std::stod(argv[1]), std::stod(argv[2]) } : std::vector<double>{ 1.0, 3.0 };
+		auto seconds = argc == 4 ? std::stod(argv[3]) : argc == 2 ? std::stod(argv[1]) : 2.0;
+
+		if (weights[0] <= 0 || weights[1] <= 0 || seconds <= 0)
+		{
+			logging::errlog("the weights and the seconds must be positive");
+			return -1;
+		}
+
+		return rate_benchmark::run(weights, std::chrono::duration<double>(seconds)) ? 0 : 1;
+	}
+	catch (...)
+	{
+		logging::errlog("incorrect weights or seconds");
+		return -1;
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef __RATE_BENCHMARK_HPP__
+#define __RATE_BENCHMARK_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+
+#include "executor.hpp"
+#include "task_group.hpp"
+#include "rate_limiter.hpp"
+
+// Checks the shares of the turns under load: every client floods the executor with as many sessions,
+// each command keeps its worker busy for a while, and the commands each client gets through are counted.
+// With a turn per worker the waiting commands queue in the rate limiter, so the shares follow the weights.
+class rate_benchmark
+{
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct client
+	{
+		uint64_t id = 0;
+		double weight = 1;
+		std::atomic<uint64_t> commands = 0;
+	};
+
+	static inline const auto command_duration = std::chrono::microseconds(200);
+	static inline const auto next_command_delay = std::chrono::microseconds(100);
+	static inline const size_t sessions_per_client = 16;
+	// Of the share of all commands
+	static inline const double tolerance = 0.05;
+
+	static task<void> flood(client &sender, const std::atomic<bool> &stopped)
+	{
+		auto limits = rate_limiter::session();
+		limits.identify(sender.id);
+
+		while (!stopped.load(std::memory_order_relaxed))
+		{
+			// The next command of the session arrives, the worker serves other sessions meanwhile
+			co_await executor::sleep_for(next_command_delay);
+			auto turn = co_await limits.take_turn();
+
+			// Busy the way a command keeps its worker
+			for (auto start = clock::now(); clock::now() - start < command_duration;)
+			{}
+
+			sender.commands.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	static task<void> flood_all(std::vector<client> &clients, const std::atomic<bool> &stopped, std::promise<void> &finished)
+	{
+		auto group = task_group();
+		for (auto &&sender : clients)
+		{
+			for (size_t i = 0; i < sessions_per_client; ++i)
+			{
+				group.spawn(flood(sender, stopped));
+			}
+		}
+
+		co_await group.wait();
+		finished.set_value();
+	}
+
+public:
+	// Prints the share of the commands each client got and the share of its weight,
+	// false if a client is off by more than the tolerance
+	[[nodiscard]] static bool run(const std::vector<double> &weights, std::chrono::duration<double> duration)
+	{
+		auto workers = executor();
+		rate_limiter::set_concurrency(workers.workers_count());
+
+		auto clients = std::vector<client>(weights.size());
+		auto total_weight = 0.0;
+		for (size_t i = 0; i < clients.size(); ++i)
+		{
+			clients[i].id = i + 1;
+			clients[i].weight = weights[i];
+			rate_limiter::set_weight(clients[i].id, weights[i]);
+			total_weight += weights[i];
+		}
+
+		std::cout << "# " << clients.size() << " clients of " << sessions_per_client << " sessions, " << workers.workers_count()
+			<< " workers, commands of " << command_duration.count() << " us, " << duration.count() << " s\n";
+
+		auto stopped = std::atomic<bool>(false);
+		auto finished = std::promise<void>();
+		workers.spawn(flood_all(clients, stopped, finished));
+
+		std::this_thread::sleep_for(duration);
+		stopped = true;
+		finished.get_future().wait();
+
+		auto total = uint64_t(0);
+		for (auto &&sender : clients)
+		{
+			total += sender.commands.load();
+		}
+
+		auto fair = true;
+		std::cout << "# client\tweight\tcommands\tshare\texpected\n";
+		for (auto &&sender : clients)
+		{
+			auto share = double(sender.commands.load()) / double(std::max<uint64_t>(total, 1));
+			auto expected = sender.weight / total_weight;
+			fair = fair && std::abs(share - expected) <= tolerance;
+
+			std::cout << sender.id << '\t' << sender.weight << '\t' << sender.commands.load() << '\t'
+				<< std::fixed << std::setprecision(3) << share << '\t' << expected << std::defaultfloat << '\n';
+		}
+
+		std::cout << (fair ? "# shares follow the weights" : "# shares do not follow the weights") << std::endl;
+		return fair;
+	}
+};
+
+#endif // !__RATE_BENCHMARK_HPP__
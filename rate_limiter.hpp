@@ -0,0 +1,433 @@
+#ifndef __RATE_LIMITER_HPP__
+#define __RATE_LIMITER_HPP__
+
+#include <map>
+#include <mutex>
+#include <queue>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <coroutine>
+#include <type_traits>
+#include <unordered_map>
+
+#include "task.hpp"
+#include "executor.hpp"
+#include "async_connection_if.hpp"
+
+// Commands a second and how many may come at once; a rate of 0 is no limit
+struct rate_limit
+{
+	double rate = 0;
+	double burst = 0;
+};
+
+// Starts full and refills continuously, a command takes a token
+class token_bucket
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+private:
+	double tokens = 0;
+	clock::time_point updated = {};
+
+public:
+	// How long until a token is there, zero if there is one now
+	[[nodiscard]] std::chrono::nanoseconds wait(const rate_limit &limit, clock::time_point now) noexcept
+	{
+		if (limit.rate <= 0)
+		{
+			return std::chrono::nanoseconds::zero();
+		}
+
+		auto capacity = std::max(limit.burst, 1.0);
+		auto elapsed = std::chrono::duration<double>(now - updated).count();
+		tokens = updated == clock::time_point() ? capacity : std::min(capacity, tokens + limit.rate * elapsed);
+		updated = now;
+
+		return tokens >= 1 ? std::chrono::nanoseconds::zero()
+			: std::chrono::nanoseconds(int64_t((1 - tokens) / limit.rate * 1e9) + 1);
+	}
+
+	void take(const rate_limit &limit) noexcept
+	{
+		if (limit.rate > 0)
+		{
+			tokens -= 1;
+		}
+	}
+};
+
+// Admission of commands: a command needs a token of its session and one of its client, the process on the
+// other side, or it is answered with "retry after". Admitted commands then take turns: at most `concurrency`
+// run at once and the waiting ones are started in start-time fair queuing order, so each client gets
+// a share of the turns in proportion to its weight however many sessions it floods the server with.
+class rate_limiter
+{
+public:
+	using clock = token_bucket::clock;
+
+	struct client_statistics
+	{
+		uint64_t client;
+		size_t sessions;
+		double weight;
+		uint64_t admitted;
+		uint64_t throttled;
+	};
+
+	struct statistics
+	{
+		rate_limit session_limit;
+		rate_limit client_limit;
+		size_t concurrency;
+		size_t in_flight;
+		size_t queued;
+		std::vector<client_statistics> clients;
+	};
+
+private:
+	struct client_state
+	{
+		token_bucket bucket;
+		size_t sessions = 0;
+		// Virtual time at which the client's latest command is done with its turn
+		double finish = 0;
+		uint64_t admitted = 0;
+		uint64_t throttled = 0;
+	};
+
+	struct waiter
+	{
+		double start;
+		uint64_t order;
+		std::coroutine_handle<> handle;
+		executor *scheduler;
+
+		[[nodiscard]] bool operator>(const waiter &other) const noexcept
+		{
+			return std::pair(start, order) > std::pair(other.start, other.order);
+		}
+	};
+
+	// Suspends until the command's turn comes
+	struct turn_awaiter
+	{
+		uint64_t client;
+
+		bool await_ready() const
+		{
+			return false;
+		}
+
+		bool await_suspend(std::coroutine_handle<> handle) const
+		{
+			auto guard = std::lock_guard(mutex);
+			auto start = start_tag(client);
+			auto scheduler = executor::current();
+
+			if (in_flight < concurrency && waiting.empty() && !scheduler->has_queued_work())
+			{
+				// Nothing else is ready to run, so there is no order to keep: started at once, as if dequeued
+				virtual_time = std::max(virtual_time, start);
+				++in_flight;
+				return false;
+			}
+
+			waiting.push({ start, next_order++, handle, scheduler });
+			if (in_flight < concurrency)
+			{
+				++in_flight;
+				scheduler->post_behind(dispatch);
+			}
+			return true;
+		}
+
+		void await_resume() const noexcept
+		{}
+	};
+
+	static inline std::mutex mutex;
+
+	static inline rate_limit session_limit;
+	static inline rate_limit client_limit;
+
+	// A turn per worker: a command holds its turn only while it keeps a worker busy, so the turns are
+	// the workers and the waiting commands are queued here, in fair order, instead of in the executor
+	static inline size_t concurrency = std::max(1u, std::thread::hardware_concurrency());
+	static inline size_t in_flight = 0;
+
+	static inline std::unordered_map<uint64_t, client_state> clients;
+	// Kept for clients that come and go
+	static inline std::map<uint64_t, double> weights;
+
+	static inline double virtual_time = 0;
+	static inline uint64_t next_order = 0;
+	static inline std::priority_queue<waiter, std::vector<waiter>, std::greater<waiter>> waiting;
+
+	// Called with the mutex held
+	[[nodiscard]] static double start_tag(uint64_t client)
+	{
+		auto found = weights.find(client);
+		auto weight = found == weights.end() ? 1.0 : found->second;
+		auto &&state = clients[client];
+
+		auto start = std::max(virtual_time, state.finish);
+		state.finish = start + 1 / weight;
+		return start;
+	}
+
+	// A turn taken or given up for the waiters starts the one first in fair order. It is handed out behind
+	// the work that is ready, so the commands ready by then are waiting for it as well: a command that
+	// keeps its worker busy never suspends while it holds the turn, and ordering only the commands
+	// already waiting would leave it to the order in which the workers happen to run the others.
+	static void dispatch()
+	{
+		auto next = waiter();
+		{
+			auto guard = std::lock_guard(mutex);
+			if (waiting.empty())
+			{
+				--in_flight;
+				return;
+			}
+
+			next = waiting.top();
+			waiting.pop();
+			virtual_time = next.start;
+		}
+
+		next.scheduler->schedule(next.handle);
+	}
+
+	// The turn passes to the next waiter, if any
+	static void release()
+	{
+		auto scheduler = static_cast<executor *>(nullptr);
+		{
+			auto guard = std::lock_guard(mutex);
+			if (waiting.empty() || in_flight > concurrency)
+			{
+				--in_flight;
+				return;
+			}
+
+			scheduler = waiting.top().scheduler;
+		}
+
+		scheduler->post_behind(dispatch);
+	}
+
+public:
+	// Held while a command runs
+	class turn
+	{
+	private:
+		uint64_t client;
+		bool held;
+
+	public:
+		turn(uint64_t client, bool held) noexcept: client(client), held(held)
+		{}
+
+		turn(turn &&other) noexcept: client(other.client), held(std::exchange(other.held, false))
+		{}
+
+		turn(const turn &) = delete;
+		turn &operator=(const turn &) = delete;
+		turn &operator=(turn &&) = delete;
+
+		~turn()
+		{
+			if (held)
+			{
+				release();
+			}
+		}
+
+		// Lets the others run while the command only waits for `awaited`, then waits for the turn again
+		// in the order of its client, the way a new command of the client would
+		template <typename T>
+		task<T> without(task<T> awaited)
+		{
+			auto given_up = std::exchange(held, false);
+			if (given_up)
+			{
+				release();
+			}
+
+			if constexpr (std::is_void_v<T>)
+			{
+				co_await awaited;
+				if (given_up)
+				{
+					co_await take_back();
+				}
+			}
+			else
+			{
+				auto result = co_await awaited;
+				if (given_up)
+				{
+					co_await take_back();
+				}
+				co_return result;
+			}
+		}
+
+	private:
+		task<void> take_back()
+		{
+			co_await turn_awaiter{ client };
+			held = true;
+		}
+	};
+
+	// Budget of one session, counted against its client once the client is known
+	class session
+	{
+	private:
+		token_bucket bucket;
+		uint64_t client = 0;
+		bool identified = false;
+
+	public:
+		session() = default;
+
+		session(const session &) = delete;
+		session &operator=(const session &) = delete;
+
+		~session()
+		{
+			if (!identified)
+			{
+				return;
+			}
+
+			auto guard = std::lock_guard(mutex);
+			if (auto found = clients.find(client); found != clients.end() && --found->second.sessions == 0)
+			{
+				clients.erase(found);
+			}
+		}
+
+		// Once the client has sent a command, a session keeps its client from then on
+		void identify(async_connection_if &connection)
+		{
+			if (!identified)
+			{
+				identify(connection.peer_process());
+			}
+		}
+
+		void identify(uint64_t peer)
+		{
+			if (identified)
+			{
+				return;
+			}
+
+			client = peer;
+			identified = true;
+
+			auto guard = std::lock_guard(mutex);
+			++clients[client].sessions;
+		}
+
+		// Zero when the command may run, otherwise when to retry; a refused command takes no tokens
+		[[nodiscard]] std::chrono::nanoseconds admit()
+		{
+			auto now = clock::now();
+			auto guard = std::lock_guard(mutex);
+			auto &&state = clients[client];
+
+			auto wait = std::max(bucket.wait(session_limit, now), state.bucket.wait(client_limit, now));
+			if (wait != std::chrono::nanoseconds::zero())
+			{
+				++state.throttled;
+				return wait;
+			}
+
+			bucket.take(session_limit);
+			state.bucket.take(client_limit);
+			++state.admitted;
+			return wait;
+		}
+
+		// Suspends until the command's turn comes
+		[[nodiscard]] turn_awaiter wait_turn() const noexcept
+		{
+			return turn_awaiter{ client };
+		}
+
+		// co_await session.take_turn() holds the turn until the returned one is destroyed or gives it up
+		// while it waits, an exempt command runs at once and holds none
+		[[nodiscard]] task<turn> take_turn(bool exempt = false)
+		{
+			if (!exempt)
+			{
+				co_await wait_turn();
+			}
+			co_return turn(client, !exempt);
+		}
+	};
+
+	static void set_session_limit(rate_limit limit)
+	{
+		auto guard = std::lock_guard(mutex);
+		session_limit = limit;
+	}
+
+	static void set_client_limit(rate_limit limit)
+	{
+		auto guard = std::lock_guard(mutex);
+		client_limit = limit;
+	}
+
+	// A lower limit takes effect as the running commands finish
+	static void set_concurrency(size_t limit)
+	{
+		auto granted = std::vector<executor *>();
+		{
+			auto guard = std::lock_guard(mutex);
+			concurrency = std::max<size_t>(limit, 1);
+
+			for (auto queued = waiting.size(); in_flight < concurrency && granted.size() < queued; ++in_flight)
+			{
+				granted.push_back(waiting.top().scheduler);
+			}
+		}
+
+		for (auto &&scheduler : granted)
+		{
+			scheduler->post_behind(dispatch);
+		}
+	}
+
+	// Applies to the commands queued from now on
+	static void set_weight(uint64_t client, double weight)
+	{
+		auto guard = std::lock_guard(mutex);
+		weights[client] = weight;
+	}
+
+	[[nodiscard]] static statistics get_statistics()
+	{
+		auto guard = std::lock_guard(mutex);
+		auto result = statistics{ session_limit, client_limit, concurrency, in_flight, waiting.size(), {} };
+
+		for (auto &&[client, state] : clients)
+		{
+			auto found = weights.find(client);
+			result.clients.push_back({ client, state.sessions, found == weights.end() ? 1.0 : found->second, state.admitted, state.throttled });
+		}
+
+		std::sort(result.clients.begin(), result.clients.end(), [](auto &&lhs, auto &&rhs) { return lhs.client < rhs.client; });
+		return result;
+	}
+};
+
+#endif // !__RATE_LIMITER_HPP__
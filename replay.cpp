@@ -0,0 +1,37 @@
+#include "replay.hpp"
+#include "logging.hpp"
+
+int main(int argc, char **argv)
+{
+	if (argc != 2 && argc != 3)
+	{
+		logging::errlog("you must specify the traffic capture to replay and optionally the speed: `<capture> [<N>x|max]`");
+		return -1;
+	}
+	
+	try
+	{
+		// The recorded pace by default, 0 is as fast as the server answers
+		auto speed_argument = std::string(argc == 3 ? argv[2] : "1x");
+		auto speed = speed_argument == "max" ? 0.0 : std::stod(speed_argument);
+		
+		if (speed_argument != "max" && (!speed_argument.ends_with('x') || speed <= 0))
+		{
+			logging::errlog("incorrect speed, expected for example 1x, 10x, 0.5x or max");
+			return -1;
+		}
+		
+		auto &&[workload, result] = replay::load(argv[1]);
+		if (st::is_not_success(result))
+		{
+			return -1;
+		}
+		
+		return st::is_success(workload.run(speed)) ? 0 : 1;
+	}
+	catch (...)
+	{
+		logging::errlog("incorrect speed, expected for example 1x, 10x, 0.5x or max");
+		return -1;
+	}
+}
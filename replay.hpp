@@ -0,0 +1,405 @@
+#ifndef __REPLAY_HPP__
+#define __REPLAY_HPP__
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cctype>
+#include <memory>
+#include <iomanip>
+#include <optional>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+
+#include "traffic_capture.hpp"
+#include "message_connection.hpp"
+
+// Drives a server with the sessions of a traffic capture and compares the latencies with the recorded ones.
+// Every command is sent at its recorded moment divided by the speed, and never before the responses
+// its client had seen when it was recorded, so pipelined and interactive sessions keep their shape.
+class replay
+{
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct command
+	{
+		std::chrono::nanoseconds at;
+		std::string text;
+
+		// Responses the session had received when the command was sent
+		size_t answered_before;
+
+		// Nothing for a command that was never answered, such as disconnect
+		std::optional<std::string> response{};
+		std::chrono::nanoseconds recorded_latency{};
+
+		clock::time_point sent{};
+		std::optional<std::chrono::nanoseconds> replayed_latency{};
+		bool response_differs = false;
+	};
+
+	struct session
+	{
+		std::string handshake_request;
+		std::chrono::nanoseconds opened_at;
+		std::vector<command> commands;
+		status result = status::success;
+
+		std::mutex mutex;
+		std::condition_variable answered_condition;
+		size_t answered = 0;
+	};
+
+	struct latencies
+	{
+		std::vector<double> recorded;
+		std::vector<double> replayed;
+	};
+
+	// How often a session waiting for the server checks that the server, and whoever it waits for, is still there
+	static constexpr auto wait_check_interval = std::chrono::milliseconds(100);
+
+	// Sessions take turns on the handshake queue, otherwise they could take each other's keys
+	static inline std::mutex handshake_mutex;
+
+	std::vector<std::unique_ptr<session>> sessions;
+	std::chrono::nanoseconds recorded_duration{};
+
+	// A read that gives up with status::read_error once the server is gone, or with status::read_timeout
+	// once `waiting` returns false
+	template <typename F>
+	[[nodiscard]] static status read_while(message_connection &connection, std::string &message, F waiting)
+	{
+		auto result = status::read_timeout;
+		while ((result = connection.read(message, wait_check_interval)) == status::read_timeout)
+		{
+			if (!connection.peer_alive())
+			{
+				return status::read_error;
+			}
+
+			if (!waiting())
+			{
+				return status::read_timeout;
+			}
+		}
+
+		return result;
+	}
+
+	[[nodiscard]] static std::pair<std::shared_ptr<message_connection>, status> connect(std::string_view handshake_request)
+	{
+		auto connection_key = std::string();
+		auto result = status::success;
+		{
+			auto guard = std::lock_guard(handshake_mutex);
+
+			auto handshake_connection = message_connection(result);
+			if (st::is_not_success(result)
+				|| st::is_not_success(result = handshake_connection.write(handshake_request))
+				|| st::is_not_success(result = read_while(handshake_connection, connection_key, [] { return true; })))
+			{
+				return { nullptr, result };
+			}
+		}
+
+		// A tank session waits here while the tank is held by another one
+		auto connection = std::make_shared<message_connection>(result, std::stoi(connection_key));
+		auto acceptance_message = std::string();
+		if (st::is_not_success(result) || st::is_not_success(result = read_while(*connection, acceptance_message, [] { return true; })))
+		{
+			return { nullptr, result };
+		}
+
+		return { connection, acceptance_message.starts_with("-- accepted --") ? status::success : status::failed_accepted };
+	}
+
+	// Gives up once the sender has, it would otherwise wait for the responses to commands never sent
+	static void receive(session &current, message_connection &connection)
+	{
+		auto response = std::string();
+
+		for (auto &&command : current.commands)
+		{
+			if (!command.response)
+			{
+				continue;
+			}
+
+			auto result = read_while(connection, response, [&]
+			{
+				auto guard = std::lock_guard(current.mutex);
+				return st::is_success(current.result);
+			});
+
+			if (result == status::read_timeout)
+			{
+				return;
+			}
+
+			if (st::is_not_success(result))
+			{
+				auto guard = std::lock_guard(current.mutex);
+				current.result = result;
+				current.answered = current.commands.size();
+				current.answered_condition.notify_all();
+				return;
+			}
+
+			auto guard = std::lock_guard(current.mutex);
+			command.replayed_latency = clock::now() - command.sent;
+			command.response_differs = response != *command.response;
+			++current.answered;
+			current.answered_condition.notify_all();
+		}
+	}
+
+	// Speed 0 sends every command as soon as the responses before it have arrived
+	static void run_session(session &current, clock::time_point replay_start, double speed)
+	{
+		auto scaled = [&](std::chrono::nanoseconds at)
+		{
+			return replay_start + std::chrono::duration_cast<clock::duration>(at / speed);
+		};
+
+		if (speed > 0)
+		{
+			std::this_thread::sleep_until(scaled(current.opened_at));
+		}
+
+		auto &&[connection, result] = connect(current.handshake_request);
+		if (st::is_not_success(result))
+		{
+			current.result = result;
+			return;
+		}
+
+		auto receiver = std::thread(receive, std::ref(current), std::ref(*connection));
+		auto disconnected = false;
+
+		for (auto &&command : current.commands)
+		{
+			{
+				auto lock = std::unique_lock(current.mutex);
+				current.answered_condition.wait(lock, [&] { return current.answered >= command.answered_before; });
+
+				if (st::is_not_success(current.result))
+				{
+					break;
+				}
+			}
+
+			if (speed > 0)
+			{
+				std::this_thread::sleep_until(scaled(command.at));
+			}
+
+			{
+				auto guard = std::lock_guard(current.mutex);
+				command.sent = clock::now();
+			}
+
+			if (result = connection->write(command.text); st::is_not_success(result))
+			{
+				auto guard = std::lock_guard(current.mutex);
+				current.result = result;
+				break;
+			}
+
+			disconnected = command.text == "disconnect";
+		}
+
+		receiver.join();
+
+		// A session cut short in the capture still has to release its tank
+		if (!disconnected && st::is_success(current.result))
+		{
+			current.result = connection->write("disconnect");
+		}
+	}
+
+	// Commands are grouped by their text with the numbers left out: "set download speed N"
+	[[nodiscard]] static std::string command_class(std::string_view text)
+	{
+		auto result = std::string();
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			if (!std::isdigit(static_cast<unsigned char>(text[i])))
+			{
+				result.push_back(text[i]);
+				continue;
+			}
+
+			result.push_back('N');
+			while (i + 1 < text.size() && std::isdigit(static_cast<unsigned char>(text[i + 1])))
+			{
+				++i;
+			}
+		}
+		return result;
+	}
+
+	[[nodiscard]] static double percentile(std::vector<double> &values, double share)
+	{
+		if (values.empty())
+		{
+			return 0.0;
+		}
+
+		auto position = values.begin() + size_t(share * (values.size() - 1));
+		std::nth_element(values.begin(), position, values.end());
+		return *position;
+	}
+
+	static void print_row(std::string_view name, latencies &current)
+	{
+		std::cout << name << '\t' << current.replayed.size();
+
+		for (auto share : { 0.5, 0.99 })
+		{
+			auto recorded = percentile(current.recorded, share);
+			auto replayed = percentile(current.replayed, share);
+
+			std::cout << '\t' << recorded << " ms\t" << replayed << " ms\t" << std::showpos << replayed - recorded << std::noshowpos << " ms";
+		}
+
+		std::cout << '\n';
+	}
+
+public:
+	// Sessions that sent nothing are left out
+	[[nodiscard]] static std::pair<replay, status> load(const std::string &path)
+	{
+		auto &&[records, result] = traffic_capture::load(path);
+		if (st::is_not_success(result))
+		{
+			return { replay(), result };
+		}
+
+		auto loaded = replay();
+		auto by_number = std::map<uint32_t, std::unique_ptr<session>>();
+		auto answered = std::map<uint32_t, size_t>();
+		// Commands of a session by their index in the capture
+		auto indexed = std::map<std::pair<uint32_t, uint32_t>, size_t>();
+
+		for (auto &&record : records)
+		{
+			auto at = std::chrono::nanoseconds(record.timestamp);
+			loaded.recorded_duration = std::max(loaded.recorded_duration, at);
+
+			if (record.kind == traffic_capture::event::open)
+			{
+				by_number[record.session] = std::make_unique<session>();
+				by_number[record.session]->handshake_request = record.payload;
+				by_number[record.session]->opened_at = at;
+				continue;
+			}
+
+			auto found = by_number.find(record.session);
+			if (found == by_number.end())
+			{
+				continue;
+			}
+
+			auto &&current = *found->second;
+			if (record.kind == traffic_capture::event::read)
+			{
+				indexed[{ record.session, record.command }] = current.commands.size();
+				current.commands.push_back({ .at = at, .text = record.payload, .answered_before = answered[record.session] });
+			}
+			else if (record.kind == traffic_capture::event::write && record.command != traffic_capture::no_command)
+			{
+				// A response answers the command it is tagged with, a command left unanswered shifts nothing
+				auto found_command = indexed.find({ record.session, record.command });
+				if (found_command == indexed.end() || current.commands[found_command->second].response)
+				{
+					continue;
+				}
+
+				auto &&answering = current.commands[found_command->second];
+				answering.response = record.payload;
+				answering.recorded_latency = at - answering.at;
+				++answered[record.session];
+			}
+		}
+
+		for (auto &&[number, current] : by_number)
+		{
+			if (!current->commands.empty())
+			{
+				loaded.sessions.push_back(std::move(current));
+			}
+		}
+
+		return { std::move(loaded), status::success };
+	}
+
+	// Prints a line per kind of command: the count, then the recorded and replayed median and 99th percentile
+	// with their difference; the recorded latency is measured by the server, the replayed one includes the queues
+	status run(double speed)
+	{
+		auto replay_start = clock::now();
+		auto workers = std::vector<std::thread>();
+
+		for (auto &&current : sessions)
+		{
+			workers.emplace_back(run_session, std::ref(*current), replay_start, speed);
+		}
+
+		for (auto &&worker : workers)
+		{
+			worker.join();
+		}
+
+		auto elapsed = std::chrono::duration<double>(clock::now() - replay_start);
+		auto by_class = std::map<std::string, latencies>();
+		auto total = latencies();
+		auto failed_sessions = size_t(0);
+		auto differing = size_t(0);
+
+		for (auto &&current : sessions)
+		{
+			failed_sessions += st::is_not_success(current->result);
+
+			for (auto &&command : current->commands)
+			{
+				if (!command.response || !command.replayed_latency)
+				{
+					continue;
+				}
+
+				auto recorded = std::chrono::duration<double, std::milli>(command.recorded_latency).count();
+				auto replayed = std::chrono::duration<double, std::milli>(*command.replayed_latency).count();
+				auto &&current_class = by_class[command_class(command.text)];
+
+				current_class.recorded.push_back(recorded);
+				current_class.replayed.push_back(replayed);
+				total.recorded.push_back(recorded);
+				total.replayed.push_back(replayed);
+				differing += command.response_differs;
+			}
+		}
+
+		std::cout << "# command\tcount\trecorded p50\treplayed p50\tdelta\trecorded p99\treplayed p99\tdelta\n"
+			<< std::fixed << std::setprecision(3);
+
+		for (auto &&[name, current] : by_class)
+		{
+			print_row(name, current);
+		}
+		print_row("all", total);
+
+		std::cout << "# " << sessions.size() << " sessions, " << failed_sessions << " failed, "
+			<< differing << " responses differ from the capture, replayed in " << elapsed.count() << " s (recorded "
+			<< std::chrono::duration<double>(recorded_duration).count() << " s)" << std::endl;
+
+		return failed_sessions == 0 ? status::success : status::read_error;
+	}
+};
+
+#endif // !__REPLAY_HPP__
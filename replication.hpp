@@ -0,0 +1,581 @@
+#ifndef __REPLICATION_HPP__
+#define __REPLICATION_HPP__
+
+#include <deque>
+#include <mutex>
+#include <cerrno>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "status.hpp"
+#include "logging.hpp"
+#include "storage_tank.hpp"
+
+// Hot standby: the primary streams every change of a tank, the whole new state of the tank, to a standby
+// process over a local socket. A standby connecting first gets every tank, then the changes in the order
+// they were recorded. It applies a state only if it is newer than the one it has, so changes that overtake
+// the initial copy do no harm. The standby acknowledges what it has applied, which is how the primary
+// measures the lag. A standby the primary drops is told so and reconnects for a new copy; the standby
+// takes over only once the primary process has exited, a connection closing alone is not enough.
+class replication
+{
+public:
+	struct statistics
+	{
+		bool standby_connected;
+		uint64_t recorded;
+		uint64_t sent;
+		uint64_t acknowledged;
+		// From recording a change to its acknowledgement, for the latest acknowledged one and at most
+		std::chrono::nanoseconds lag;
+		std::chrono::nanoseconds max_lag;
+	};
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct change
+	{
+		uint64_t sequence;
+		// Nanoseconds since the epoch, both ends share the clock
+		int64_t timestamp;
+		uint64_t tank;
+		tank_snapshot state;
+	};
+
+	static constexpr std::string_view magic = "OILREP01";
+
+	// Sent once the standby has a copy of every tank, it may take over from then on
+	static const uint64_t synchronized = std::numeric_limits<uint64_t>::max();
+	// Sent to a standby being dropped right before the socket is closed, it reconnects for a new copy
+	static const uint64_t dropped = std::numeric_limits<uint64_t>::max() - 1;
+
+	static constexpr auto send_interval = std::chrono::milliseconds(1);
+	// How long a standby may take nothing the primary sends before it is dropped
+	static constexpr auto send_timeout = std::chrono::seconds(30);
+	static constexpr auto send_poll_interval = std::chrono::milliseconds(100);
+	static constexpr auto report_interval = std::chrono::seconds(5);
+
+	// A standby that falls this far behind is dropped as the next change is recorded, it copies every
+	// tank again when it reconnects
+	static const size_t max_pending = 1 << 20;
+
+	static inline std::atomic<bool> connected = false;
+	static inline std::atomic<uint64_t> recorded = 0;
+
+	static inline std::mutex mutex;
+	static inline std::condition_variable pending_condition;
+	static inline std::vector<change> pending;
+	static inline uint64_t sequence = 0;
+
+	static inline std::mutex statistics_mutex;
+	static inline statistics current = {};
+	// The last change of every batch sent and when it was recorded
+	static inline std::deque<std::pair<uint64_t, clock::time_point>> unacknowledged;
+
+	static inline std::jthread sender;
+
+	[[nodiscard]] static int64_t now() noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	[[nodiscard]] static sockaddr_un address_of(const std::string &path) noexcept
+	{
+		auto address = sockaddr_un();
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		return address;
+	}
+
+	// Never blocks for long: a standby that stops reading is given the send timeout, and one dropped
+	// meanwhile for falling behind is given up on at once
+	[[nodiscard]] static bool write_all(int socket, const void *data, size_t size) noexcept
+	{
+		auto progressed = clock::now();
+
+		for (auto bytes = static_cast<const char *>(data); size > 0; )
+		{
+			if (auto written = send(socket, bytes, size, MSG_NOSIGNAL | MSG_DONTWAIT); written > 0)
+			{
+				bytes += written;
+				size -= size_t(written);
+				progressed = clock::now();
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+				return false;
+			}
+
+			if (!connected.load(std::memory_order_relaxed) || clock::now() - progressed > send_timeout)
+			{
+				return false;
+			}
+
+			auto writable = pollfd{ socket, POLLOUT, 0 };
+			poll(&writable, 1, int(send_poll_interval.count()));
+		}
+		return true;
+	}
+
+	// Reads whatever acknowledgements have arrived without waiting, false once the standby is gone
+	[[nodiscard]] static bool read_acknowledgements(int socket)
+	{
+		uint64_t applied[64];
+		auto last = uint64_t(0);
+		auto received = false;
+
+		for (ssize_t size; (size = recv(socket, applied, sizeof(applied), MSG_DONTWAIT)) != 0; )
+		{
+			if (size < 0)
+			{
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					return false;
+				}
+				break;
+			}
+
+			// Acknowledgements are small enough to never be split
+			last = applied[size_t(size) / sizeof(uint64_t) - 1];
+			received = true;
+		}
+
+		if (received)
+		{
+			auto arrived = clock::now();
+			auto guard = std::lock_guard(statistics_mutex);
+			current.acknowledged = std::max(current.acknowledged, last);
+
+			for (; !unacknowledged.empty() && unacknowledged.front().first <= current.acknowledged; unacknowledged.pop_front())
+			{
+				current.lag = arrived - unacknowledged.front().second;
+				current.max_lag = std::max(current.max_lag, current.lag);
+			}
+		}
+
+		return true;
+	}
+
+	// A copy of every tank, the changes recorded meanwhile are already queued behind it
+	[[nodiscard]] static bool synchronize(int socket, const tank_vector &tanks)
+	{
+		auto count = uint64_t(tanks.size());
+		if (!write_all(socket, magic.data(), magic.size()) || !write_all(socket, &count, sizeof(count)))
+		{
+			return false;
+		}
+
+		static const size_t copy_batch = 4096;
+
+		auto copy = std::vector<change>();
+		for (size_t id = 0; id < tanks.size(); ++id)
+		{
+			copy.push_back({ 0, now(), id, tanks[id].snapshot() });
+
+			if (copy.size() == copy_batch)
+			{
+				if (!write_all(socket, copy.data(), copy.size() * sizeof(change)))
+				{
+					return false;
+				}
+				copy.clear();
+			}
+		}
+
+		copy.push_back({ 0, now(), synchronized, {} });
+		return write_all(socket, copy.data(), copy.size() * sizeof(change));
+	}
+
+	// Serves one standby at a time until it disconnects or falls too far behind
+	static void stream(int socket, const tank_vector &tanks, std::stop_token stop)
+	{
+		{
+			auto guard = std::lock_guard(mutex);
+			pending.clear();
+			connected = true;
+		}
+
+		logging::inflog("replication: a standby has connected, copying " + std::to_string(tanks.size()) + " tanks");
+
+		auto batch = std::vector<change>();
+		auto alive = synchronize(socket, tanks);
+
+		{
+			auto guard = std::lock_guard(statistics_mutex);
+			current.standby_connected = alive;
+		}
+
+		while (alive && !stop.stop_requested())
+		{
+			{
+				auto lock = std::unique_lock(mutex);
+				pending_condition.wait_for(lock, send_interval, [] { return !pending.empty() || !connected.load(std::memory_order_relaxed); });
+
+				if (!connected.load(std::memory_order_relaxed))
+				{
+					// Only if the socket takes it at once, the standby reconnects when the connection closes anyway
+					auto notice = change{ 0, now(), dropped, {} };
+					alive = send(socket, &notice, sizeof(notice), MSG_NOSIGNAL | MSG_DONTWAIT) == ssize_t(sizeof(notice));
+					break;
+				}
+
+				batch.swap(pending);
+			}
+
+			if (!batch.empty())
+			{
+				if (alive = write_all(socket, batch.data(), batch.size() * sizeof(change)); alive)
+				{
+					// When the last change was recorded, on the clock the lag is measured with
+					auto recorded_at = clock::now() - std::chrono::nanoseconds(now() - batch.back().timestamp);
+
+					auto guard = std::lock_guard(statistics_mutex);
+					current.sent = batch.back().sequence;
+					unacknowledged.emplace_back(batch.back().sequence, recorded_at);
+				}
+				batch.clear();
+			}
+
+			alive = alive && read_acknowledgements(socket);
+		}
+
+		{
+			// Nothing recorded for this standby is of use to the next one, which starts with a copy
+			auto guard = std::lock_guard(mutex);
+			connected = false;
+			std::vector<change>().swap(pending);
+		}
+		close(socket);
+
+		auto guard = std::lock_guard(statistics_mutex);
+		current.standby_connected = false;
+		unacknowledged.clear();
+		logging::warnlog("replication: the standby has disconnected");
+	}
+
+	static void follow_changes(const std::vector<change> &changes, std::vector<tank_snapshot> &states, bool &synchronized_copy,
+		bool &dropped_standby, uint64_t &applied, std::chrono::nanoseconds &max_lag)
+	{
+		auto received = now();
+
+		for (auto &&current_change : changes)
+		{
+			if (current_change.tank == synchronized)
+			{
+				synchronized_copy = true;
+				logging::inflog("replication: every tank is copied, the standby is ready to take over");
+				continue;
+			}
+
+			if (current_change.tank == dropped)
+			{
+				dropped_standby = true;
+				continue;
+			}
+
+			if (current_change.tank < states.size() && current_change.state.revision > states[current_change.tank].revision)
+			{
+				states[current_change.tank] = current_change.state;
+			}
+
+			applied = std::max(applied, current_change.sequence);
+			max_lag = std::max(max_lag, std::chrono::nanoseconds(received - current_change.timestamp));
+		}
+	}
+
+	// The process at the other end of a connected socket, 0 if unknown
+	[[nodiscard]] static pid_t peer_of(int socket) noexcept
+	{
+		auto credentials = ucred();
+		auto size = socklen_t(sizeof(credentials));
+		return getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 ? credentials.pid : 0;
+	}
+
+	// An exited process is gone even while it waits for its parent to collect it
+	[[nodiscard]] static bool is_gone(pid_t process)
+	{
+		auto line = std::string();
+		std::getline(std::ifstream("/proc/" + std::to_string(process) + "/stat"), line);
+
+		// "pid (name) state ...", the name may hold anything
+		auto name_end = line.rfind(')');
+		return name_end == std::string::npos || name_end + 2 >= line.size() || line[name_end + 2] == 'Z' || line[name_end + 2] == 'X';
+	}
+
+	// Sockets close a moment before the process is done exiting
+	[[nodiscard]] static bool has_exited(pid_t process)
+	{
+		static const size_t checks = 20;
+
+		for (size_t i = 0; i < checks; ++i)
+		{
+			if (is_gone(process))
+			{
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+		return false;
+	}
+
+	// Waits for the primary to accept, -1 once the primary it followed so far has exited
+	[[nodiscard]] static int connect_to(const std::string &path, pid_t primary)
+	{
+		auto address = address_of(path);
+
+		while (true)
+		{
+			auto connection = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (connection == -1)
+			{
+				return -1;
+			}
+
+			if (connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0)
+			{
+				return connection;
+			}
+			close(connection);
+
+			if (primary != 0 && is_gone(primary))
+			{
+				return -1;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+
+	// Applies what the primary sends until it closes the connection; states newer than a previous
+	// connection left are kept, so a standby copying again can still take over with what it had
+	[[nodiscard]] static status follow_connection(int connection, std::vector<tank_snapshot> &states, bool &synchronized_copy,
+		bool &dropped_standby, uint64_t &applied)
+	{
+		char header[magic.size() + sizeof(uint64_t)];
+		auto size = recv(connection, header, sizeof(header), MSG_WAITALL);
+		if (size == 0)
+		{
+			return status::success;
+		}
+
+		if (size != ssize_t(sizeof(header)) || std::string_view(header, magic.size()) != magic)
+		{
+			return status::read_error;
+		}
+
+		auto count = uint64_t(0);
+		std::memcpy(&count, header + magic.size(), sizeof(count));
+
+		// Revision 0 is older than any state of the primary
+		if (states.size() != count)
+		{
+			states.assign(count, {});
+			for (auto &&state : states)
+			{
+				state.revision = 0;
+			}
+			synchronized_copy = false;
+		}
+
+		auto buffer = std::vector<char>(4096 * sizeof(change));
+		auto changes = std::vector<change>();
+		auto filled = size_t(0);
+		auto applied_changes = uint64_t(0);
+		auto max_lag = std::chrono::nanoseconds::zero();
+		auto reported = clock::now();
+
+		for (ssize_t received; (received = recv(connection, buffer.data() + filled, buffer.size() - filled, 0)) > 0; )
+		{
+			filled += size_t(received);
+
+			auto whole = filled / sizeof(change);
+			changes.resize(whole);
+			std::memcpy(changes.data(), buffer.data(), whole * sizeof(change));
+			std::memmove(buffer.data(), buffer.data() + whole * sizeof(change), filled - whole * sizeof(change));
+			filled -= whole * sizeof(change);
+
+			follow_changes(changes, states, synchronized_copy, dropped_standby, applied, max_lag);
+			applied_changes += whole;
+
+			if (whole != 0 && !write_all(connection, &applied, sizeof(applied)))
+			{
+				break;
+			}
+
+			if (clock::now() - reported >= report_interval)
+			{
+				logging::inflog("replication: " + std::to_string(applied_changes) + " changes applied, lag at most "
+					+ std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(max_lag).count()) + " us");
+				reported = clock::now();
+				applied_changes = 0;
+				max_lag = std::chrono::nanoseconds::zero();
+			}
+		}
+
+		return status::success;
+	}
+
+public:
+	// Called by the fleet after every change, costs an atomic load while no standby is connected
+	static void record(const storage_tank &tank)
+	{
+		if (!connected.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+
+		auto state = tank.snapshot();
+		auto timestamp = now();
+		auto notify = false;
+		auto dropping = false;
+		{
+			auto guard = std::lock_guard(mutex);
+			if (!connected.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			if (pending.size() >= max_pending)
+			{
+				// Whether or not the sender is stuck sending to it, nothing more is kept for the standby
+				connected = false;
+				std::vector<change>().swap(pending);
+				notify = dropping = true;
+			}
+			else
+			{
+				notify = pending.empty();
+				pending.push_back({ ++sequence, timestamp, tank.get_id(), state });
+				recorded.store(sequence, std::memory_order_relaxed);
+			}
+		}
+
+		if (dropping)
+		{
+			logging::warnlog("replication: the standby is too far behind and is dropped");
+		}
+
+		if (notify)
+		{
+			pending_condition.notify_one();
+		}
+	}
+
+	// Listens on the socket for a standby, the tanks must outlive the replication
+	[[nodiscard]] static status start_primary(const std::string &path, const tank_vector &tanks)
+	{
+		auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		auto address = address_of(path);
+		unlink(path.c_str());
+
+		if (listener == -1 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 || listen(listener, 1) == -1)
+		{
+			logging::errlog("unable to listen for a standby on: " + path);
+			if (listener != -1)
+			{
+				close(listener);
+			}
+			return status::failed_initialization;
+		}
+
+		sender = std::jthread([listener, &tanks](std::stop_token stop)
+		{
+			while (!stop.stop_requested())
+			{
+				auto waiting = pollfd{ listener, POLLIN, 0 };
+				if (poll(&waiting, 1, 100) <= 0)
+				{
+					continue;
+				}
+
+				if (auto standby = accept(listener, nullptr, nullptr); standby != -1)
+				{
+					stream(standby, tanks, stop);
+				}
+			}
+
+			close(listener);
+		});
+
+		logging::inflog("replication: waiting for a standby on " + path);
+		return status::success;
+	}
+
+	[[nodiscard]] static statistics get_statistics()
+	{
+		auto guard = std::lock_guard(statistics_mutex);
+		auto result = current;
+		result.recorded = recorded.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	// Runs as the standby of the primary listening on the socket until the primary is gone,
+	// then returns the tanks to take over with
+	[[nodiscard]] static std::pair<std::vector<tank_snapshot>, status> follow(const std::string &path)
+	{
+		auto states = std::vector<tank_snapshot>();
+		auto synchronized_copy = false;
+		auto applied = uint64_t(0);
+		auto primary = pid_t(0);
+
+		logging::inflog("replication: following the primary on " + path);
+		while (true)
+		{
+			auto connection = connect_to(path, primary);
+			if (connection == -1)
+			{
+				break;
+			}
+
+			primary = peer_of(connection);
+			auto dropped_standby = false;
+			auto result = follow_connection(connection, states, synchronized_copy, dropped_standby, applied);
+			close(connection);
+
+			if (st::is_not_success(result))
+			{
+				logging::errlog("not a primary on: " + path);
+				return { {}, status::read_error };
+			}
+
+			if (dropped_standby)
+			{
+				logging::warnlog("replication: dropped by the primary for falling behind, copying every tank again");
+				continue;
+			}
+
+			if (primary == 0 || has_exited(primary))
+			{
+				break;
+			}
+
+			logging::warnlog("replication: the primary closed the connection but is still running, reconnecting");
+		}
+
+		if (!synchronized_copy)
+		{
+			logging::errlog("replication: the primary is gone before every tank was copied");
+			return { {}, status::read_error };
+		}
+
+		logging::warnlog("replication: the primary is gone, taking over at change " + std::to_string(applied));
+		return { std::move(states), status::success };
+	}
+};
+
+#endif // !__REPLICATION_HPP__
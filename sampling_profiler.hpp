@@ -0,0 +1,299 @@
+#ifndef __SAMPLING_PROFILER_HPP__
+#define __SAMPLING_PROFILER_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "status.hpp"
+#include "logging.hpp"
+
+// Samples the stacks of all threads of the process for a while. Every thread gets a timer on its own
+// CPU clock that raises SIGPROF after each interval of CPU time it used, so the samples show where
+// CPU goes and a thread waiting in a system call is never interrupted. The handler walks the frame
+// pointers of the interrupted thread and appends the raw return addresses to a preallocated array
+// through an atomic index; nothing is symbolised in the process. Unwinding by tables is not safe in
+// a signal handler, it takes the loader's lock, so the server is built with frame pointers and a
+// function of a library built without them costs its caller's frame. The profile is written with the
+// executable mappings, profdecode turns it into collapsed stacks. Without a profile running there are
+// no timers and no signals.
+class sampling_profiler
+{
+public:
+	struct result
+	{
+		size_t samples;
+		size_t threads;
+		// Samples that did not fit the buffer
+		size_t dropped;
+	};
+
+private:
+	static const size_t max_depth = 64;
+	// Frames further apart than this are not taken for a stack
+	static const uintptr_t max_frame_size = 1 << 20;
+	// About 8 MB, allocated for the duration of a profile only
+	static const size_t capacity = 16384;
+
+	static constexpr auto interval = std::chrono::microseconds(1000000 / 99);
+
+	struct sample
+	{
+		pid_t thread;
+		uint32_t depth;
+		void *frames[max_depth];
+	};
+
+	struct thread_timer
+	{
+		pid_t thread;
+		timer_t timer;
+	};
+
+	static inline std::atomic<bool> running = false;
+	static inline std::atomic<bool> sampling = false;
+	static inline std::atomic<size_t> in_handler = 0;
+	static inline std::atomic<size_t> next = 0;
+
+	static inline std::unique_ptr<sample[]> samples;
+	static inline std::vector<thread_timer> timers;
+
+	// The saved frame pointer and the return address of a frame. The frame pointer register may hold
+	// anything in a function that does not keep one, so memory is read by a system call that fails on
+	// an address not mapped rather than by a load that would crash the handler
+	[[nodiscard]] static bool read_frame(uintptr_t address, uintptr_t (&frame)[2]) noexcept
+	{
+		auto local = iovec{ frame, sizeof(frame) };
+		auto remote = iovec{ reinterpret_cast<void *>(address), sizeof(frame) };
+		return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == ssize_t(sizeof(frame));
+	}
+
+	// The interrupted address and then the return addresses, innermost first
+	[[nodiscard]] static uint32_t walk(const ucontext_t &context, void **frames) noexcept
+	{
+#if defined(__x86_64__)
+		auto address = uintptr_t(context.uc_mcontext.gregs[REG_RIP]);
+		auto frame_pointer = uintptr_t(context.uc_mcontext.gregs[REG_RBP]);
+#elif defined(__aarch64__)
+		auto address = uintptr_t(context.uc_mcontext.pc);
+		auto frame_pointer = uintptr_t(context.uc_mcontext.regs[29]);
+#else
+#error "the profiler walks frame pointers of x86-64 and AArch64 only"
+#endif
+
+		auto depth = uint32_t(0);
+		frames[depth++] = reinterpret_cast<void *>(address);
+
+		uintptr_t frame[2];
+		while (depth < max_depth && frame_pointer % sizeof(uintptr_t) == 0 && read_frame(frame_pointer, frame) && frame[1] != 0)
+		{
+			frames[depth++] = reinterpret_cast<void *>(frame[1]);
+
+			// Stacks grow down, the caller's frame is above and not far
+			if (frame[0] <= frame_pointer || frame[0] - frame_pointer > max_frame_size)
+			{
+				break;
+			}
+			frame_pointer = frame[0];
+		}
+
+		return depth;
+	}
+
+	static void on_signal(int, siginfo_t *, void *context)
+	{
+		// Sequentially consistent with stop(), which clears the flag and then waits for the handlers inside
+		in_handler.fetch_add(1);
+
+		if (sampling.load())
+		{
+			auto saved_errno = errno;
+			if (auto slot = next.fetch_add(1, std::memory_order_relaxed); slot < capacity)
+			{
+				auto &&taken = samples[slot];
+				taken.thread = pid_t(syscall(SYS_gettid));
+				taken.depth = walk(*static_cast<const ucontext_t *>(context), taken.frames);
+			}
+			errno = saved_errno;
+		}
+
+		in_handler.fetch_sub(1);
+	}
+
+	// The CPU clock of any thread of the process, as the kernel encodes it
+	[[nodiscard]] static clockid_t thread_clock(pid_t thread) noexcept
+	{
+		static const clockid_t per_thread_scheduler_clock = 6;
+		return (~clockid_t(thread) << 3) | per_thread_scheduler_clock;
+	}
+
+	[[nodiscard]] static std::vector<pid_t> threads()
+	{
+		auto found = std::vector<pid_t>();
+		auto error = std::error_code();
+
+		for (auto &&entry : std::filesystem::directory_iterator("/proc/self/task", error))
+		{
+			found.push_back(pid_t(std::stol(entry.path().filename().string())));
+		}
+
+		return found;
+	}
+
+	[[nodiscard]] static std::string thread_name(pid_t thread)
+	{
+		auto name = std::string();
+		std::getline(std::ifstream("/proc/self/task/" + std::to_string(thread) + "/comm"), name);
+		return name.empty() ? "thread" : name;
+	}
+
+	static void stop_timers()
+	{
+		for (auto &&[thread, timer] : timers)
+		{
+			timer_delete(timer);
+		}
+		timers.clear();
+	}
+
+	// Header, executable mappings and threads, then one sample a line: thread and the addresses, innermost first
+	[[nodiscard]] static status write(const std::string &path, const std::vector<pid_t> &profiled, size_t count)
+	{
+		auto file = std::ofstream(path, std::ios::trunc);
+		file << "OILPRF01\n";
+
+		auto maps = std::ifstream("/proc/self/maps");
+		for (auto line = std::string(); std::getline(maps, line); )
+		{
+			// start-end perms offset device inode path
+			char range[64], permissions[8], offset[32], device[16];
+			auto inode = 0ul;
+			auto consumed = 0;
+			if (std::sscanf(line.c_str(), "%63s %7s %31s %15s %lu %n", range, permissions, offset, device, &inode, &consumed) == 5
+				&& permissions[2] == 'x' && line[consumed] == '/')
+			{
+				auto dash = std::strchr(range, '-');
+				*dash = ' ';
+				file << "module " << range << ' ' << offset << ' ' << line.substr(consumed) << '\n';
+			}
+		}
+
+		for (auto thread : profiled)
+		{
+			file << "thread " << thread << ' ' << thread_name(thread) << '\n';
+		}
+
+		char address[24];
+		for (size_t i = 0; i < count; ++i)
+		{
+			file << "sample " << samples[i].thread;
+			for (size_t frame = 0; frame < samples[i].depth; ++frame)
+			{
+				std::snprintf(address, sizeof(address), " %lx", reinterpret_cast<unsigned long>(samples[i].frames[frame]));
+				file << address;
+			}
+			file << '\n';
+		}
+
+		if (!file.flush())
+		{
+			logging::errlog("unable to write the profile: " + path);
+			return status::write_error;
+		}
+
+		return status::success;
+	}
+
+public:
+	// Starts sampling the threads running now, one profile at a time
+	[[nodiscard]] static status start()
+	{
+		if (running.exchange(true))
+		{
+			return status::profiler_busy;
+		}
+
+		static auto installed = []
+		{
+			struct sigaction action = {};
+			action.sa_sigaction = on_signal;
+			action.sa_flags = SA_RESTART | SA_SIGINFO;
+			sigemptyset(&action.sa_mask);
+			return sigaction(SIGPROF, &action, nullptr) == 0;
+		}();
+
+		if (!installed)
+		{
+			running = false;
+			return status::failed_initialization;
+		}
+
+		samples = std::make_unique<sample[]>(capacity);
+		next = 0;
+		sampling.store(true);
+
+		auto period = itimerspec();
+		period.it_interval.tv_nsec = std::chrono::nanoseconds(interval).count();
+		period.it_value = period.it_interval;
+
+		for (auto thread : threads())
+		{
+			auto event = sigevent();
+			event.sigev_notify = SIGEV_THREAD_ID;
+			event.sigev_signo = SIGPROF;
+			// sigev_notify_thread_id, which older C libraries do not define
+			event._sigev_un._tid = thread;
+
+			// A thread that is gone by now is simply not sampled
+			auto timer = timer_t();
+			if (timer_create(thread_clock(thread), &event, &timer) == 0)
+			{
+				timers.push_back({ thread, timer });
+				timer_settime(timer, 0, &period, nullptr);
+			}
+		}
+
+		return status::success;
+	}
+
+	// Stops sampling and writes the profile
+	[[nodiscard]] static std::pair<result, status> stop(const std::string &path)
+	{
+		auto profiled = std::vector<pid_t>();
+		for (auto &&[thread, timer] : timers)
+		{
+			profiled.push_back(thread);
+		}
+		stop_timers();
+
+		// A signal raised before the timers were deleted may still be handled
+		sampling.store(false);
+		while (in_handler.load() != 0)
+		{}
+
+		auto taken = next.load();
+		auto count = std::min(taken, capacity);
+		auto written = write(path, profiled, count);
+
+		samples.reset();
+		running = false;
+		return { { count, profiled.size(), taken - count }, written };
+	}
+};
+
+#endif // !__SAMPLING_PROFILER_HPP__
@@ -0,0 +1,114 @@
+#ifndef __SEQLOCK_HPP__
+#define __SEQLOCK_HPP__
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+// Sequence lock: readers copy the value without any lock and retry if a writer was active meanwhile,
+// writers only ever wait for each other, never for readers
+template <typename T>
+class seqlock
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+
+private:
+	static constexpr size_t words_count = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// Odd while a write is in progress
+	std::atomic<uint64_t> sequence = 0;
+
+	// The value is kept in atomic words so that a concurrent read is a retry, not a data race
+	std::array<std::atomic<uint64_t>, words_count> words;
+
+	static void pause() noexcept
+	{
+	#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+	#endif
+	}
+
+	void store_words(const T &value) noexcept
+	{
+		uint64_t buffer[words_count] = {};
+		std::memcpy(buffer, &value, sizeof(T));
+
+		for (size_t i = 0; i < words_count; ++i)
+		{
+			words[i].store(buffer[i], std::memory_order_relaxed);
+		}
+	}
+
+	[[nodiscard]] T load_words() const noexcept
+	{
+		uint64_t buffer[words_count];
+
+		for (size_t i = 0; i < words_count; ++i)
+		{
+			buffer[i] = words[i].load(std::memory_order_relaxed);
+		}
+
+		T value;
+		std::memcpy(&value, buffer, sizeof(T));
+		return value;
+	}
+
+public:
+	explicit seqlock(const T &value = T()) noexcept
+	{
+		store_words(value);
+	}
+
+	[[nodiscard]] T load() const noexcept
+	{
+		while (true)
+		{
+			auto before = sequence.load(std::memory_order_acquire);
+			if (before & 1)
+			{
+				pause();
+				continue;
+			}
+
+			auto value = load_words();
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence.load(std::memory_order_relaxed) == before)
+			{
+				return value;
+			}
+		}
+	}
+
+	// Applies the modification to the current value and publishes the result, returns the previous value
+	template <typename F>
+	T update(F &&modify) noexcept
+	{
+		auto current = sequence.load(std::memory_order_relaxed);
+		while ((current & 1) || !sequence.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			pause();
+			current = sequence.load(std::memory_order_relaxed);
+		}
+
+		std::atomic_thread_fence(std::memory_order_release);
+
+		auto previous = load_words();
+		auto value = previous;
+		modify(value);
+		store_words(value);
+
+		sequence.store(current + 2, std::memory_order_release);
+		return previous;
+	}
+
+	// Number of completed writes
+	[[nodiscard]] uint64_t version() const noexcept
+	{
+		return sequence.load(std::memory_order_acquire) / 2;
+	}
+};
+
+#endif // !__SEQLOCK_HPP__
@@ -2,15 +2,124 @@
 
 int main(int argc, char **argv)
 {
-	if (argc != 2)
+	// `--capture <file>`, `--binary-log <file>`, `--placement <numa|none>`, `--replicate <socket>`,
+	// `--lease <idle seconds>` and `--export-dir <directory>` may follow any of the forms, in any order
+	auto capture_path = std::string();
+	auto binary_log_path = std::string();
+	auto replication_path = std::string();
+	auto lease_timeout = std::string();
+	auto export_path = std::string();
+	auto placement = placement_policy::none;
+	for (; argc >= 4; argc -= 2)
 	{
-		logging::errlog("you must specify the number of tanks in the arguments");
+		if (auto option = std::string_view(argv[argc - 2]); option == "--capture")
+		{
+			capture_path = argv[argc - 1];
+		}
+		else if (option == "--binary-log")
+		{
+			binary_log_path = argv[argc - 1];
+		}
+		else if (option == "--replicate")
+		{
+			replication_path = argv[argc - 1];
+		}
+		else if (option == "--lease")
+		{
+			lease_timeout = argv[argc - 1];
+		}
+		else if (option == "--export-dir")
+		{
+			export_path = argv[argc - 1];
+		}
+		else if (option == "--placement" && (std::string_view(argv[argc - 1]) == "numa" || std::string_view(argv[argc - 1]) == "none"))
+		{
+			placement = std::string_view(argv[argc - 1]) == "numa" ? placement_policy::numa : placement_policy::none;
+		}
+		else
+		{
+			break;
+		}
+	}
+	
+	// A standby follows the primary on the socket and takes over with its tanks once it is gone
+	auto standby = argc == 3 && std::string_view(argv[1]) == "--standby";
+	auto configured = argc == 3 && std::string_view(argv[1]) == "--config";
+	if (argc != 2 && !configured && !standby)
+	{
+		logging::errlog("you must specify the number of tanks in the arguments (or `--config <file>`, or `--standby <socket>`), optionally followed by "
+			"`--capture <file>`, `--binary-log <file>`, `--placement <numa|none>`, `--replicate <socket>`, `--lease <idle seconds>` and `--export-dir <directory>`");
 		return -1;
 	}
 	
 	try
 	{
-		switch (auto result = server(std::stoull(argv[1])).run())
+		if (!binary_log_path.empty() && st::is_not_success(logging::start_binary_log(binary_log_path)))
+		{
+			logging::errlog("unable to open the binary log: " + binary_log_path);
+			return -1;
+		}
+		
+		if (!capture_path.empty() && st::is_not_success(traffic_capture::start_capture(capture_path)))
+		{
+			return -1;
+		}
+		
+		if (!lease_timeout.empty())
+		{
+			tank_lease::set_idle_timeout(std::chrono::seconds(std::stoull(lease_timeout)));
+		}
+		
+		if (!export_path.empty() && st::is_not_success(export_directory::set(export_path)))
+		{
+			return -1;
+		}
+		
+		auto configuration = std::vector<tank_snapshot>();
+		if (configured)
+		{
+			auto start = std::chrono::steady_clock::now();
+			auto &&[loaded, result] = fleet_config::load(argv[2]);
+			if (st::is_not_success(result))
+			{
+				return -1;
+			}
+			
+			configuration = std::move(loaded);
+			logging::inflog(std::to_string(configuration.size()) + " tanks configured in "
+				+ std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()) + " ms");
+		}
+		
+		auto takeover_start = std::chrono::steady_clock::now();
+		if (standby)
+		{
+			auto &&[replicated, result] = replication::follow(argv[2]);
+			if (st::is_not_success(result))
+			{
+				return -1;
+			}
+			
+			takeover_start = std::chrono::steady_clock::now();
+			configuration = std::move(replicated);
+		}
+		
+		auto serve = [&](server &&instance)
+		{
+			if (standby)
+			{
+				logging::inflog("took over in "
+					+ std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - takeover_start).count()) + " ms");
+			}
+			
+			if (!replication_path.empty() && st::is_not_success(instance.replicate(replication_path)))
+			{
+				return status::failed_initialization;
+			}
+			
+			return instance.run();
+		};
+		
+		switch (auto result = configured || standby ? serve(server(std::move(configuration), placement)) : serve(server(std::stoull(argv[1]), placement)))
 		{
 			case status::failed_initialization:
 			{
@@ -2,23 +2,72 @@
 #define __SERVER_HPP__
 #define _IS_SERVER_
 
-#include <thread>
 #include <random>
+#include <optional>
+#include <functional>
+#include <variant>
+#include <memory_resource>
 
 #include "cli.hpp"
+#include "fleet.hpp"
+#include "executor.hpp"
+#include "command_arena.hpp"
+#include "tracing.hpp"
+#include "tank_lease.hpp"
+#include "rate_limiter.hpp"
+#include "traffic_capture.hpp"
 #include "message_connection.hpp"
 
 class server
 {
 private:
-	std::vector<storage_tank> storage_tanks;
+	fleet storage_tanks;
+	executor session_executor;
+
+	// "retry after 120 ms", rounded up so that a client retrying on time is not refused again
+	[[nodiscard]] static std::pmr::string retry_after(std::chrono::nanoseconds wait, std::pmr::memory_resource *arena)
+	{
+		auto milliseconds = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+		return std::pmr::string(st::response(status::rate_limited), arena).append(" ").append(std::to_string(milliseconds)).append(" ms");
+	}
+
+	void log_placement(placement_policy policy) const
+	{
+		if (policy == placement_policy::numa)
+		{
+			logging::inflog(std::to_string(storage_tanks.size()) + " tanks placed on " + std::to_string(numa_topology::current().nodes_count())
+				+ " NUMA nodes, " + std::string(st::pktos(storage_tanks.get_placement().get_pages())));
+		}
+	}
 
 public:
-	explicit server(size_t number_of_tanks): storage_tanks{ number_of_tanks }
-	{}
+	explicit server(size_t number_of_tanks, placement_policy policy = placement_policy::none):
+		storage_tanks(number_of_tanks, policy), session_executor(std::max(1u, std::thread::hardware_concurrency()), fleet::topology_of(policy))
+	{
+		log_placement(policy);
+		rate_limiter::set_concurrency(session_executor.workers_count());
+		session_executor.spawn(storage_tanks.get_flow().run());
+		session_executor.spawn(traffic_capture::run());
+	}
+
+	// The configuration is only needed to build the fleet
+	explicit server(std::vector<tank_snapshot> configuration, placement_policy policy = placement_policy::none):
+		storage_tanks(configuration, policy), session_executor(std::max(1u, std::thread::hardware_concurrency()), fleet::topology_of(policy))
+	{
+		log_placement(policy);
+		rate_limiter::set_concurrency(session_executor.workers_count());
+		session_executor.spawn(storage_tanks.get_flow().run());
+		session_executor.spawn(traffic_capture::run());
+	}
+
+	// A standby connecting to the socket follows the tanks of this server from then on
+	[[nodiscard]] status replicate(const std::string &path)
+	{
+		return storage_tanks.start_replication(path);
+	}
 
 	template <class T>
-	[[nodiscard]] std::pair<std::optional<session_t>, status> accept()
+	[[nodiscard]] std::pair<std::optional<std::variant<session_t, fleet_session_t>>, status> accept()
 	{
 		auto result = status::success;
 		if (static auto accept_connection = std::make_shared<T>(result); st::is_success(result))
@@ -28,17 +77,35 @@ public:
 			auto storage_tank_id = std::string();
 			if (result = accept_connection->read(storage_tank_id); st::is_success(result))
 			{
+				auto span = tracing::span("handshake", trace_group::server, 0);
+				static auto rand_device = std::random_device();
+				auto session_key = std::default_random_engine(rand_device())();
+				
+				if (storage_tank_id == "fleet")
+				{
+					logging::inflog("a client with a fleet monitoring request has connected");
+					logging::inflog("session key: " + std::to_string(session_key));
+					
+					if (auto new_session = fleet_session_t{ traffic_capture::attach(std::make_shared<T>(result, session_key), storage_tank_id), storage_tanks }; st::is_success(result))
+					{
+						if (result = accept_connection->write(std::to_string(session_key)); st::is_success(result))
+						{
+							return { new_session, status::success };
+						}
+					}
+					
+					return { std::nullopt, result };
+				}
+				
 				logging::inflog("a client with an authorization request has connected to the tank number: " + storage_tank_id);
 				
 				try
 				{
-					static auto rand_device = std::random_device();
 					auto &required_tank = storage_tanks.at(std::stoull(storage_tank_id));
-					auto session_key = std::default_random_engine(rand_device())();
 					
 					logging::inflog("session key: " + std::to_string(session_key));
 					
-					if (auto new_session = session_t{ std::make_shared<T>(result, session_key), required_tank }; st::is_success(result))
+					if (auto new_session = session_t{ traffic_capture::attach(std::make_shared<T>(result, session_key), storage_tank_id), required_tank }; st::is_success(result))
 					{
 						if (result = accept_connection->write(std::to_string(session_key)); st::is_success(result))
 						{
@@ -56,35 +123,179 @@ public:
 		return { std::nullopt, result };
 	}
 
-	void connect_handler(session_t &session)
+	// The time left until the deadline, at most the limit; zero once the deadline has passed
+	[[nodiscard]] static std::chrono::milliseconds time_left(tank_lease::clock::time_point deadline, std::chrono::milliseconds limit)
+	{
+		if (deadline == tank_lease::clock::time_point::max())
+		{
+			return limit;
+		}
+		
+		auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - tank_lease::clock::now());
+		return std::clamp(remaining, std::chrono::milliseconds::zero(), limit);
+	}
+
+	// A session whose client process is gone is kept for the grace period, so that a restarted client
+	// can resume it without a new handshake; status::read_timeout means it was not resumed in time.
+	// status::lease_expired means no command came before the deadline, which the grace period does not
+	// put off: the tank of a crashed client goes to the next session as soon as the lease runs out.
+	// client_gone tells whether the command came in the grace period
+	static task<status> read_command(std::shared_ptr<async_connection_if> connection, std::string &command, bool &client_gone,
+		tank_lease::clock::time_point deadline = tank_lease::clock::time_point::max())
+	{
+		client_gone = false;
+		
+		static const auto liveness_check_interval = std::chrono::seconds(5);
+		static const auto resume_grace_period = std::chrono::seconds(60);
+		
+		while (true)
+		{
+			auto timeout = time_left(deadline, liveness_check_interval);
+			if (timeout == std::chrono::milliseconds::zero())
+			{
+				co_return status::lease_expired;
+			}
+			
+			auto result = co_await connection->async_read(command, timeout);
+			if (result != status::read_timeout)
+			{
+				co_return result;
+			}
+			
+			if (connection->peer_alive())
+			{
+				continue;
+			}
+			
+			logging::warnlog("the client is gone, the session is kept for resumption");
+			client_gone = true;
+			
+			auto grace_end = tank_lease::clock::now() + resume_grace_period;
+			if (result = co_await connection->async_read(command, time_left(std::min(deadline, grace_end), resume_grace_period)); result != status::read_timeout)
+			{
+				co_return result;
+			}
+			
+			if (deadline < grace_end)
+			{
+				co_return status::lease_expired;
+			}
+			
+			logging::warnlog("the session was not resumed in time and is closed");
+			co_return result;
+		}
+	}
+
+	task<void> connect_handler(session_t session)
 	{
 		logging::inflog("waiting for an existing session to be released");
 		
 		auto client_command = std::string();
 		auto &&[current_session, current_tank] = session;
-		auto guard = std::lock_guard(current_tank._get_sync_object());
+		auto limits = rate_limiter::session();
+		auto lease = tank_lease(current_tank);
+		auto lock_wait = tracing::span("tank lock wait", trace_group::sessions, current_session->session_key());
+		co_await lease.acquire();
+		lock_wait.finish();
 		
-		if (auto result = current_session->write("-- accepted --"); st::is_not_success(result))
+		// Anyone may write to the session queue, resuming the session takes the token it was accepted with
+		// and the number of times it has been resumed, so a stale session file cannot take it over again.
+		// Responses carry no number: the ones a crashed client missed are still in the session queue
+		// and the resuming client takes them from there, so there is no position to agree on
+		auto resume_token = (uint64_t(std::random_device()()) << 32) | std::random_device()();
+		auto resumptions = uint64_t(0);
+		// The process that sent the latest command; before the first one, the process that read the acceptance
+		auto client_process = uint64_t(0);
+		auto client_gone = false;
+		
+		if (auto result = co_await current_session->async_write("-- accepted -- " + std::to_string(resume_token)); st::is_not_success(result))
 		{
 			logging::errlog("sending a customer acceptance message");
-			return;
+			co_return;
 		}
 		
-		logging::inflog("session permission message sent");
+		logging::inflog<"tank {}: session permission message sent">(log_tank{ current_tank.get_id() });
 		
 		while (true)
 		{
-			logging::inflog("waiting for client command");
+			logging::inflog<"tank {}: waiting for client command">(log_tank{ current_tank.get_id() });
 			
-			if (auto result = current_session->read(client_command); st::is_not_success(result))
+			if (auto result = co_await read_command(current_session, client_command, client_gone, lease.expires_at()); result == status::lease_expired)
+			{
+				// The next waiting session gets the tank now, this one only reads until it finds the tank free
+				lease.expire();
+				logging::warnlog<"tank {}: idle session is read-only, the tank is given up">(log_tank{ current_tank.get_id() });
+				continue;
+			}
+			else if (st::is_not_success(result))
 			{
-				logging::errlog("receiving a command from the client");
+				if (result != status::read_timeout)
+				{
+					logging::errlog("receiving a command from the client");
+				}
 				break;
 			}
-
-			logging::inflog("command processing: " + client_command);
 			
-			switch (auto result_handling = cli::handling(client_command, session))
+			if (client_command.starts_with("resume "))
+			{
+				// Only a session whose client is gone is resumed, nobody else gets an answer: the client
+				// still attached would take it for the answer to its next command
+				auto attached = client_process != 0 ? client_process : current_session->reader_process();
+				if (!client_gone && (attached == 0 || message_connection::process_alive(pid_t(attached))))
+				{
+					logging::warnlog<"tank {}: ignored a resume while the client is attached">(log_tank{ current_tank.get_id() });
+					continue;
+				}
+				
+				if (client_command != "resume " + std::to_string(resume_token) + ' ' + std::to_string(resumptions))
+				{
+					logging::warnlog<"tank {}: refused to resume the session">(log_tank{ current_tank.get_id() });
+					
+					if (auto result = co_await current_session->async_write(st::response(status::resume_refused)); st::is_not_success(result))
+					{
+						logging::errlog("write error");
+						co_return;
+					}
+					continue;
+				}
+				++resumptions;
+			}
+			client_process = current_session->peer_process();
+			
+			// Whatever the command allocates is dropped at once when it is answered
+			auto arena = command_arena();
+			auto command = cli::parse(client_command, session, arena.get());
+			
+			// Any command renews a held lease, a read-only session takes the tank back only to change it
+			if ((lease.held() || command.kind() != command_kind::read) && !lease.renew())
+			{
+				if (auto result = co_await current_session->async_write(st::response(status::lease_expired)); st::is_not_success(result))
+				{
+					logging::errlog("write error");
+					co_return;
+				}
+				continue;
+			}
+			
+			// A throttled command is answered without being logged or run, a disconnect is never held back
+			auto exempt = client_command == "disconnect";
+			limits.identify(*current_session);
+			if (auto wait = exempt ? std::chrono::nanoseconds::zero() : limits.admit(); wait != std::chrono::nanoseconds::zero())
+			{
+				if (auto result = co_await current_session->async_write(retry_after(wait, arena.get())); st::is_not_success(result))
+				{
+					logging::errlog("write error");
+					co_return;
+				}
+				continue;
+			}
+			
+			// A transfer gives its turn up while the product moves
+			auto turn = co_await limits.take_turn(exempt);
+			auto processing = tracing::span("command", trace_group::sessions, current_session->session_key());
+			logging::inflog<"tank {}: command processing: {}">(log_tank{ current_tank.get_id() }, client_command);
+			
+			switch (auto result_handling = co_await cli::handling(command, session, turn))
 			{
 				case status::success:
 				{
@@ -95,10 +306,10 @@ public:
 				{
 					logging::warnlog("no handler found for client command");
 					
-					if (auto result = current_session->write("unknow command"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::cli_handler_not_found)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
 					}
 					break;
 				}
@@ -107,10 +318,10 @@ public:
 				{
 					logging::warnlog("it is not possible to unload, the corresponding pump is inactive");
 					
-					if (auto result = current_session->write("loading pump not active"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::loading_pump_not_active)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
 					}
 					break;
 				}
@@ -119,10 +330,10 @@ public:
 				{
 					logging::warnlog("unable to load, the corresponding pump is inactive");
 					
-					if (auto result = current_session->write("unloading pump not active"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::unloading_pump_not_active)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
 					}
 					break;
 				}
@@ -131,10 +342,10 @@ public:
 				{
 					logging::warnlog("storage tank non working");
 					
-					if (auto result = current_session->write("oil tank not working"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::storage_tank_non_working)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
 					}
 					break;
 				}
@@ -143,10 +354,10 @@ public:
 				{
 					logging::warnlog("critically low level of oil products");
 					
-					if (auto result = current_session->write("too low level of oil in the tank, it is impossible to download"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::low_level_of_oil_products)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
 					}
 					break;
 				}
@@ -155,18 +366,54 @@ public:
 				{
 					logging::warnlog("critically high level of oil products");
 					
-					if (auto result = current_session->write("too high level of oil in the tank, it is impossible to unload"); st::is_not_success(result))
+					if (auto result = co_await current_session->async_write(st::response(status::high_level_of_oil_products)); st::is_not_success(result))
+					{
+						logging::errlog("write error");
+						co_return;
+					}
+					break;
+				}
+				
+				case status::too_many_rules:
+				{
+					logging::warnlog("the tank has reached the limit of automation rules");
+					
+					if (auto result = co_await current_session->async_write(st::response(status::too_many_rules)); st::is_not_success(result))
 					{
 						logging::errlog("write error");
-						return;
+						co_return;
+					}
+					break;
+				}
+				
+				case status::product_mismatch:
+				{
+					logging::warnlog("the operation is for another product grade than the tank holds");
+					
+					if (auto result = co_await current_session->async_write(st::response(status::product_mismatch)); st::is_not_success(result))
+					{
+						logging::errlog("write error");
+						co_return;
+					}
+					break;
+				}
+				
+				case status::tank_not_empty:
+				{
+					logging::warnlog("the product grade of a tank holding product cannot be changed");
+					
+					if (auto result = co_await current_session->async_write(st::response(status::tank_not_empty)); st::is_not_success(result))
+					{
+						logging::errlog("write error");
+						co_return;
 					}
 					break;
 				}
 				
 				case status::disconnect:
 				{
-					logging::inflog("client disconnected");
-					return;
+					logging::inflog<"tank {}: client disconnected">(log_tank{ current_tank.get_id() });
+					co_return;
 				}
 				
 				default:
@@ -178,6 +425,85 @@ public:
 		}
 	}
 
+	task<void> connect_handler(fleet_session_t session)
+	{
+		auto client_command = std::string();
+		auto &&[current_session, tanks] = session;
+		auto limits = rate_limiter::session();
+		
+		if (auto result = co_await current_session->async_write("-- accepted --"); st::is_not_success(result))
+		{
+			logging::errlog("sending a customer acceptance message");
+			co_return;
+		}
+		
+		logging::inflog("fleet session permission message sent");
+		
+		while (true)
+		{
+			auto client_gone = false;
+			if (auto result = co_await read_command(current_session, client_command, client_gone); st::is_not_success(result))
+			{
+				if (result != status::read_timeout)
+				{
+					logging::errlog("receiving a command from the client");
+				}
+				break;
+			}
+			
+			auto arena = command_arena();
+			
+			// The limits are adjusted from a fleet session, so those commands are never held back
+			auto exempt = client_command == "disconnect" || client_command.starts_with("rate ");
+			limits.identify(*current_session);
+			if (auto wait = exempt ? std::chrono::nanoseconds::zero() : limits.admit(); wait != std::chrono::nanoseconds::zero())
+			{
+				if (auto result = co_await current_session->async_write(retry_after(wait, arena.get())); st::is_not_success(result))
+				{
+					logging::errlog("write error");
+					co_return;
+				}
+				continue;
+			}
+			
+			auto turn = co_await limits.take_turn(exempt);
+			auto processing = tracing::span("command", trace_group::sessions, current_session->session_key());
+			auto command = cli::parse(client_command, session, arena.get());
+			
+			switch (auto result_handling = co_await cli::handling(command, session, turn))
+			{
+				case status::success:
+				{
+					break;
+				}
+				
+				case status::cli_handler_not_found:
+				{
+					logging::warnlog("no handler found for client command");
+					
+					if (auto result = co_await current_session->async_write(st::response(status::cli_handler_not_found)); st::is_not_success(result))
+					{
+						logging::errlog("write error");
+						co_return;
+					}
+					break;
+				}
+				
+				case status::disconnect:
+				{
+					logging::inflog("fleet client disconnected");
+					co_return;
+				}
+				
+				default:
+				{
+					logging::warnlog("unhandled error: " + std::to_string((int)result_handling));
+					co_return;
+				}
+			}
+		}
+	}
+
 	status run()
 	{
 		while (true)
@@ -185,10 +511,18 @@ public:
 			// cppcheck-suppress cppcheckError
 			if (auto &&[session, result] = accept<message_connection>(); st::is_success(result))
 			{
-				auto bind_connect_handler = std::bind(&server::connect_handler, this, session.value());
-				auto thread_handler = std::thread(bind_connect_handler);
-
-				thread_handler.detach();
+				// A tank session is served by the workers of the node holding the tank
+				std::visit([this](auto &accepted_session)
+				{
+					if constexpr (std::is_same_v<std::decay_t<decltype(accepted_session)>, session_t>)
+					{
+						session_executor.spawn(connect_handler(accepted_session), storage_tanks.node_of(accepted_session.second.get_id()));
+					}
+					else
+					{
+						session_executor.spawn(connect_handler(accepted_session));
+					}
+				}, session.value());
 			}
 			else return result;
 		}
@@ -0,0 +1,166 @@
+#ifndef __SNAPSHOT_EPOCHS_HPP__
+#define __SNAPSHOT_EPOCHS_HPP__
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <utility>
+#include <unordered_map>
+
+#include "seqlock.hpp"
+
+// Point-in-time images of many seqlock-published values taken while writers keep changing them.
+// A snapshot opens an epoch; the first write to a value during the epoch keeps a copy of the value
+// as it was before, unless the snapshot has already read it. The snapshot reads a value once: its
+// kept copy if there is one, otherwise the current value. Writers never wait for the snapshot and
+// the extra memory is one copy per value written before the snapshot got to it, freed as it is read.
+template <typename T>
+class snapshot_epochs
+{
+private:
+	// Odd while a snapshot is open, its value is then the epoch of the snapshot
+	std::atomic<uint64_t> phase = 0;
+	// Writes in progress that started in an even or in an odd phase
+	std::atomic<uint64_t> writers[2] = { 0, 0 };
+
+	// One snapshot at a time
+	std::mutex snapshot_mutex;
+
+	std::mutex preserved_mutex;
+	std::unordered_map<uint64_t, T> preserved;
+	uint64_t preserved_total = 0;
+
+	// Until the writes that started in the given phase are done; they are a store or two long
+	void wait_writers(uint64_t previous_phase) const noexcept
+	{
+		while (writers[previous_phase & 1].load(std::memory_order_acquire) != 0)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+public:
+	struct statistics
+	{
+		// Values read by the snapshot and how many of them were kept copies
+		uint64_t read;
+		uint64_t preserved;
+	};
+
+	// Open from construction to destruction
+	class snapshot
+	{
+	private:
+		snapshot_epochs *owner;
+		std::unique_lock<std::mutex> exclusive;
+		uint64_t epoch;
+
+		friend class snapshot_epochs;
+
+		std::atomic<uint64_t> read = 0;
+
+	public:
+		explicit snapshot(snapshot_epochs &epochs): owner(&epochs), exclusive(epochs.snapshot_mutex)
+		{
+			epoch = owner->phase.fetch_add(1, std::memory_order_acq_rel) + 1;
+			owner->wait_writers(epoch - 1);
+		}
+
+		snapshot(const snapshot &) = delete;
+		snapshot &operator=(const snapshot &) = delete;
+
+		~snapshot()
+		{
+			owner->phase.fetch_add(1, std::memory_order_acq_rel);
+			owner->wait_writers(epoch);
+
+			auto guard = std::lock_guard(owner->preserved_mutex);
+			owner->preserved.clear();
+			owner->preserved_total = 0;
+		}
+
+		// The value as it was when the snapshot was opened, each value is read once.
+		// `read_epoch` is the epoch of the value's last kept or read state, kept next to the value
+		[[nodiscard]] T read_value(uint64_t key, std::atomic<uint64_t> &read_epoch, const seqlock<T> &value)
+		{
+			read.fetch_add(1, std::memory_order_relaxed);
+
+			auto current = value.load();
+			auto last = read_epoch.load(std::memory_order_acquire);
+			if (last < epoch && read_epoch.compare_exchange_strong(last, epoch, std::memory_order_acq_rel))
+			{
+				return current;
+			}
+
+			// A writer got there first and is keeping the copy under the mutex
+			auto guard = std::lock_guard(owner->preserved_mutex);
+			auto found = owner->preserved.find(key);
+			auto kept = found->second;
+			owner->preserved.erase(found);
+			return kept;
+		}
+
+		[[nodiscard]] statistics get_statistics() const
+		{
+			auto guard = std::lock_guard(owner->preserved_mutex);
+			return { read.load(std::memory_order_relaxed), owner->preserved_total };
+		}
+	};
+
+	// Held around the publication of a write
+	class writer
+	{
+	private:
+		snapshot_epochs *owner;
+		uint64_t entered = 0;
+
+	public:
+		writer(snapshot_epochs *epochs, uint64_t key, std::atomic<uint64_t> &read_epoch, const seqlock<T> &value): owner(epochs)
+		{
+			if (!owner)
+			{
+				return;
+			}
+
+			// Counted in the phase it sees, so that opening or closing a snapshot can wait for the writes of the phase before
+			while (true)
+			{
+				entered = owner->phase.load(std::memory_order_acquire);
+				owner->writers[entered & 1].fetch_add(1, std::memory_order_acq_rel);
+				if (owner->phase.load(std::memory_order_acquire) == entered)
+				{
+					break;
+				}
+				owner->writers[entered & 1].fetch_sub(1, std::memory_order_release);
+			}
+
+			if ((entered & 1) == 0 || read_epoch.load(std::memory_order_acquire) >= entered)
+			{
+				return;
+			}
+
+			// The first write of the epoch keeps the state the snapshot has not read yet
+			auto guard = std::lock_guard(owner->preserved_mutex);
+			auto last = read_epoch.load(std::memory_order_acquire);
+			if (last < entered && read_epoch.compare_exchange_strong(last, entered, std::memory_order_acq_rel))
+			{
+				owner->preserved.emplace(key, value.load());
+				++owner->preserved_total;
+			}
+		}
+
+		writer(const writer &) = delete;
+		writer &operator=(const writer &) = delete;
+
+		~writer()
+		{
+			if (owner)
+			{
+				owner->writers[entered & 1].fetch_sub(1, std::memory_order_release);
+			}
+		}
+	};
+};
+
+#endif // !__SNAPSHOT_EPOCHS_HPP__
@@ -1,6 +1,8 @@
 #ifndef __STATUS_HPP__
 #define __STATUS_HPP__
 
+#include <string_view>
+
 enum class status
 {
 	success,
@@ -15,7 +17,17 @@ enum class status
 	read_error,
 	write_error,
 	failed_accepted,
+	too_many_rules,
+	incorrect_configuration,
+	read_timeout,
 	disconnect,
+	rate_limited,
+	lease_expired,
+	profiler_busy,
+	product_mismatch,
+	incorrect_file_name,
+	tank_not_empty,
+	resume_refused,
 };
 
 namespace st
@@ -29,6 +41,71 @@ namespace st
 	{
 		return !is_success(st);
 	}
+
+	// Text the server sends back to the client for the statuses of a command
+	[[nodiscard]] std::string_view response(status st)
+	{
+		switch (st)
+		{
+			case status::success: return "success";
+			case status::cli_handler_not_found: return "unknow command";
+			case status::loading_pump_not_active: return "loading pump not active";
+			case status::unloading_pump_not_active: return "unloading pump not active";
+			case status::storage_tank_non_working: return "oil tank not working";
+			case status::low_level_of_oil_products: return "too low level of oil in the tank, it is impossible to download";
+			case status::high_level_of_oil_products: return "too high level of oil in the tank, it is impossible to unload";
+			case status::incorrect_tank_id: return "incorrect tank list";
+			case status::too_many_rules: return "too many rules for the tank";
+			case status::incorrect_configuration: return "incorrect fleet configuration";
+			// Followed by the time to wait: "retry after 120 ms"
+			case status::rate_limited: return "retry after";
+			case status::lease_expired: return "the tank is leased to another session";
+			case status::profiler_busy: return "a profile is already running";
+			case status::product_mismatch: return "the tank holds another product grade";
+			case status::incorrect_file_name: return "only a file name in the export directory is accepted";
+			case status::tank_not_empty: return "the tank still holds product, it must be emptied first";
+			case status::resume_refused: return "the session is not resumed, the token or the number of times it was resumed does not match";
+			default: return "internal error";
+		}
+	}
+
+	// Every response that is not an error message is a result of a successful command
+	[[nodiscard]] status from_response(std::string_view message)
+	{
+		if (message.starts_with(response(status::rate_limited)))
+		{
+			return status::rate_limited;
+		}
+
+		static const status errors[] =
+		{
+			status::cli_handler_not_found,
+			status::loading_pump_not_active,
+			status::unloading_pump_not_active,
+			status::storage_tank_non_working,
+			status::low_level_of_oil_products,
+			status::high_level_of_oil_products,
+			status::incorrect_tank_id,
+			status::too_many_rules,
+			status::incorrect_configuration,
+			status::lease_expired,
+			status::profiler_busy,
+			status::product_mismatch,
+			status::incorrect_file_name,
+			status::tank_not_empty,
+			status::resume_refused,
+		};
+
+		for (auto error : errors)
+		{
+			if (message == response(error))
+			{
+				return error;
+			}
+		}
+
+		return status::success;
+	}
 }
 
 #endif // !__STATUS_HPP__
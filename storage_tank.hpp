@@ -1,9 +1,21 @@
 #ifndef __STORAGE_TANK_HPP__
 #define __STORAGE_TANK_HPP__
 
+
+#include <array>
+#include <vector>
+#include <functional>
+#include <memory_resource>
+
 #include "status.hpp"
+#include "seqlock.hpp"
+#include "snapshot_epochs.hpp"
+#include "instrumented_mutex.hpp"
 #include "logging.hpp"
+#include "tracing.hpp"
 #include "oil_product.hpp"
+#include "trigger_table.hpp"
+#include "tank_observer_if.hpp"
 
 enum class working_state
 {
@@ -40,9 +52,26 @@ namespace st
 	}
 };
 
-class storage_tank
+// Fields that are changed together share a version
+enum class field_group
 {
-private:
+	state,
+	limits,
+	speeds,
+	level,
+	product
+};
+
+static const size_t field_groups_count = 5;
+
+// Tank state at a single point in time
+struct tank_snapshot
+{
+	// Bumped on every change, a group remembers the revision of its last change.
+	// Numbering starts at 1, so that a client knowing nothing asks for changes since 0
+	uint64_t revision = 1;
+	std::array<uint64_t, field_groups_count> changed_at = { 1, 1, 1, 1, 1 };
+
 	working_state work_state = working_state::non_work;
 
 	activity_state loading_pump_status = activity_state::inactive;
@@ -56,209 +85,412 @@ private:
 
 	uint64_t level_of_oil_products = lower_permissible_level;
 
-	std::mutex _mutex;
+	product_grade grade = product_grade::crude;
+
+	[[nodiscard]] bool changed_since(field_group group, uint64_t version) const noexcept
+	{
+		return changed_at[size_t(group)] > version;
+	}
+};
+
+using tank_epochs = snapshot_epochs<tank_snapshot>;
+
+class storage_tank
+{
+private:
+	// Published through a sequence lock: any thread reads a consistent state without taking a lock
+	seqlock<tank_snapshot> state;
+
+	uint64_t id = 0;
+	trigger_table triggers;
+
+	instrumented_mutex _mutex;
+
+	tank_observer_if *observer = nullptr;
+
+	// Online snapshots of the fleet, and the epoch of the last one that has this tank's state
+	tank_epochs *epochs = nullptr;
+	std::atomic<uint64_t> read_epoch = 0;
+
+	void notify()
+	{
+		if (observer)
+		{
+			observer->state_changed(*this);
+		}
+	}
+
+	// Applies a change of one field group and publishes it, returns the state before the change
+	template <typename F>
+	tank_snapshot change(field_group group, F &&modify)
+	{
+		auto previous = tank_snapshot();
+		{
+			auto writing = tank_epochs::writer(epochs, id, read_epoch, state);
+			previous = state.update([group, &modify](tank_snapshot &tank)
+			{
+				modify(tank);
+				tank.changed_at[size_t(group)] = ++tank.revision;
+			});
+		}
+		notify();
+
+		return previous;
+	}
+
+	// Every level change goes through here so that automation rules are evaluated incrementally.
+	// The new level is computed from the current one within the update, returns it
+	template <typename F>
+	uint64_t change_level_with(F &&level_of)
+	{
+		auto level = uint64_t(0);
+		auto old_level = change(field_group::level, [&level, &level_of](tank_snapshot &tank)
+		{
+			tank.level_of_oil_products = level = level_of(tank.level_of_oil_products);
+		}).level_of_oil_products;
+		
+		triggers.fire(old_level, level, [this](const trigger_table::trigger &rule)
+		{
+			switch (rule.action)
+			{
+				case trigger_action::activate_loading_pump:
+				{
+					set_loading_pump_status(activity_state::active);
+					logging::inflog<"tank {}: level {} {}, load pump active">(log_tank{ id }, st::tctos(rule.condition), rule.threshold);
+					break;
+				}
+
+				case trigger_action::deactivate_loading_pump:
+				{
+					set_loading_pump_status(activity_state::inactive);
+					logging::inflog<"tank {}: level {} {}, load pump inactive">(log_tank{ id }, st::tctos(rule.condition), rule.threshold);
+					break;
+				}
+
+				case trigger_action::activate_unloading_pump:
+				{
+					set_unloading_pump_status(activity_state::active);
+					logging::inflog<"tank {}: level {} {}, unloading pump active">(log_tank{ id }, st::tctos(rule.condition), rule.threshold);
+					break;
+				}
+
+				case trigger_action::deactivate_unloading_pump:
+				{
+					set_unloading_pump_status(activity_state::inactive);
+					logging::inflog<"tank {}: level {} {}, unloading pump inactive">(log_tank{ id }, st::tctos(rule.condition), rule.threshold);
+					break;
+				}
+
+				case trigger_action::alert:
+				{
+					// Reporting is a background job, the tank change does not wait for the log
+					auto report = [id = id, condition = rule.condition, threshold = rule.threshold]
+					{
+						logging::warnlog<"tank {}: level {} {}">(log_tank{ id }, st::tctos(condition), threshold);
+					};
+					
+					if (auto scheduler = executor::current())
+					{
+						scheduler->post(report);
+					}
+					else
+					{
+						report();
+					}
+					break;
+				}
+			}
+		});
+
+		return level;
+	}
+
+	void change_level(uint64_t level)
+	{
+		change_level_with([level](uint64_t) { return level; });
+	}
 
 public:
-	void set_download_speed(uint64_t speed) noexcept
+	void set_download_speed(uint64_t speed)
 	{
-		download_speed = speed;
+		change(field_group::speeds, [speed](tank_snapshot &tank) { tank.download_speed = speed; });
 	}
 
-	void set_unloading_speed(uint64_t speed) noexcept
+	void set_unloading_speed(uint64_t speed)
 	{
-		unloading_speed = speed;
+		change(field_group::speeds, [speed](tank_snapshot &tank) { tank.unloading_speed = speed; });
 	}
 
-	void set_lower_permissible_level(uint64_t level) noexcept
+	void set_lower_permissible_level(uint64_t level)
 	{
-		lower_permissible_level = level;
+		change(field_group::limits, [level](tank_snapshot &tank) { tank.lower_permissible_level = level; });
 	}
 
-	void set_upper_acceptable_level(uint64_t level) noexcept
+	void set_upper_acceptable_level(uint64_t level)
 	{
-		upper_acceptable_level = level;
+		change(field_group::limits, [level](tank_snapshot &tank) { tank.upper_acceptable_level = level; });
 	}
 
-	void set_level_of_oil_products(uint64_t level) noexcept
+	void set_level_of_oil_products(uint64_t level)
 	{
-		level_of_oil_products = level;
+		change_level(level);
 	}
 	
-	void set_working_state(working_state state) noexcept
+	void set_working_state(working_state work_state)
+	{
+		change(field_group::state, [work_state](tank_snapshot &tank) { tank.work_state = work_state; });
+	}
+
+	void set_loading_pump_status(activity_state status)
 	{
-		work_state = state;
+		change(field_group::state, [status](tank_snapshot &tank) { tank.loading_pump_status = status; });
 	}
 
-	void set_loading_pump_status(activity_state status) noexcept
+	void set_unloading_pump_status(activity_state status)
 	{
-		loading_pump_status = status;
+		change(field_group::state, [status](tank_snapshot &tank) { tank.unloading_pump_status = status; });
 	}
 
-	void set_unloading_pump_status(activity_state status) noexcept
+	// Relabelling a tank that holds product would move its volume to another grade, so only a tank
+	// emptied down to its lower permissible level takes another grade
+	[[nodiscard]] status set_product_grade(product_grade grade)
 	{
-		unloading_pump_status = status;
+		if (auto tank = state.load(); tank.grade != grade && tank.level_of_oil_products > tank.lower_permissible_level)
+		{
+			return status::tank_not_empty;
+		}
+
+		change(field_group::product, [grade](tank_snapshot &tank) { tank.grade = grade; });
+		return status::success;
 	}
 
 	[[nodiscard]] uint64_t get_download_speed() const noexcept
 	{
-		return download_speed;
+		return state.load().download_speed;
 	}
 
 	[[nodiscard]] uint64_t get_unloading_speed() const noexcept
 	{
-		return unloading_speed;
+		return state.load().unloading_speed;
 	}
 
 	[[nodiscard]] uint64_t get_lower_permissible_level() const noexcept
 	{
-		return lower_permissible_level;
+		return state.load().lower_permissible_level;
 	}
 
 	[[nodiscard]] uint64_t get_upper_acceptable_level() const noexcept
 	{
-		return upper_acceptable_level;
+		return state.load().upper_acceptable_level;
 	}
 
 	[[nodiscard]] uint64_t get_level_of_oil_products() const noexcept
 	{
-		return level_of_oil_products;
+		return state.load().level_of_oil_products;
 	}
 	
 	[[nodiscard]] working_state get_working_state() const noexcept
 	{
-		return work_state;
+		return state.load().work_state;
 	}
 
 	[[nodiscard]] activity_state get_loading_pump_status() const noexcept
 	{
-		return loading_pump_status;
+		return state.load().loading_pump_status;
 	}
 
 	[[nodiscard]] activity_state get_unloading_pump_status() const noexcept
 	{
-		return unloading_pump_status;
+		return state.load().unloading_pump_status;
 	}
 
-	[[nodiscard]] std::mutex &_get_sync_object()
+	[[nodiscard]] product_grade get_product_grade() const noexcept
+	{
+		return state.load().grade;
+	}
+
+	[[nodiscard]] tank_snapshot snapshot() const noexcept
+	{
+		return state.load();
+	}
+
+	// The state when the online snapshot was opened, read once per snapshot
+	[[nodiscard]] tank_snapshot snapshot(tank_epochs::snapshot &fleet_snapshot)
+	{
+		return fleet_snapshot.read_value(id, read_epoch, state);
+	}
+
+	// Replaces the whole state without notifying anybody, for a tank that is not observed yet
+	void restore(const tank_snapshot &tank) noexcept
+	{
+		state.update([&tank](tank_snapshot &current) { current = tank; });
+	}
+
+	void set_id(uint64_t tank_id) noexcept
+	{
+		id = tank_id;
+	}
+
+	void set_observer(tank_observer_if *tank_observer) noexcept
+	{
+		observer = tank_observer;
+	}
+
+	void set_epochs(tank_epochs *fleet_epochs) noexcept
+	{
+		epochs = fleet_epochs;
+	}
+
+	[[nodiscard]] uint64_t get_id() const noexcept
+	{
+		return id;
+	}
+
+	// Rules are changed by the session owning the tank, under the tank mutex
+	[[nodiscard]] trigger_table &get_triggers() noexcept
+	{
+		return triggers;
+	}
+
+	[[nodiscard]] instrumented_mutex &_get_sync_object()
 	{
 		return _mutex;
 	}
 
-	status download(oil_product &op)
+	// How a transfer waits for the product to move, a session lets the other commands run meanwhile
+	using transfer_wait = std::function<task<void>(std::chrono::seconds)>;
+
+	[[nodiscard]] static task<void> sleep(std::chrono::seconds duration)
+	{
+		co_await executor::sleep_for(duration);
+	}
+
+	task<status> download(oil_product &op, transfer_wait wait = sleep)
 	{
-		if (work_state == working_state::non_work)
+		auto span = tracing::span("download", trace_group::tanks, id);
+		auto tank = state.load();
+		
+		if (tank.work_state == working_state::non_work)
+		{
+			co_return status::storage_tank_non_working;
+		}
+
+		if (tank.loading_pump_status == activity_state::inactive)
 		{
-			return status::storage_tank_non_working;
+			co_return status::loading_pump_not_active;
 		}
 
-		if (loading_pump_status == activity_state::inactive)
+		if (op.get_grade() != tank.grade)
 		{
-			return status::loading_pump_not_active;
+			co_return status::product_mismatch;
 		}
 
-		logging::inflog("== download request ==");
+		logging::inflog<"tank {}: == download request ==">(log_tank{ id });
 
 		auto required_download_size = op.get_capacity() - op.get_content_volume();
-		auto possible_loading_volume = level_of_oil_products - lower_permissible_level;
+		auto possible_loading_volume = tank.level_of_oil_products - tank.lower_permissible_level;
 		auto total_download_volume = std::min(required_download_size, possible_loading_volume);
 
-		logging::inflog("required download size: " + std::to_string(required_download_size));
-		logging::inflog("possible loading volume: " + std::to_string(possible_loading_volume));
-		logging::inflog("total download volume: " + std::to_string(total_download_volume));
+		logging::inflog<"tank {}: required download size: {}">(log_tank{ id }, required_download_size);
+		logging::inflog<"tank {}: possible loading volume: {}">(log_tank{ id }, possible_loading_volume);
+		logging::inflog<"tank {}: total download volume: {}">(log_tank{ id }, total_download_volume);
 
 		if (total_download_volume == 0)
 		{
-			return status::low_level_of_oil_products;
+			co_return status::low_level_of_oil_products;
 		}
 
-		auto loading_time = total_download_volume / download_speed;
-
-		logging::inflog("loading time: ");
-
-		// Simulation of system operation
-		std::this_thread::sleep_for(std::chrono::seconds(loading_time));
+		auto loading_time = total_download_volume / tank.download_speed;
 
-		level_of_oil_products -= total_download_volume;
+		logging::inflog<"tank {}: loading time: {}">(log_tank{ id }, loading_time);
 
-		logging::inflog("level of oil products: ");
+		// Simulation of system operation, the session is suspended meanwhile
+		auto simulation = tracing::span("simulation", trace_group::tanks, id);
+		co_await wait(std::chrono::seconds(loading_time));
+		simulation.finish();
 
-		if (level_of_oil_products == lower_permissible_level)
+		// Relative to the level at the end, the level may have been changed while the transfer ran
+		auto level = change_level_with([total_download_volume](uint64_t current)
 		{
-			loading_pump_status = activity_state::inactive;
+			return current > total_download_volume ? current - total_download_volume : 0;
+		});
 
-			logging::inflog("load pump inactive");
-		}
+		logging::inflog<"tank {}: level of oil products: {}">(log_tank{ id }, level);
 
-		/*if (unloading_pump_status == activity_state::inactive &&
-			level_of_oil_products < upper_acceptable_level)
+		if (level <= tank.lower_permissible_level)
 		{
-			unloading_pump_status = activity_state::active;
+			set_loading_pump_status(activity_state::inactive);
 
-			logging::inflog("unloading pump active");
-		}*/
+			logging::inflog<"tank {}: load pump inactive">(log_tank{ id });
+		}
 
 		op.set_content_volume(op.get_content_volume() + total_download_volume);
 
-		return status::success;
+		co_return status::success;
 	}
 
-	status unload(oil_product &op)
+	task<status> unload(oil_product &op, transfer_wait wait = sleep)
 	{
-		if (work_state == working_state::non_work)
+		auto span = tracing::span("unload", trace_group::tanks, id);
+		auto tank = state.load();
+		
+		if (tank.work_state == working_state::non_work)
+		{
+			co_return status::storage_tank_non_working;
+		}
+
+		if (tank.unloading_pump_status == activity_state::inactive)
 		{
-			return status::storage_tank_non_working;
+			co_return status::unloading_pump_not_active;
 		}
 
-		if (unloading_pump_status == activity_state::inactive)
+		if (op.get_grade() != tank.grade)
 		{
-			return status::unloading_pump_not_active;
+			co_return status::product_mismatch;
 		}
 
-		logging::inflog("== unload request ==");
+		logging::inflog<"tank {}: == unload request ==">(log_tank{ id });
 
 		auto possible_unloading_size = op.get_content_volume();
-		auto possible_unloading_volume = upper_acceptable_level - level_of_oil_products;
+		auto possible_unloading_volume = tank.upper_acceptable_level - tank.level_of_oil_products;
 		auto total_unloading_volume = std::min(op.get_content_volume(), possible_unloading_volume);
 
-		logging::inflog("possible unloading size: " + std::to_string(possible_unloading_size));
-		logging::inflog("possible unloading volume: " + std::to_string(possible_unloading_volume));
-		logging::inflog("total unloading volume: " + std::to_string(total_unloading_volume));
+		logging::inflog<"tank {}: possible unloading size: {}">(log_tank{ id }, possible_unloading_size);
+		logging::inflog<"tank {}: possible unloading volume: {}">(log_tank{ id }, possible_unloading_volume);
+		logging::inflog<"tank {}: total unloading volume: {}">(log_tank{ id }, total_unloading_volume);
 
 		if (total_unloading_volume == 0)
 		{
-			return status::high_level_of_oil_products;
+			co_return status::high_level_of_oil_products;
 		}
 
-		auto unloading_time = total_unloading_volume / unloading_speed;
+		auto unloading_time = total_unloading_volume / tank.unloading_speed;
 
-		logging::inflog("unloading time: " + std::to_string(unloading_time));
+		logging::inflog<"tank {}: unloading time: {}">(log_tank{ id }, unloading_time);
 
-		// Simulation of system operation
-		std::this_thread::sleep_for(std::chrono::seconds(unloading_time));
+		// Simulation of system operation, the session is suspended meanwhile
+		auto simulation = tracing::span("simulation", trace_group::tanks, id);
+		co_await wait(std::chrono::seconds(unloading_time));
+		simulation.finish();
 
-		level_of_oil_products += total_unloading_volume;
+		auto level = change_level_with([total_unloading_volume](uint64_t current) { return current + total_unloading_volume; });
 
-		logging::inflog("level of oil products: " + std::to_string(level_of_oil_products));
+		logging::inflog<"tank {}: level of oil products: {}">(log_tank{ id }, level);
 
-		if (level_of_oil_products == upper_acceptable_level)
+		if (level >= tank.upper_acceptable_level)
 		{
-			unloading_pump_status = activity_state::inactive;
+			set_unloading_pump_status(activity_state::inactive);
 
-			logging::inflog("unloading pump inactive");
+			logging::inflog<"tank {}: unloading pump inactive">(log_tank{ id });
 		}
 
-		/*if (loading_pump_status == activity_state::inactive &&
-			level_of_oil_products > lower_permissible_level)
-		{
-			loading_pump_status = activity_state::active;
-
-			logging::inflog("load pump active");
-		}*/
-
 		op.set_content_volume(op.get_content_volume() - total_unloading_volume);
 
-		return status::success;
+		co_return status::success;
 	}
 };
 
+// The tanks of a fleet, laid out by the memory resource of the fleet
+using tank_vector = std::pmr::vector<storage_tank>;
+
 #endif // !__STORAGE_TANK_HPP__
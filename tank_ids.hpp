@@ -0,0 +1,98 @@
+#ifndef __TANK_IDS_HPP__
+#define __TANK_IDS_HPP__
+
+#include <vector>
+#include <string>
+#include <charconv>
+#include <cstdint>
+
+#include "status.hpp"
+
+// Tank lists are written as ids and ranges separated by commas: "0-15,20,22"
+static const size_t max_snapshot_size = 128;
+
+namespace st
+{
+	[[nodiscard]] std::pair<std::vector<uint64_t>, status> stoids(std::string_view ids, size_t limit = max_snapshot_size)
+	{
+		auto result = std::vector<uint64_t>();
+
+		while (!ids.empty())
+		{
+			auto item = ids.substr(0, ids.find(','));
+			ids.remove_prefix(std::min(ids.size(), item.size() + 1));
+
+			uint64_t first = 0;
+			auto [first_end, first_error] = std::from_chars(item.data(), item.data() + item.size(), first);
+			if (first_error != std::errc())
+			{
+				return { {}, status::incorrect_tank_id };
+			}
+
+			auto last = first;
+			if (first_end != item.data() + item.size())
+			{
+				if (*first_end != '-')
+				{
+					return { {}, status::incorrect_tank_id };
+				}
+
+				auto [last_end, last_error] = std::from_chars(first_end + 1, item.data() + item.size(), last);
+				if (last_error != std::errc() || last_end != item.data() + item.size() || last < first)
+				{
+					return { {}, status::incorrect_tank_id };
+				}
+			}
+
+			if (last - first >= limit - result.size())
+			{
+				return { {}, status::incorrect_tank_id };
+			}
+
+			// Counted, so a range ending at the largest id ends too
+			for (uint64_t n = 0; n <= last - first; ++n)
+			{
+				result.push_back(first + n);
+			}
+		}
+
+		if (result.empty())
+		{
+			return { {}, status::incorrect_tank_id };
+		}
+
+		return { result, status::success };
+	}
+
+	// Consecutive ids are folded back into ranges
+	[[nodiscard]] std::string idstos(const uint64_t *ids, size_t count)
+	{
+		auto result = std::string();
+
+		for (size_t i = 0; i < count;)
+		{
+			auto last = i;
+			while (last + 1 < count && ids[last + 1] == ids[last] + 1)
+			{
+				++last;
+			}
+
+			if (!result.empty())
+			{
+				result.push_back(',');
+			}
+
+			result += std::to_string(ids[i]);
+			if (last != i)
+			{
+				result += '-' + std::to_string(ids[last]);
+			}
+
+			i = last + 1;
+		}
+
+		return result;
+	}
+}
+
+#endif // !__TANK_IDS_HPP__
@@ -0,0 +1,115 @@
+#ifndef __TANK_LEASE_HPP__
+#define __TANK_LEASE_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <optional>
+
+#include "task.hpp"
+#include "storage_tank.hpp"
+#include "instrumented_mutex.hpp"
+
+// A session's hold on its tank. Every command renews it; a session idle for longer than the timeout
+// gives the tank up, so the next waiting session gets it at once, and is read-only from then on
+// until it finds the tank free again. A timeout of zero keeps the tank for the whole session.
+class tank_lease
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct statistics
+	{
+		std::chrono::seconds idle_timeout;
+		// Leases given up by idle sessions and taken back by them later
+		uint64_t expired;
+		uint64_t renewed;
+		// Commands refused to read-only sessions
+		uint64_t refused;
+	};
+
+private:
+	// Long enough for an operator to look something up, short enough not to leave a tank offline for long
+	static inline std::atomic<int64_t> idle_timeout = 300;
+
+	static inline std::atomic<uint64_t> expired_count = 0;
+	static inline std::atomic<uint64_t> renewed_count = 0;
+	static inline std::atomic<uint64_t> refused_count = 0;
+
+	storage_tank &tank;
+	std::optional<instrumented_mutex::lock_guard> guard;
+	clock::time_point renewed_at;
+
+public:
+	explicit tank_lease(storage_tank &tank) noexcept: tank(tank)
+	{}
+
+	tank_lease(const tank_lease &) = delete;
+	tank_lease &operator=(const tank_lease &) = delete;
+
+	// Waits for the tank as long as it takes
+	[[nodiscard]] task<void> acquire()
+	{
+		auto locked = co_await tank._get_sync_object().scoped_lock();
+		guard.emplace(std::move(locked));
+		renewed_at = clock::now();
+	}
+
+	[[nodiscard]] bool held() const noexcept
+	{
+		return guard.has_value();
+	}
+
+	// Activity of the session: the lease runs on, or is taken back if the tank is free
+	[[nodiscard]] bool renew()
+	{
+		if (!guard)
+		{
+			if (!tank._get_sync_object().try_lock())
+			{
+				refused_count.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			guard.emplace(&tank._get_sync_object());
+			renewed_count.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		renewed_at = clock::now();
+		return true;
+	}
+
+	// Never while it is not held
+	[[nodiscard]] clock::time_point expires_at() const noexcept
+	{
+		auto timeout = idle_timeout.load(std::memory_order_relaxed);
+		return guard && timeout != 0 ? renewed_at + std::chrono::seconds(timeout) : clock::time_point::max();
+	}
+
+	void expire()
+	{
+		if (guard)
+		{
+			guard.reset();
+			expired_count.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Applies to the leases from their next renewal
+	static void set_idle_timeout(std::chrono::seconds timeout) noexcept
+	{
+		idle_timeout.store(timeout.count(), std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] static statistics get_statistics() noexcept
+	{
+		return {
+			std::chrono::seconds(idle_timeout.load(std::memory_order_relaxed)),
+			expired_count.load(std::memory_order_relaxed),
+			renewed_count.load(std::memory_order_relaxed),
+			refused_count.load(std::memory_order_relaxed)
+		};
+	}
+};
+
+#endif // !__TANK_LEASE_HPP__
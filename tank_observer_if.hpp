@@ -0,0 +1,13 @@
+#ifndef __TANK_OBSERVER_IF_HPP__
+#define __TANK_OBSERVER_IF_HPP__
+
+class storage_tank;
+
+class tank_observer_if
+{
+public:
+	// Called after every change of the tank state, possibly from several threads at once
+	virtual void state_changed(const storage_tank &tank) = 0;
+};
+
+#endif // !__TANK_OBSERVER_IF_HPP__
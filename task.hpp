@@ -0,0 +1,169 @@
+#ifndef __TASK_HPP__
+#define __TASK_HPP__
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+template <typename T>
+class task;
+
+namespace detail
+{
+	struct task_promise_base
+	{
+		std::coroutine_handle<> continuation = std::noop_coroutine();
+		std::exception_ptr exception;
+
+		struct final_awaiter
+		{
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			// Symmetric transfer back to the awaiting coroutine, the stack does not grow
+			template <typename P>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<P> finished) const noexcept
+			{
+				return finished.promise().continuation;
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		std::suspend_always initial_suspend() const noexcept
+		{
+			return {};
+		}
+
+		final_awaiter final_suspend() const noexcept
+		{
+			return {};
+		}
+
+		void unhandled_exception() noexcept
+		{
+			exception = std::current_exception();
+		}
+	};
+
+	template <typename T>
+	struct task_promise : task_promise_base
+	{
+		std::optional<T> value;
+
+		task<T> get_return_object() noexcept;
+
+		template <typename U>
+		void return_value(U &&result)
+		{
+			value.emplace(std::forward<U>(result));
+		}
+
+		T result()
+		{
+			if (exception)
+			{
+				std::rethrow_exception(exception);
+			}
+
+			return std::move(*value);
+		}
+	};
+
+	template <>
+	struct task_promise<void> : task_promise_base
+	{
+		task<void> get_return_object() noexcept;
+
+		void return_void() const noexcept
+		{}
+
+		void result()
+		{
+			if (exception)
+			{
+				std::rethrow_exception(exception);
+			}
+		}
+	};
+}
+
+// Lazily started coroutine, runs when awaited and resumes the awaiting coroutine when finished
+template <typename T = void>
+class [[nodiscard]] task
+{
+public:
+	using promise_type = detail::task_promise<T>;
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+public:
+	explicit task(std::coroutine_handle<promise_type> handle) noexcept: handle(handle)
+	{}
+
+	task(task &&other) noexcept: handle(std::exchange(other.handle, nullptr))
+	{}
+
+	task &operator=(task &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (handle)
+			{
+				handle.destroy();
+			}
+
+			handle = std::exchange(other.handle, nullptr);
+		}
+
+		return *this;
+	}
+
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+
+	~task()
+	{
+		if (handle)
+		{
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept
+	{
+		return !handle || handle.done();
+	}
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	T await_resume()
+	{
+		return handle.promise().result();
+	}
+};
+
+namespace detail
+{
+	template <typename T>
+	task<T> task_promise<T>::get_return_object() noexcept
+	{
+		return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+	}
+
+	inline task<void> task_promise<void>::get_return_object() noexcept
+	{
+		return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+	}
+}
+
+#endif // !__TASK_HPP__
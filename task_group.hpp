@@ -0,0 +1,66 @@
+#ifndef __TASK_GROUP_HPP__
+#define __TASK_GROUP_HPP__
+
+#include <atomic>
+#include <coroutine>
+
+#include "executor.hpp"
+
+// Runs coroutines concurrently on the current executor, co_await group.wait() resumes once all of them have finished
+class task_group
+{
+private:
+	// The waiter holds one extra count, so the group cannot complete before somebody waits for it
+	std::atomic<size_t> remaining = 1;
+	std::coroutine_handle<> waiter;
+	executor *scheduler = executor::current();
+
+	task<void> run(task<void> coroutine)
+	{
+		co_await coroutine;
+
+		if (remaining.fetch_sub(1) == 1)
+		{
+			scheduler->schedule(waiter);
+		}
+	}
+
+public:
+	task_group() = default;
+
+	task_group(const task_group &) = delete;
+	task_group &operator=(const task_group &) = delete;
+
+	// The group must outlive the coroutine, that is, it must be awaited
+	void spawn(task<void> coroutine)
+	{
+		remaining.fetch_add(1);
+		scheduler->spawn(run(std::move(coroutine)));
+	}
+
+	[[nodiscard]] auto wait() noexcept
+	{
+		struct wait_awaiter
+		{
+			task_group &group;
+
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+
+			bool await_suspend(std::coroutine_handle<> handle) const noexcept
+			{
+				group.waiter = handle;
+				return group.remaining.fetch_sub(1) != 1;
+			}
+
+			void await_resume() const noexcept
+			{}
+		};
+
+		return wait_awaiter{ *this };
+	}
+};
+
+#endif // !__TASK_GROUP_HPP__
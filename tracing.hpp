@@ -0,0 +1,263 @@
+#ifndef __TRACING_HPP__
+#define __TRACING_HPP__
+
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+
+#include "status.hpp"
+#include "logging.hpp"
+
+// What a span belongs to: the server itself, a session (by its key) or a tank (by its id).
+// Every group is a process of the exported trace and everything it contains is a thread of it.
+enum class trace_group : uint32_t
+{
+	server,
+	sessions,
+	tanks
+};
+
+// Spans recorded into a buffer per thread and exported as Chrome trace JSON (chrome://tracing, Perfetto).
+// A span is put on the track of what it belongs to, not of the thread it ran on: a session moves between
+// the workers, but its spans still nest on one line. When tracing is off a span costs an atomic load.
+class tracing
+{
+private:
+	struct span_record
+	{
+		const char *name;
+		trace_group group;
+		uint64_t track;
+		int64_t start;
+		int64_t duration;
+	};
+
+	// Only the newest spans are kept when a buffer overflows
+	static const size_t buffer_capacity = 1 << 16;
+
+	// The owner thread appends, the export reads, so a buffer has a lock that is almost never contended
+	struct thread_buffer
+	{
+		std::mutex mutex;
+		std::vector<span_record> spans;
+		size_t next = 0;
+		// Order in which the thread first recorded, shown as an argument of its spans
+		size_t thread;
+	};
+
+	static inline std::atomic<bool> enabled = false;
+	static inline const auto epoch = std::chrono::steady_clock::now();
+
+	static inline std::mutex registry_mutex;
+	static inline std::vector<std::shared_ptr<thread_buffer>> buffers;
+	static inline thread_local std::shared_ptr<thread_buffer> local_buffer;
+
+	[[nodiscard]] static int64_t now() noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	static void record(const span_record &span)
+	{
+		if (!local_buffer)
+		{
+			auto guard = std::lock_guard(registry_mutex);
+			local_buffer = buffers.emplace_back(std::make_shared<thread_buffer>());
+			local_buffer->thread = buffers.size() - 1;
+		}
+
+		auto guard = std::lock_guard(local_buffer->mutex);
+		if (local_buffer->spans.size() < buffer_capacity)
+		{
+			local_buffer->spans.push_back(span);
+		}
+		else
+		{
+			local_buffer->spans[local_buffer->next % buffer_capacity] = span;
+		}
+		++local_buffer->next;
+	}
+
+	static void append_number(std::string &text, int64_t value)
+	{
+		char number[24];
+		text.append(number, std::to_chars(number, std::end(number), value).ptr);
+	}
+
+	// Chrome traces count in microseconds, the fraction keeps the nanoseconds
+	static void append_microseconds(std::string &text, int64_t nanoseconds)
+	{
+		append_number(text, nanoseconds / 1000);
+		text.push_back('.');
+
+		char fraction[3];
+		auto fraction_value = nanoseconds % 1000;
+		for (size_t i = 3; i-- > 0; fraction_value /= 10)
+		{
+			fraction[i] = char('0' + fraction_value % 10);
+		}
+		text.append(fraction, 3);
+	}
+
+	[[nodiscard]] static std::string_view process_name(trace_group group) noexcept
+	{
+		switch (group)
+		{
+			case trace_group::server: return "server";
+			case trace_group::sessions: return "sessions";
+			default: return "tanks";
+		}
+	}
+
+	// The server has a single track, the accepting thread
+	static void append_track_name(std::string &text, trace_group group, uint64_t track)
+	{
+		switch (group)
+		{
+			case trace_group::server: text.append("accept"); return;
+			case trace_group::sessions: text.append("session "); break;
+			default: text.append("tank "); break;
+		}
+		append_number(text, int64_t(track));
+	}
+
+public:
+	// Measures from its construction to its end or finish(), whichever comes first
+	class span
+	{
+	private:
+		const char *name;
+		trace_group group;
+		uint64_t track;
+		int64_t start = 0;
+		bool active;
+
+	public:
+		// The name must outlive the trace, a string literal
+		span(const char *name, trace_group group, uint64_t track) noexcept:
+			name(name), group(group), track(track), active(enabled.load(std::memory_order_relaxed))
+		{
+			if (active)
+			{
+				start = now();
+			}
+		}
+
+		span(const span &) = delete;
+		span &operator=(const span &) = delete;
+
+		~span()
+		{
+			finish();
+		}
+
+		void finish()
+		{
+			if (active)
+			{
+				active = false;
+				record({ name, group, track, start, now() - start });
+			}
+		}
+	};
+
+	[[nodiscard]] static bool is_enabled() noexcept
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Starting again drops the spans of the previous run
+	static void set_enabled(bool state)
+	{
+		if (state && !enabled)
+		{
+			auto guard = std::lock_guard(registry_mutex);
+			for (auto &&buffer : buffers)
+			{
+				auto buffer_guard = std::lock_guard(buffer->mutex);
+				buffer->spans.clear();
+				buffer->next = 0;
+			}
+		}
+
+		enabled = state;
+	}
+
+	// Spans still open are not exported, the number of exported ones is returned
+	[[nodiscard]] static std::pair<size_t, status> export_chrome_trace(const std::string &path)
+	{
+		auto spans = std::vector<std::pair<span_record, size_t>>();
+		{
+			auto guard = std::lock_guard(registry_mutex);
+			for (auto &&buffer : buffers)
+			{
+				auto buffer_guard = std::lock_guard(buffer->mutex);
+				for (auto &&span : buffer->spans)
+				{
+					spans.emplace_back(span, buffer->thread);
+				}
+			}
+		}
+
+		std::sort(spans.begin(), spans.end(), [](auto &&lhs, auto &&rhs) { return lhs.first.start < rhs.first.start; });
+
+		// Processes and threads are named once, the first time they appear
+		auto named = std::set<std::pair<trace_group, uint64_t>>();
+		auto trace = std::string("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+		for (auto group : { trace_group::server, trace_group::sessions, trace_group::tanks })
+		{
+			trace.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+			append_number(trace, int64_t(group));
+			trace.append(",\"args\":{\"name\":\"").append(process_name(group)).append("\"}},\n");
+		}
+
+		for (auto &&[span, thread] : spans)
+		{
+			if (named.emplace(span.group, span.track).second)
+			{
+				trace.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+				append_number(trace, int64_t(span.group));
+				trace.append(",\"tid\":");
+				append_number(trace, int64_t(span.track));
+				trace.append(",\"args\":{\"name\":\"");
+				append_track_name(trace, span.group, span.track);
+				trace.append("\"}},\n");
+			}
+
+			trace.append("{\"name\":\"").append(span.name).append("\",\"ph\":\"X\",\"pid\":");
+			append_number(trace, int64_t(span.group));
+			trace.append(",\"tid\":");
+			append_number(trace, int64_t(span.track));
+			trace.append(",\"ts\":");
+			append_microseconds(trace, span.start);
+			trace.append(",\"dur\":");
+			append_microseconds(trace, span.duration);
+			trace.append(",\"args\":{\"thread\":");
+			append_number(trace, int64_t(thread));
+			trace.append("}},\n");
+		}
+
+		// The last comma is replaced by the end of the array
+		trace.resize(trace.size() - 2);
+		trace.append("\n]}\n");
+
+		auto file = std::ofstream(path, std::ios::trunc);
+		if (!file.write(trace.data(), trace.size()))
+		{
+			logging::errlog("unable to write the trace: " + path);
+			return { 0, status::write_error };
+		}
+
+		return { spans.size(), status::success };
+	}
+};
+
+#endif // !__TRACING_HPP__
@@ -0,0 +1,285 @@
+#ifndef __TRAFFIC_CAPTURE_HPP__
+#define __TRAFFIC_CAPTURE_HPP__
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#include "executor.hpp"
+#include "logging.hpp"
+#include "async_connection_if.hpp"
+
+// Records everything the sessions of the server read and write, so that real traffic can be replayed.
+// The file is a magic followed by records: a header of timestamp (nanoseconds since the capture
+// started), session number, event, command index and payload size, all little-endian, and then the
+// payload itself. A session reads a command and answers it before it reads the next one, so a command
+// read is numbered within its session and a response carries the number of the command it answers.
+class traffic_capture
+{
+public:
+	enum class event : uint32_t
+	{
+		// The payload is the handshake request: a tank id or "fleet"
+		open,
+		read,
+		write,
+		close
+	};
+
+	// Of the opening, the closing and of what a session writes before its first command
+	static const uint32_t no_command = UINT32_MAX;
+
+	struct record
+	{
+		uint64_t timestamp;
+		uint32_t session;
+		event kind;
+		uint32_t command;
+		std::string payload;
+	};
+
+	static constexpr std::string_view magic = "OILCAP02";
+	static const size_t header_size = sizeof(uint64_t) + 4 * sizeof(uint32_t);
+
+	static constexpr auto flush_interval = std::chrono::seconds(1);
+
+private:
+	// Records are collected in memory and written out by the flushing coroutine or once there are enough of them
+	static const size_t flush_threshold = 1 << 20;
+
+	static inline std::mutex capture_mutex;
+	static inline std::ofstream file;
+	static inline std::string pending;
+	static inline std::atomic<bool> enabled = false;
+	static inline std::atomic<uint32_t> sessions_count = 0;
+	static inline std::chrono::steady_clock::time_point start;
+
+	// Forwards to the session connection and records whatever got through
+	class captured_connection : public async_connection_if
+	{
+	private:
+		std::shared_ptr<async_connection_if> connection;
+		uint32_t session;
+		uint32_t commands_read = 0;
+
+	public:
+		captured_connection(std::shared_ptr<async_connection_if> connection, std::string_view handshake_request):
+			connection(std::move(connection)), session(sessions_count.fetch_add(1))
+		{
+			append(session, event::open, no_command, handshake_request);
+		}
+
+		~captured_connection()
+		{
+			append(session, event::close, no_command, {});
+		}
+
+		task<status> async_read(std::string &message) override
+		{
+			auto result = co_await connection->async_read(message);
+			if (st::is_success(result))
+			{
+				append(session, event::read, commands_read++, message);
+			}
+			co_return result;
+		}
+
+		task<status> async_write(std::string_view message) override
+		{
+			// The response is ready now, how long the queue takes to accept it is not the server's latency
+			append(session, event::write, commands_read == 0 ? no_command : commands_read - 1, message);
+			co_return co_await connection->async_write(message);
+		}
+
+		task<status> async_read(std::string &message, std::chrono::milliseconds timeout) override
+		{
+			auto result = co_await connection->async_read(message, timeout);
+			if (st::is_success(result))
+			{
+				append(session, event::read, commands_read++, message);
+			}
+			co_return result;
+		}
+
+		bool peer_alive() override
+		{
+			return connection->peer_alive();
+		}
+
+		uint64_t session_key() const override
+		{
+			return connection->session_key();
+		}
+
+		uint64_t peer_process() override
+		{
+			return connection->peer_process();
+		}
+
+		uint64_t reader_process() override
+		{
+			return connection->reader_process();
+		}
+	};
+
+	static void put(std::string &text, const void *value, size_t size)
+	{
+		text.append(static_cast<const char *>(value), size);
+	}
+
+	static void append(uint32_t session, event kind, uint32_t command, std::string_view payload)
+	{
+		if (!enabled)
+		{
+			return;
+		}
+
+		auto timestamp = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		auto size = uint32_t(payload.size());
+
+		auto guard = std::lock_guard(capture_mutex);
+		put(pending, &timestamp, sizeof(timestamp));
+		put(pending, &session, sizeof(session));
+		put(pending, &kind, sizeof(kind));
+		put(pending, &command, sizeof(command));
+		put(pending, &size, sizeof(size));
+		pending.append(payload);
+
+		if (pending.size() >= flush_threshold)
+		{
+			flush_pending();
+		}
+	}
+
+	// Called under the capture mutex
+	static void flush_pending()
+	{
+		if (!file.write(pending.data(), pending.size()).flush())
+		{
+			logging::errlog("unable to write the traffic capture, capturing stops");
+			enabled = false;
+		}
+		pending.clear();
+	}
+
+	// Whatever is still pending when the process exits is written out
+	struct final_flush
+	{
+		~final_flush()
+		{
+			stop_capture();
+		}
+	};
+
+	static inline final_flush at_exit;
+
+public:
+	[[nodiscard]] static status start_capture(const std::string &path)
+	{
+		auto guard = std::lock_guard(capture_mutex);
+
+		if (file.open(path, std::ios::binary | std::ios::trunc); !file.write(magic.data(), magic.size()))
+		{
+			logging::errlog("unable to create the traffic capture: " + path);
+			return status::write_error;
+		}
+
+		start = std::chrono::steady_clock::now();
+		enabled = true;
+		logging::inflog("capturing the traffic to " + path);
+
+		return status::success;
+	}
+
+	static void stop_capture()
+	{
+		auto guard = std::lock_guard(capture_mutex);
+		if (enabled.exchange(false) && !pending.empty())
+		{
+			flush_pending();
+		}
+		file.close();
+	}
+
+	// The session connection itself when nothing is captured
+	[[nodiscard]] static std::shared_ptr<async_connection_if> attach(std::shared_ptr<async_connection_if> connection, std::string_view handshake_request)
+	{
+		if (!enabled)
+		{
+			return connection;
+		}
+
+		return std::make_shared<captured_connection>(std::move(connection), handshake_request);
+	}
+
+	// Writes the records out regularly, so a server that is killed loses at most the last interval
+	static task<void> run()
+	{
+		while (enabled)
+		{
+			co_await executor::sleep_for(flush_interval);
+
+			auto guard = std::lock_guard(capture_mutex);
+			if (!pending.empty())
+			{
+				flush_pending();
+			}
+		}
+	}
+
+	// A capture cut short by a killed server ends with a partial record, which is dropped
+	[[nodiscard]] static std::pair<std::vector<record>, status> load(const std::string &path)
+	{
+		auto file = std::ifstream(path, std::ios::binary);
+		if (!file)
+		{
+			logging::errlog("unable to open the traffic capture: " + path);
+			return { {}, status::read_error };
+		}
+
+		auto content = std::string(size_t(file.seekg(0, std::ios::end).tellg()), '\0');
+		file.seekg(0).read(content.data(), content.size());
+
+		auto data = std::string_view(content);
+		if (!data.starts_with(magic))
+		{
+			logging::errlog("not a traffic capture: " + path);
+			return { {}, status::read_error };
+		}
+		data.remove_prefix(magic.size());
+
+		auto records = std::vector<record>();
+		while (data.size() >= header_size)
+		{
+			auto current = record();
+			auto size = uint32_t(0);
+			auto position = data.data();
+
+			std::memcpy(&current.timestamp, position, sizeof(current.timestamp));
+			std::memcpy(&current.session, position += sizeof(current.timestamp), sizeof(current.session));
+			std::memcpy(&current.kind, position += sizeof(current.session), sizeof(current.kind));
+			std::memcpy(&current.command, position += sizeof(current.kind), sizeof(current.command));
+			std::memcpy(&size, position += sizeof(current.command), sizeof(size));
+
+			if (data.size() - header_size < size)
+			{
+				break;
+			}
+
+			current.payload = data.substr(header_size, size);
+			data.remove_prefix(header_size + size);
+			records.push_back(std::move(current));
+		}
+
+		return { std::move(records), status::success };
+	}
+};
+
+#endif // !__TRAFFIC_CAPTURE_HPP__
@@ -0,0 +1,225 @@
+#ifndef __TRANSFER_PLANNER_HPP__
+#define __TRANSFER_PLANNER_HPP__
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <optional>
+#include <algorithm>
+
+#include "fleet.hpp"
+#include "task_group.hpp"
+
+enum class transfer_direction
+{
+	download,
+	unload
+};
+
+// Splits an order larger than one tank across several tanks and runs the parts at the same time.
+// Parts are sized so that they all take about as long: the order is done when its slowest part is.
+class transfer_planner
+{
+public:
+	struct part
+	{
+		uint64_t tank_id;
+		uint64_t volume;
+		uint64_t seconds;
+		uint64_t transferred = 0;
+		status result = status::success;
+	};
+
+	struct report
+	{
+		uint64_t requested;
+		uint64_t transferred;
+		std::chrono::duration<double> elapsed;
+		std::vector<part> parts;
+	};
+
+	// Bounds the number of tanks one order keeps locked
+	static const size_t max_parts = 64;
+
+private:
+	struct candidate
+	{
+		uint64_t tank_id;
+		uint64_t capacity;
+		uint64_t speed;
+	};
+
+	struct progress
+	{
+		std::atomic<size_t> finished = 0;
+		std::atomic<uint64_t> transferred = 0;
+	};
+
+	// Working tanks with an active pump, of the grade if one is given, the speed and the volume they can move in this direction
+	[[nodiscard]] static std::vector<candidate> find_candidates(fleet &tanks, transfer_direction direction, std::optional<product_grade> grade)
+	{
+		auto candidates = std::vector<candidate>();
+
+		for (size_t id = 0; id < tanks.size(); ++id)
+		{
+			auto tank = tanks[id].snapshot();
+			if (tank.work_state != working_state::work || (grade && tank.grade != *grade))
+			{
+				continue;
+			}
+
+			auto download = direction == transfer_direction::download;
+			auto pump = download ? tank.loading_pump_status : tank.unloading_pump_status;
+			auto speed = download ? tank.download_speed : tank.unloading_speed;
+			auto capacity = download ?
+				(tank.level_of_oil_products > tank.lower_permissible_level ? tank.level_of_oil_products - tank.lower_permissible_level : 0) :
+				(tank.upper_acceptable_level > tank.level_of_oil_products ? tank.upper_acceptable_level - tank.level_of_oil_products : 0);
+
+			if (pump == activity_state::active && speed != 0 && capacity != 0)
+			{
+				candidates.push_back({ id, capacity, speed });
+			}
+		}
+
+		// Faster pumps first, they shorten the order the most
+		std::sort(candidates.begin(), candidates.end(), [](const candidate &lhs, const candidate &rhs)
+		{
+			return lhs.speed != rhs.speed ? lhs.speed > rhs.speed : lhs.capacity > rhs.capacity;
+		});
+
+		return candidates;
+	}
+
+	// Finds the shortest time T in which the tanks move the volume, each tank moving min(capacity, speed * T)
+	[[nodiscard]] static std::vector<uint64_t> split(const std::vector<candidate> &chosen, uint64_t volume)
+	{
+		auto by_exhaustion = std::vector<size_t>(chosen.size());
+		for (size_t i = 0; i < chosen.size(); ++i)
+		{
+			by_exhaustion[i] = i;
+		}
+
+		std::sort(by_exhaustion.begin(), by_exhaustion.end(), [&chosen](size_t lhs, size_t rhs)
+		{
+			return double(chosen[lhs].capacity) / chosen[lhs].speed < double(chosen[rhs].capacity) / chosen[rhs].speed;
+		});
+
+		auto exhausted_volume = 0.0;
+		auto remaining_speed = 0.0;
+		for (auto &&tank : chosen)
+		{
+			remaining_speed += tank.speed;
+		}
+
+		// Tanks run dry (or full) one after another until the rest can move what is left in time
+		auto time = 0.0;
+		for (auto i : by_exhaustion)
+		{
+			auto exhaustion_time = double(chosen[i].capacity) / chosen[i].speed;
+			time = (volume - exhausted_volume) / remaining_speed;
+			if (time <= exhaustion_time)
+			{
+				break;
+			}
+
+			time = exhaustion_time;
+			exhausted_volume += chosen[i].capacity;
+			remaining_speed -= chosen[i].speed;
+		}
+
+		auto volumes = std::vector<uint64_t>(chosen.size());
+		auto assigned = uint64_t(0);
+		for (size_t i = 0; i < chosen.size(); ++i)
+		{
+			volumes[i] = std::min(chosen[i].capacity, uint64_t(chosen[i].speed * time));
+			assigned += volumes[i];
+		}
+
+		// What rounding left over goes to the fastest tanks with room for it
+		for (size_t i = 0; i < chosen.size() && assigned < volume; ++i)
+		{
+			auto extra = std::min(chosen[i].capacity - volumes[i], volume - assigned);
+			volumes[i] += extra;
+			assigned += extra;
+		}
+
+		return volumes;
+	}
+
+	static task<void> transfer(storage_tank &tank, part &current, transfer_direction direction, progress &total, size_t parts_count)
+	{
+		auto product = oil_product(current.volume, tank.get_product_grade());
+		if (direction == transfer_direction::unload)
+		{
+			product.set_content_volume(current.volume);
+		}
+
+		auto moving = direction == transfer_direction::download ? tank.download(product) : tank.unload(product);
+		current.result = co_await moving;
+		current.transferred = direction == transfer_direction::download ?
+			product.get_content_volume() : current.volume - product.get_content_volume();
+
+		auto finished = total.finished.fetch_add(1) + 1;
+		auto transferred = total.transferred.fetch_add(current.transferred) + current.transferred;
+
+		logging::inflog<"transfer plan: tank {} done, {} of {} parts, {} transferred">(log_tank{ current.tank_id }, finished, parts_count, transferred);
+	}
+
+public:
+	// Tanks held by sessions are left alone, the chosen ones are locked until their part is done
+	static task<report> run(fleet &tanks, transfer_direction direction, uint64_t volume, std::optional<product_grade> grade = std::nullopt)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto chosen = std::vector<candidate>();
+		auto locks = std::vector<instrumented_mutex::lock_guard>();
+		auto chosen_capacity = uint64_t(0);
+
+		for (auto &&tank : find_candidates(tanks, direction, grade))
+		{
+			if (chosen.size() == max_parts)
+			{
+				break;
+			}
+
+			if (tanks[tank.tank_id]._get_sync_object().try_lock())
+			{
+				locks.emplace_back(&tanks[tank.tank_id]._get_sync_object());
+				chosen.push_back(tank);
+				chosen_capacity += tank.capacity;
+			}
+		}
+
+		auto result = report{ volume, 0, {}, {} };
+		auto volumes = split(chosen, std::min(volume, chosen_capacity));
+
+		// Tanks left without a part are released right away
+		auto held = std::vector<instrumented_mutex::lock_guard>();
+		for (size_t i = 0; i < chosen.size(); ++i)
+		{
+			if (volumes[i] != 0)
+			{
+				result.parts.push_back({ chosen[i].tank_id, volumes[i], volumes[i] / chosen[i].speed });
+				held.push_back(std::move(locks[i]));
+			}
+		}
+		locks.clear();
+
+		logging::inflog<"transfer plan: {} over {} tanks">(volume, result.parts.size());
+
+		auto total = progress();
+		auto group = task_group();
+		for (auto &&current : result.parts)
+		{
+			group.spawn(transfer(tanks[current.tank_id], current, direction, total, result.parts.size()));
+		}
+		co_await group.wait();
+
+		result.transferred = total.transferred.load();
+		result.elapsed = std::chrono::steady_clock::now() - start;
+
+		co_return result;
+	}
+};
+
+#endif // !__TRANSFER_PLANNER_HPP__
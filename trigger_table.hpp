@@ -0,0 +1,171 @@
+#ifndef __TRIGGER_TABLE_HPP__
+#define __TRIGGER_TABLE_HPP__
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "status.hpp"
+
+enum class trigger_condition
+{
+	level_above,
+	level_below
+};
+
+enum class trigger_action
+{
+	activate_loading_pump,
+	deactivate_loading_pump,
+	activate_unloading_pump,
+	deactivate_unloading_pump,
+	alert
+};
+
+namespace st
+{
+	[[nodiscard]] trigger_condition stotc(const std::string &condition)
+	{
+		return condition == "above" ? trigger_condition::level_above : trigger_condition::level_below;
+	}
+
+	[[nodiscard]] std::string tctos(trigger_condition condition)
+	{
+		return condition == trigger_condition::level_above ? "above" : "below";
+	}
+
+	[[nodiscard]] trigger_action stota(const std::string &action)
+	{
+		if (action == "activate loading pump") return trigger_action::activate_loading_pump;
+		if (action == "deactivate loading pump") return trigger_action::deactivate_loading_pump;
+		if (action == "activate unloading pump") return trigger_action::activate_unloading_pump;
+		if (action == "deactivate unloading pump") return trigger_action::deactivate_unloading_pump;
+		return trigger_action::alert;
+	}
+
+	[[nodiscard]] std::string tatos(trigger_action action)
+	{
+		switch (action)
+		{
+			case trigger_action::activate_loading_pump: return "activate loading pump";
+			case trigger_action::deactivate_loading_pump: return "deactivate loading pump";
+			case trigger_action::activate_unloading_pump: return "activate unloading pump";
+			case trigger_action::deactivate_unloading_pump: return "deactivate unloading pump";
+			default: return "alert";
+		}
+	}
+}
+
+// Automation rules of one tank, compiled into thresholds sorted by level.
+// Rules are edge-triggered: "above X" fires when the level rises past X, "below X" when it falls under X.
+class trigger_table
+{
+public:
+	struct trigger
+	{
+		uint64_t threshold;
+		trigger_condition condition;
+		trigger_action action;
+	};
+
+	// Keeps evaluation bounded no matter how the rules are configured
+	static const size_t max_triggers = 16;
+
+private:
+	std::vector<trigger> rising;
+	std::vector<trigger> falling;
+
+	// Compares a trigger with a trigger or with a bare level, levels are looked up without a probe trigger
+	struct by_threshold
+	{
+		bool operator()(const trigger &lhs, const trigger &rhs) const noexcept
+		{
+			return lhs.threshold < rhs.threshold;
+		}
+
+		bool operator()(const trigger &lhs, uint64_t level) const noexcept
+		{
+			return lhs.threshold < level;
+		}
+
+		bool operator()(uint64_t level, const trigger &rhs) const noexcept
+		{
+			return level < rhs.threshold;
+		}
+	};
+
+public:
+	status add(const trigger &rule)
+	{
+		if (rising.size() + falling.size() == max_triggers)
+		{
+			return status::too_many_rules;
+		}
+
+		auto &&triggers = rule.condition == trigger_condition::level_above ? rising : falling;
+		triggers.insert(std::upper_bound(triggers.begin(), triggers.end(), rule, by_threshold()), rule);
+
+		return status::success;
+	}
+
+	void clear() noexcept
+	{
+		rising.clear();
+		falling.clear();
+	}
+
+	[[nodiscard]] bool empty() const noexcept
+	{
+		return rising.empty() && falling.empty();
+	}
+
+	[[nodiscard]] std::string to_string() const
+	{
+		auto rules = std::string();
+
+		for (auto &&triggers : { &rising, &falling })
+		{
+			for (auto &&rule : *triggers)
+			{
+				if (!rules.empty())
+				{
+					rules.push_back('\n');
+				}
+
+				rules += "when level " + st::tctos(rule.condition) + ' ' + std::to_string(rule.threshold)
+					+ " then " + st::tatos(rule.action);
+			}
+		}
+
+		return rules.empty() ? "no rules" : rules;
+	}
+
+	// Calls the handler for every trigger crossed by the level change
+	template <typename F>
+	void fire(uint64_t old_level, uint64_t new_level, F &&handler) const
+	{
+		if (new_level > old_level)
+		{
+			// above X: old_level <= X < new_level
+			auto first = std::lower_bound(rising.begin(), rising.end(), old_level, by_threshold());
+
+			for (; first != rising.end() && first->threshold < new_level; ++first)
+			{
+				handler(*first);
+			}
+		}
+		else if (new_level < old_level)
+		{
+			// below X: new_level < X <= old_level
+			auto first = std::upper_bound(falling.begin(), falling.end(), new_level, by_threshold());
+
+			for (; first != falling.end() && first->threshold <= old_level; ++first)
+			{
+				handler(*first);
+			}
+		}
+	}
+};
+
+#endif // !__TRIGGER_TABLE_HPP__